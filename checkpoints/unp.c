@@ -18,7 +18,7 @@ readn(int fd, void* buff, size_t nbytes) {
   char *ptr = (char*) buff;
 
   while (nleft > 0) {
-    int nread = read(fd, ptr, nleft);
+    int nread = backend->read(fd, ptr, nleft);
 
     if (nread == 0) { // EOF
       return nbytes - nleft;
@@ -44,7 +44,7 @@ writen(int fd, const void* buff, size_t nbytes) {
   const char *ptr = (const char *) buff;
 
   while (nleft > 0) {
-    int nwritten = write(fd, ptr, nleft);
+    int nwritten = backend->write(fd, ptr, nleft);
 
     if (nwritten == 0 || (nwritten < 0 && errno != EINTR)) {
       return -1;
@@ -65,7 +65,7 @@ readline(int fd, void* buff, size_t maxlen) {
   ssize_t n;
   for (n = 1; n < maxlen; n++) {
     again:
-      rc = read(fd, &c, 1);
+      rc = backend->read(fd, &c, 1);
       if (rc == 1) {
         *ptr++ = c;
         if (c == '\n') {
@@ -86,7 +86,7 @@ readline(int fd, void* buff, size_t maxlen) {
 }
 
 void Connect(int sockfd, struct sockaddr *addr, socklen_t len) {
-  int rv = connect(sockfd, addr, len);
+  int rv = backend->connect(sockfd, addr, len);
   if (rv < 0) {
     printf("connect failed %s\n", strerror(errno));
     exit(-1);
@@ -102,7 +102,7 @@ void Inet_pton(int af, const char *src, void *dst) {
 }
 
 int Socket(int domain, int type, int protocol) {
-int rv = socket(domain, type, protocol);
+int rv = backend->socket(domain, type, protocol);
   if (rv < 0) {
     printf("socket failed %s\n", strerror(errno));
     exit(-1);
@@ -111,7 +111,7 @@ int rv = socket(domain, type, protocol);
 }
 
 void Bind(int sockfd, struct sockaddr *addr, size_t len) {
-  int rv = bind(sockfd, addr, len);
+  int rv = backend->bind(sockfd, addr, len);
   if (rv < 0) {
     printf("bind failed %s\n", strerror(errno));
     exit(-1);
@@ -119,7 +119,7 @@ void Bind(int sockfd, struct sockaddr *addr, size_t len) {
 }
 
 int Accept(int sockfd, struct sockaddr *addr, socklen_t *len) {
-  int rv = accept(sockfd, addr, len);
+  int rv = backend->accept(sockfd, addr, len);
   if (rv < 0) {
     printf("accept failed %s\n", strerror(errno));
     exit(-1);
@@ -128,7 +128,7 @@ int Accept(int sockfd, struct sockaddr *addr, socklen_t *len) {
 }
 
 void Listen(int sockfd, int backlog) {
-  int rv = listen(sockfd, backlog);
+  int rv = backend->listen(sockfd, backlog);
   if (rv < 0) {
     printf("listen failed %s\n", strerror(errno));
     exit(-1);
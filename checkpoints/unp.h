@@ -13,6 +13,8 @@
 #include <errno.h>
 #include <zconf.h>
 
+#include "backend.h"
+
 #define MAXLINE 4096
 
 ssize_t readn(int fd, void *buff, size_t nbytes);
@@ -0,0 +1,96 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "backend.h"
+
+#define BACKEND(name, F)                                            \
+    {                                                               \
+        name, F(socket), F(bind), F(listen), F(accept), F(connect), \
+        F(read), F(write), F(close), F(setsockopt), F(getsockopt),  \
+        F(sendto), F(recvfrom)                                      \
+    }
+
+#ifdef WRAP_BACKEND
+// the programs are linked with -Wl,--wrap=[func] for each function in
+// WRAP_FUNCS, i.e. each __wrap_[func] the user-space stack provides. the libc
+// function of a wrapped call can only be reached through __real_[func].
+// both are weak here, so a function the stack doesn't provide is called
+// directly and goes to the kernel.
+#define DECLARE(ret, func, ...)                                     \
+    extern ret __real_##func(__VA_ARGS__) __attribute__((weak));    \
+    extern ret __wrap_##func(__VA_ARGS__) __attribute__((weak));
+#define REAL(func) (__real_##func ? __real_##func : func)
+#define WRAP(func) (__wrap_##func ? __wrap_##func : REAL(func))
+
+DECLARE(int, socket, int, int, int)
+DECLARE(int, bind, int, const struct sockaddr*, socklen_t)
+DECLARE(int, listen, int, int)
+DECLARE(int, accept, int, struct sockaddr*, socklen_t*)
+DECLARE(int, connect, int, const struct sockaddr*, socklen_t)
+DECLARE(ssize_t, read, int, void*, size_t)
+DECLARE(ssize_t, write, int, const void*, size_t)
+DECLARE(int, close, int)
+DECLARE(int, setsockopt, int, int, int, const void*, socklen_t)
+DECLARE(int, getsockopt, int, int, int, void*, socklen_t*)
+DECLARE(ssize_t, sendto, int, const void*, size_t, int,
+    const struct sockaddr*, socklen_t)
+DECLARE(ssize_t, recvfrom, int, void*, size_t, int, struct sockaddr*,
+    socklen_t*)
+
+// weak symbols are resolved at load time, so the tables are filled in
+// initBackend().
+static backend_t kernelBackend;
+static backend_t userBackend;
+#else
+#define REAL(func) func
+
+static backend_t kernelBackend = BACKEND("kernel", REAL);
+#endif
+
+const backend_t *backend = &kernelBackend;
+const backend_t *kernelStack = &kernelBackend;
+
+const backend_t *findBackend(const char *name)
+{
+    if (strcmp(name, kernelBackend.name) == 0)
+    {
+        return &kernelBackend;
+    }
+#ifdef WRAP_BACKEND
+    if (strcmp(name, userBackend.name) == 0)
+    {
+        return &userBackend;
+    }
+#endif
+    return NULL;
+}
+
+// runs before main(), so every program(including the checkpoints) picks the
+// backend the same way without touching its argument parsing.
+__attribute__((constructor)) static void initBackend()
+{
+    const char *name = getenv("MPERF_BACKEND");
+#ifdef WRAP_BACKEND
+    backend_t kernel = BACKEND("kernel", REAL);
+    backend_t user = BACKEND("user", WRAP);
+
+    kernelBackend = kernel;
+    userBackend = user;
+#endif
+
+    if (name == NULL || *name == 0)
+    {
+        return;
+    }
+    if ((backend = findBackend(name)) == NULL)
+    {
+        fprintf(stderr, "Unknown socket backend \"%s\"", name);
+#ifndef WRAP_BACKEND
+        fprintf(stderr, "(built without a user-space stack)");
+#endif
+        fprintf(stderr, ".\n");
+        exit(1);
+    }
+}
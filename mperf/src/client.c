@@ -1,64 +1,163 @@
+#include "control.h"
+#include "live.h"
+#include "many.h"
+#include "mptcp.h"
 #include "sndrcv.h"
+#include "store.h"
+#include "trace.h"
 #include "util.h"
 
 const char *usage = 
     "  -B [local ip]:\n"
-    "    Specify the local ip address.\n"
+    "    Specify the local ip address, or a comma-separated list of them to\n"
+    "    stripe parallel streams across.\n"
     "  -b [local port]:\n"
-    "    Specify the local port.\n"
+    "    Specify the local port, parallel stream i binds [local port] + i.\n"
     "    **: STILL DEVELOPPING, BUGGY!"
     "    (default: let system choose a port randomly).\n"
+    "  -C [count]:\n"
+    "    Open [count] concurrent connections(up to 65536) and run a long test\n"
+    "    of -t seconds over all of them, served by a single epoll loop on\n"
+    "    both ends. Reports the connect and accept rate, the memory per\n"
+    "    connection and how fairly the bytes were shared. Needs the kernel\n"
+    "    stack, the connections use the -B and -c lists round-robin. See -R.\n"
     "  -c [server ip]:\n"
-    "    Specify the server ip address.\n"
+    "    Specify the server ip address, or a comma-separated list of them.\n"
+    "    Stream i uses the (i mod n)th local and remote address, the\n"
+    "    controller is reached through the first ones.\n"
     "    *: Required\n"
+    "  -e [plan]:\n"
+    "    Run a plan of tests back to back after a single configure, e.g.\n"
+    "    \"long 10s; fix 1KB x100; reverse long 10s\". Each test is a long\n"
+    "    test of [time]s or a fix test of [size](K, M or G)B, sent by the\n"
+    "    client with reverse and run N times with xN, every run on new data\n"
+    "    connections. Reports every run and a summary of each test. -N, -m,\n"
+    "    -T and the probe options apply to all tests, the size of a probe\n"
+    "    test is its packets per probe. Replaces -t, -n and -s, can't be\n"
+    "    used with -S, -C or -X.\n"
+    "  -f:\n"
+    "    Use TCP Fast Open: the control request of -H and the first data of\n"
+    "    the connections the client writes first(-s or -S) go in the SYN.\n"
+    "    Needs a cookie of the server from an earlier connection and\n"
+    "    net.ipv4.tcp_fastopen enabled on both hosts(1 on the client, 2 on\n"
+    "    the server). Reports whether it was used.\n"
     "  -h:\n"
     "    Print this message and exit.\n"
-#ifdef PROBE
+    "  -H:\n"
+    "    Configure the test over a TCP connection to the controller instead\n"
+    "    of a single UDP request(for a controller with a user-space stack).\n"
     "  -i [interval]:\n"
-	"    Specify the time interval(ms) between two send operations.\n"
+	"    Probe mode: specify the time interval(ms) between two send\n"
+	"    operations.\n"
 	"    (default: 4).\n"
     "  -I [interval]:\n"
-	"    Specify the time interval(ms) between two probe operations.\n"
+	"    Probe mode: specify the time interval(ms) between two probe\n"
+	"    operations.\n"
 	"    (default: 1000).\n"
-#endif
+    "  -j [path]:\n"
+    "    Write a Chrome trace(JSON, for chrome://tracing or Perfetto) of the\n"
+    "    phases of the test on both ends to [path]: the control exchange,\n"
+    "    the controller's terminate, fork and wait for the server, the\n"
+    "    server's configure and, per stream, connect, first to last byte\n"
+    "    and close. The server's clock is aligned with the client's over\n"
+    "    the connection of its results. Can't be used with -e, -C or -X.\n"
+    "  -K [secret]:\n"
+    "    Shared secret of the controller's UDP requests(default: $MPERF_KEY,\n"
+    "    or none).\n"
     "  -l [path]:\n"
     "    Specify the file to save the log.\n"
-#ifndef PROBE
+    "  -M:\n"
+    "    Use MPTCP for the data connection(falls back to TCP if the kernel\n"
+    "    doesn't support it) and report the subflows after the test.\n"
+    "    The server should be started with -M as well.\n"
+    "  -L [count]:\n"
+    "    Probe mode: do [count] loop tests(default: 1).\n"
+    "  -m [mode]:\n"
+    "    Select the test mode(default: bulk). Each mode has its own sending\n"
+    "    and receiving loops, the server follows the client.\n"
+    "      bulk:    send data as fast as possible.\n"
+    "      probe:   the sender sends trains of small probe packets, see -i,\n"
+    "               -I, -L, -n and -z. The receiver estimates the capacity\n"
+    "               and the available bandwidth of the path from their\n"
+    "               arrival times.\n"
+    "      check:   the receiver checks the content of the data.\n"
+    "      trickle: long tests send a byte every 50ms.\n"
+    "      slow:    long tests send a packet every second.\n"
     "  -n [size]:\n"
     "    Tell the program to do fix test with size=[size]Bytes.\n"
-#else
-    "  -L [count]:\n"
-    "    Do [count] loop tests(default: 1).\n"
-    "  -n [count]: \n"
-    "    Send [count] probe packets per probe(default: 25).\n"
-#endif
+    "    Probe mode: send [size] probe packets per probe(default: 255).\n"
+    "  -N [streams]:\n"
+    "    Run [streams] parallel streams(default: the length of the longer\n"
+    "    one of the -B and -c lists).\n"
+    "  -o [path]:\n"
+    "    Append the results of every run to the results store at [path],\n"
+    "    created if it doesn't exist: the host, the path, the configuration,\n"
+    "    the results of both ends and when the run started and ended, in a\n"
+    "    record of its own. Query it with mperf-history. Can't be used with\n"
+    "    -C or -X.\n"
     "  -p [port]:\n"
-    "    Specify port number of server.\n"
+    "    Specify port number of server. The controller tells the client\n"
+    "    the data port of its test, which differs from [port] when it\n"
+    "    runs concurrent tests.\n"
     "    *: Required\n"
     "  -P [cport]:\n"
     "    Specify port number of controller(default: [port] + 1).\n"
+    "  -Q [priority]:\n"
+    "    Priority of the test in the queue of a controller started with -q,\n"
+    "    higher first(default: 0).\n"
+    "  -R [bytes]:[interval]:\n"
+    "    With -C, every connection sends a burst of [bytes] every\n"
+    "    [interval]ms, the bursts spread evenly over the interval.\n"
+    "    (default: 1024:1000).\n"
     "  -s:\n"
     "    If specified, let the client send data.\n"
-#ifndef PROBE
+    "  -S [count]:\n"
+    "    Run [count] fix tests in a session: the data connection and the\n"
+    "    server process are kept across the tests, each of which is started\n"
+    "    by a header on the data connection instead of a new handshake.\n"
     "  -t [time]:\n"
     "    Tell the program to do long test with timeLength=[time]seconds.\n"
     "  -T [Time]:\n"
     "    End test and exit after [Time] seconds.\n"
     "      for long tests, default: [time] + 10.\n"
     "      for fix tests, default: 200.\n"
-#endif
     "  -v:\n"
     "    Print version information and exit.\n"
     "  -V[level]:\n"
-    "    Print verbose log. Use -V2 for even more verbose log.";
+    "    Print verbose log. Use -V2 for even more verbose log.\n"
+    "  -w [seconds]:\n"
+    "    Watch the tests of the controller instead of running one: print the\n"
+    "    state, Bytes and rate of each of them every [seconds] until none is\n"
+    "    waiting or running(0: once). Needs only -c and -p.\n"
+    "  -X [host:port]:\n"
+    "    Incast: configure the controllers at the comma-separated host:port\n"
+    "    pairs, connect to each of their servers and start all the senders\n"
+    "    at once toward this client. Reports the goodput of every sender,\n"
+    "    the aggregate and when the last sender finished. Replaces -c, -p\n"
+    "    and -P.\n"
+    "  -z [size]:\n"
+    "    Probe mode: send [size]Bytes per probe packet(default: 1). Use\n"
+    "    -i 0 and about an MSS to estimate the capacity from packet pairs.";
 
 static char *localIP = NULL;
 static char *serverIP = NULL;
+static char *localIPs[MAX_ADDRS];
+static char *serverIPs[MAX_ADDRS];
+static int localCount = 0;
+static int serverCount = 0;
+static char *incastIPs[MAX_STREAMS];
+static unsigned short incastPorts[MAX_STREAMS];
+static int incastCount = 0;
+static int streams = 0;
+static char streamNames[MAX_STREAMS][64];
+static char *pStreamNames[MAX_STREAMS];
+static int streamFDs[MAX_STREAMS];
 static unsigned short localPort = 0;
 static unsigned short port = 0;
 static unsigned short cport = 0;
 static int timelen = -1;
 static int localTime = -1;
+static int timeout = -1;
 static int size = -1;
 static char *path = NULL;
 static int connfd = -1;
@@ -66,72 +165,218 @@ static int mss = 0;
 static char packetBuf[67108864];
 //static int rwnd = 3145728;
 static int reverse = 0;
-#ifdef PROBE
+static int mptcp = 0;
+static int sessionCount = 0;
+static int priority = 0;
+static int tcpControl = 0;
+static int fastOpen = 0;
+static char *secret = NULL;
+static int sessionDone = 0;
+static int mode = MODE_BULK;
 static int sendInterval = 4;
 static int probeInterval = 1000;
 static int loop = 0;
-#endif
+static int probeLen = 1;
+static char *planText = NULL;
+// seconds between two snapshots of -w, -1 without it.
+static int watchEvery = -1;
+static char *tracePath = NULL;
+static char *storePath = NULL;
+// when the run being stored started, us since the epoch.
+static int64_t runStart = 0;
+// the trace of the server, and how far its clock is ahead of ours.
+static traceEvent_t serverTrace[MAX_TRACE];
+static int serverTraceCount = 0;
+static int64_t serverOffset = 0;
+// the server is on this host, its clock is ours.
+static int sameClock = 0;
+static plan_t plan;
+static many_t many = { 0, 0, 1024, 1000, 0 };
+
+// makes t the test being run, with the default timeouts of the client.
+static void loadTest(const planTest_t *t)
+{
+    reverse = t->type & FLAG_REVERSE;
+    size = t->type & TYPE_FIX ? t->size : -1;
+    timelen = t->type & TYPE_FIX ? -1 : t->time;
+    if ((localTime = timeout) < 0)
+    {
+        localTime = size > 0 ? 200 : timelen + 10;
+    }
+}
+
+// the plan of -e, or a plan of the single test of the other options.
+static void buildPlan()
+{
+    static char text[PLAN_TEXT];
+    planTest_t *t;
+    char *bad;
+    int i;
+
+    if (planText != NULL)
+    {
+        snprintf(text, sizeof(text), "%s", planText);
+        if ((bad = parsePlan(&plan, text)) != NULL)
+        {
+            logFatal("Invalid plan(%s).", bad);
+        }
+    }
+    else
+    {
+        plan.count = 1;
+        plan.tests[0].type = (size > 0 ? TYPE_FIX : TYPE_LONG) | reverse;
+        plan.tests[0].repeat = 1;
+        plan.tests[0].time = timelen;
+        plan.tests[0].size = size;
+    }
+    plan.flags = FLAG_PORT;
+    // the senders of an incast and the connections of -C report on their
+    // own.
+    if (incastCount == 0 && many.conns == 0)
+    {
+        plan.flags |= FLAG_RESULTS;
+    }
+    if (sessionCount > 0)
+    {
+        plan.flags |= FLAG_SESSION;
+    }
+    if (tracePath != NULL)
+    {
+        plan.flags |= FLAG_TRACE;
+    }
+    // the size of a many-connection test is the burst.
+    if (many.conns > 0)
+    {
+        plan.flags |= FLAG_MANY;
+        plan.tests[0].size = many.burst;
+    }
+    // every server of an incast sends a single stream.
+    if (incastCount > 0)
+    {
+        plan.flags |= FLAG_INCAST;
+    }
+    plan.streams = incastCount > 0 ? 1 : streams;
+    plan.mode = mode;
+    plan.probeLen = probeLen;
+    plan.conns = many.conns;
+    plan.interval = many.interval;
+    plan.priority = priority;
+    for (i = 0; i < plan.count; ++i)
+    {
+        t = plan.tests + i;
+        if (mode == MODE_PROBE && !(t->type & TYPE_FIX))
+        {
+            logFatal("Probe mode only runs fix tests.");
+        }
+        t->timeout = timeout;
+        if (mode == MODE_PROBE)
+        {
+            t->loop = loop;
+            t->sendInterval = sendInterval;
+            t->probeInterval = probeInterval;
+        }
+    }
+    loadTest(plan.tests);
+}
 
 static void parseArguments(int argc, char **argv)
 {
     char c;
+    int i;
     optind = 0;
-#ifdef PROBE
-    while ((c = getopt(argc, argv, "B:b:c:hi:I:l:L:n:p:P:svV::")) != EOF)
-#else
-    while ((c = getopt(argc, argv, "B:b:c:hl:n:p:P:st:T:vV::")) != EOF)
-#endif
+    while ((c = getopt(argc, argv,
+        "B:b:C:c:e:fhHi:I:j:K:l:L:m:MN:n:o:p:P:Q:R:sS:t:T:vV::w:X:z:")) != EOF)
     {
         switch (c)
         {
         case 'B':
-            localIP = optarg;
+            localCount = splitList(optarg, localIPs, MAX_ADDRS);
             break;
         case 'b':
             localPort = atoi(optarg);
             break;
+        case 'C':
+            many.conns = atoi(optarg);
+            break;
         case 'c':
-            serverIP = optarg;
+            serverCount = splitList(optarg, serverIPs, MAX_ADDRS);
+            break;
+        case 'e':
+            planText = optarg;
+            break;
+        case 'f':
+            fastOpen = 1;
             break;
         case 'h':
             printUsageAndExit(argv);
             break;
-#ifdef PROBE
+        case 'H':
+            tcpControl = 1;
+            break;
         case 'i':
             sendInterval = atoi(optarg);
             break;
         case 'I':
             probeInterval = atoi(optarg);
             break;
-#endif
+        case 'j':
+            tracePath = optarg;
+            break;
+        case 'K':
+            secret = optarg;
+            break;
         case 'l':
             path = optarg;
             break;
-#ifdef PROBE
         case 'L':
             loop = atoi(optarg);
             break;
-#endif
+        case 'm':
+            if ((mode = findTestMode(optarg)) < 0)
+            {
+                logFatal("Unknown test mode %s.", optarg);
+            }
+            break;
+        case 'M':
+            mptcp = 1;
+            break;
+        case 'N':
+            streams = atoi(optarg);
+            break;
         case 'n':
             size = atoi(optarg);
             break;
+        case 'o':
+            storePath = optarg;
+            break;
         case 'p':
             port = atoi(optarg);
             break;
         case 'P':
             cport = atoi(optarg);
             break;
+        case 'Q':
+            priority = atoi(optarg);
+            break;
+        case 'R':
+            if (sscanf(optarg, "%d:%d", &many.burst, &many.interval) != 2)
+            {
+                logFatal("Invalid burst %s, expected [bytes]:[interval].",
+                    optarg);
+            }
+            break;
         case 's':
             reverse = FLAG_REVERSE;
             break;
-#ifndef PROBE
+        case 'S':
+            sessionCount = atoi(optarg);
+            break;
         case 't':
             timelen = atoi(optarg);
             break;
         case 'T':
-            localTime = atoi(optarg);
+            timeout = atoi(optarg);
             break;
-#endif
         case 'v':
             printVersionAndExit("mperf-client");
             break;
@@ -145,6 +390,26 @@ static void parseArguments(int argc, char **argv)
                 setVerbose(1);
             }
             break;
+        case 'w':
+            watchEvery = atoi(optarg);
+            break;
+        case 'X':
+            incastCount = splitList(optarg, incastIPs, MAX_STREAMS);
+            for (i = 0; i < incastCount; ++i)
+            {
+                char *colon = strrchr(incastIPs[i], ':');
+
+                if (colon == NULL || (incastPorts[i] = atoi(colon + 1)) == 0)
+                {
+                    logFatal("Invalid controller %s, expected host:port.",
+                        incastIPs[i]);
+                }
+                *colon = 0;
+            }
+            break;
+        case 'z':
+            probeLen = atoi(optarg);
+            break;
         default:
             logWarning("Unexpected command-line option %c!", (char)optopt);
             printUsageAndExit(argv);
@@ -155,46 +420,120 @@ static void parseArguments(int argc, char **argv)
     {
         cport = port + 1;
     }
-    if (localTime < 0)
+    if (incastCount > 0)
     {
-        if (size > 0)
-        {
-            localTime = 200;
-        }
-        else
+        if (reverse || sessionCount > 0 || many.conns > 0 || streams > 0 ||
+            serverCount > 0)
         {
-            localTime = timelen + 10;
+            logFatal("-X can't be used with -s, -S, -C, -N or -c.");
         }
+        // the receiving streams take the place of the parallel streams.
+        streams = incastCount;
+        port = incastPorts[0] - 1;
     }
-
-    if (serverIP == NULL)
+    else if (serverCount == 0)
     {
         logFatal("No server IP specified.");
     }
+    serverIP = serverIPs[0];
+    localIP = localCount ? localIPs[0] : NULL;
+    if (streams <= 0)
+    {
+        streams = many.conns ? 1 :
+            localCount > serverCount ? localCount : serverCount;
+    }
+    if (streams > MAX_STREAMS)
+    {
+        logFatal("Too many streams(max %d).", MAX_STREAMS);
+    }
     if (port == 0)
     {
         logFatal("No legal port number specified.");
     }
-#ifdef PROBE
-    size &= 0xFF;
-#else
-    if (timelen < 0 && size < 0)
+    if (localPort > 0 && localPort + streams - 1 > 65535)
+    {
+        logFatal("Local ports %d to %d out of range.", localPort,
+            localPort + streams - 1);
+    }
+    if (planText != NULL)
+    {
+        if (timelen >= 0 || size >= 0 || reverse || sessionCount > 0 ||
+            many.conns > 0 || incastCount > 0)
+        {
+            logFatal("-e can't be used with -t, -n, -s, -S, -C or -X.");
+        }
+    }
+    else if (mode == MODE_PROBE)
+    {
+        // probe tests are always fix tests.
+        if (size <= 0)
+        {
+            size = 255;
+        }
+    }
+    else if (timelen < 0 && size < 0 && watchEvery < 0)
     {
         logFatal("No legal -t or -n argument specified.");
     }
-#endif
-    if (path != NULL)
+    if (tracePath != NULL &&
+        (planText != NULL || many.conns > 0 || incastCount > 0))
     {
-        redirectLogTo(path);
+        logFatal("-j can't be used with -e, -C or -X.");
     }
-#ifdef PROBE
-    if (loop <= 0)
+    if (storePath != NULL && (many.conns > 0 || incastCount > 0))
     {
-        loop = 1;
+        logFatal("-o can't be used with -C or -X.");
+    }
+    if (mode == MODE_PROBE)
+    {
+        if (loop <= 0)
+        {
+            loop = 1;
+        }
+        if (sendInterval < 0 || probeInterval < 0)
+        {
+            logFatal("Invalid probe intervals %d/%d.", sendInterval,
+                probeInterval);
+        }
+        if (probeLen <= 0 || probeLen > PACKET_LEN)
+        {
+            logFatal("Invalid probe packet size %d.", probeLen);
+        }
+    }
+    // a long test has no length the receiver could stop at.
+    if (sessionCount > 0 && size <= 0)
+    {
+        logFatal("Sessions only support fix tests(-n).");
+    }
+    if (many.conns != 0)
+    {
+        if (many.conns < 0 || many.conns > MAX_CONNS)
+        {
+            logFatal("Invalid number of connections %d(max %d).",
+                many.conns, MAX_CONNS);
+        }
+        if (timelen <= 0 || size > 0 || sessionCount > 0 || streams > 1 ||
+            mode != MODE_BULK || mptcp)
+        {
+            logFatal("-C only supports long bulk tests(-t) over TCP, without "
+                "-S or -N.");
+        }
+        if (many.burst <= 0 || many.interval <= 0)
+        {
+            logFatal("Invalid burst %d:%d.", many.burst, many.interval);
+        }
+        if (strcmp(backend->name, "kernel") != 0)
+        {
+            logFatal("-C needs the kernel stack.");
+        }
+        many.timelen = timelen;
+        many.send = BOOL(reverse);
+    }
+    buildPlan();
+    if (path != NULL)
+    {
+        redirectLogTo(path);
     }
-    sendInterval &= 0x7F;
-    probeInterval &= 0xFFFF;
-#endif
 }
 
 static inline void rRecvRetval(int connfd, const char *ope, char *ret)
@@ -202,69 +541,134 @@ static inline void rRecvRetval(int connfd, const char *ope, char *ret)
     static char text[256];
     if (rio_readnr(connfd, ret, 1) < 1)
     {
-        close(connfd);
+        backend->close(connfd);
         logFatal("%s: Can't receive return value!", ope);
     }
     if (*ret != RET_SUCC)
     {
-        close(connfd);
+        backend->close(connfd);
         logFatal("%s failed(%s)!", ope, retstr(*ret, text));
     }
     
     logMessage("%s complete.", ope);
 }
 
-static void reconfigureServer()
+// bytes transferred by a single fix test.
+static inline long testBytes()
+{
+    return mode == MODE_PROBE ? (long)loop * size * probeLen : size;
+}
+
+// returns the data port of the test.
+static inline unsigned short reconfigureServer(char *server,
+    unsigned short controlPort)
+{
+    return configureTest(&plan, localIP, localPort, server, controlPort,
+        tcpControl, fastOpen);
+}
+
+// asks the controller for the live statistics of its tests from slot first
+// on, leaves a line "port state run runs Bytes ms" per test in message, and
+// "more [slot]" if the rest didn't fit.
+static char requestStats(char *message, int first)
 {
-    static char message[1024];
-    int type = size > 0 ? TYPE_FIX : TYPE_LONG;
-#ifdef PROBE
-    int arg = loop;
-    int arg2 = (sendInterval << 24) | (size << 16) | probeInterval;
-#else
-    int arg = size <= 0 && !reverse ? timelen : localTime;
-    int arg2 = size;
-#endif
-    char ret;
     char errbuf[256];
+    char ret;
+    int fd, len;
 
-    logVerbose("Trying to reconfigure the server...");
-    // reconfigure now. 
-    if ((connfd = netdial(
-        AF_INET, SOCK_STREAM, localIP, localPort, serverIP, cport)) < 0)
+    len = sprintf(message, "0 %d", first) + 1;
+    if (!tcpControl)
+    {
+        return controlRequest(localIP, serverIP, cport, SIG_STAT, message,
+            len);
+    }
+    if ((fd = netdial(AF_INET, SOCK_STREAM, 0, localIP, localPort, serverIP,
+        cport)) < 0)
     {
-        logFatal("Can't connect to controller(%s)!", 
+        logFatal("Can't connect to controller(%s)!",
             strerrorV(errno, errbuf));
     }
+    if ((ret = rSendRequest(fd, SIG_STAT, message, len)) == RET_SUCC &&
+        (ret = recvReturn(fd, message)) == RET_SUCC)
+    {
+        ret = rReceiveMessage(fd, "controller", message);
+    }
+    backend->close(fd);
+    return ret;
+}
+
+// prints the tests of a reply of the controller from slot first on, counts
+// the ones waiting or running in active. returns the slot to ask from next,
+// 0 if the reply had all the rest.
+static int logStats(int first, int *active)
+{
+    static char message[CONTROL_MESSAGE + 1];
+    char state[16];
+    char *line, *save;
+    long long bytes, ms;
+    int port, run, runs, more = 0;
+    char ret;
 
-    *message = SIG_CONF;
-    if (rio_writenr(connfd, message, 1) < 1)
+    if ((ret = requestStats(message, first)) != RET_SUCC)
     {
-        close(connfd);
-        logFatal("Can't send instruction to controller(%s)!", 
-            strerrorV(errno, errbuf));
+        logFatal("Can't get the statistics of the tests(%s)!",
+            retstr(ret, message));
     }
-    sprintf(message, "%d %d %d", (int)type | reverse, arg, arg2);
-    logVerbose("Control message: %s", message);
-    rSendMessage(connfd, "controller", message, 1 + strlen(message));
-    ret = rRecvBytes(connfd, &ret, 1, "Failed to receive return value");
-    if (ret != RET_SUCC)
+    for (line = strtok_r(message, "\n", &save); line != NULL;
+         line = strtok_r(NULL, "\n", &save))
     {
-        close(connfd);
-        logFatal("Reconfigure failed(%s)!", retstr(ret, message));
+        if (sscanf(line, "more %d", &more) == 1)
+        {
+            continue;
+        }
+        if (sscanf(line, "%d %15s %d %d %lld %lld", &port, state, &run,
+            &runs, &bytes, &ms) != 6)
+        {
+            continue;
+        }
+        logMessage("->Test on port %d: %s, run %d/%d, %lld Bytes in "
+            "%lldms(%.2fMbit/s).", port, state, run, runs, bytes, ms,
+            ms > 0 ? bytes * 8.0 / ms / 1000 : 0.0);
+        *active += strcmp(state, liveStateName(LIVE_WAITING)) == 0 ||
+            strcmp(state, liveStateName(LIVE_RUNNING)) == 0;
     }
-    close(connfd);
+    // a reply always moves on, so that a broken one can't loop.
+    return more > first ? more : 0;
 }
 
-static void connectToServer()
+// prints the tests of the controller every watchEvery seconds while one of
+// them is waiting or running.
+static void watchTests()
 {
-    socklen_t socklen = sizeof(mss);
-    if ((connfd = netdial(
-        AF_INET, SOCK_STREAM, localIP, localPort, serverIP, port)) < 0)
+    int active, first;
+
+    do
     {
-        logFatal("Can't connect to server!");
+        active = 0;
+        // the tests of many slots take more than a reply.
+        for (first = 0; (first = logStats(first, &active)) > 0;);
+        if (active == 0)
+        {
+            logMessage("->No test running.");
+            break;
+        }
     }
-    if (getsockopt(connfd, IPPROTO_TCP, 2, &mss, &socklen) < 0)
+    while (watchEvery > 0 && sleep(watchEvery) == 0);
+}
+
+// whether the data connections get the first write of the client in their
+// SYN. the server writes first unless the client sends or runs a session,
+// and the senders of an incast must start at once.
+static inline int fastOpenData()
+{
+    return fastOpen && (reverse || sessionCount > 0) && incastCount == 0;
+}
+
+static void logMSS(int connfd)
+{
+    socklen_t socklen = sizeof(mss);
+
+    if (backend->getsockopt(connfd, IPPROTO_TCP, 2, &mss, &socklen) < 0)
     {
         char errbuf[256];
         logWarning("Failed to get MSS(%s).", strerrorV(errno, errbuf));
@@ -273,16 +677,411 @@ static void connectToServer()
     {
         logMessage("MSS is %d.", mss);
     }
+}
 
-#ifdef FIX
-    int flag = 1;
-    setsockopt(connfd, IPPROTO_TCP, TCP_NODELAY, (char*)&flag, sizeof(int));
-#endif
-#ifdef PROBE
-    int flag = 1;
-    setsockopt(connfd, IPPROTO_TCP, TCP_NODELAY, (char*)&flag, sizeof(int));
-#endif
+static int connectToServer(char *local, unsigned short lport, char *server,
+    unsigned short port)
+{
+    int connfd;
+    int protocol = mptcp ? IPPROTO_MPTCP : 0;
+    char errbuf[256];
+
+    if ((connfd = fastOpenData() ?
+        netdialFastOpen(AF_INET, protocol, local, lport, server, port) :
+        netdial(AF_INET, SOCK_STREAM, protocol, local, lport, server,
+        port)) < 0)
+    {
+        logFatal("Can't connect to server(%s)!", strerrorV(errno, errbuf));
+    }
+    // a Fast Open connection has no handshake until the first write.
+    if (!fastOpenData())
+    {
+        logMSS(connfd);
+    }
+
+    if (testMode->nodelay)
+    {
+        int flag = 1;
+        backend->setsockopt(connfd, IPPROTO_TCP, TCP_NODELAY, (char*)&flag,
+            sizeof(int));
+    }
     logMessage("Connection established.");
+    return connfd;
+}
+
+// stream i goes from the (i mod n)th local address to the (i mod n)th remote
+// address, bound to -b + i if -b is given.
+static void connectStreams()
+{
+    int64_t since;
+    int i;
+
+    for (i = 0; i < streams; ++i)
+    {
+        char *local = localCount ? localIPs[i % localCount] : NULL;
+        char *server = serverIPs[i % serverCount];
+
+        sprintf(streamNames[i], "%s -> %s", local ? local : "*", server);
+        pStreamNames[i] = streamNames[i];
+        since = traceNow();
+        streamFDs[i] = connectToServer(local, localPort ? localPort + i : 0,
+            server, port);
+        traceSpan(TRACE_CONNECT, i, since);
+    }
+    connfd = streamFDs[0];
+}
+
+// configures every controller of the incast and connects to all of their
+// servers, then releases the senders at once with a byte on each
+// connection.
+static void startIncast()
+{
+    unsigned short dataPorts[MAX_STREAMS];
+    char go = 0;
+    char errbuf[256];
+    int i;
+
+    for (i = 0; i < incastCount; ++i)
+    {
+        dataPorts[i] = reconfigureServer(incastIPs[i], incastPorts[i]);
+    }
+    for (i = 0; i < incastCount; ++i)
+    {
+        char *local = localCount ? localIPs[i % localCount] : NULL;
+
+        sprintf(streamNames[i], "%s:%d", incastIPs[i], incastPorts[i]);
+        pStreamNames[i] = streamNames[i];
+        streamFDs[i] = connectToServer(local, localPort ? localPort + i : 0,
+            incastIPs[i], dataPorts[i]);
+    }
+    logMessage("Starting %d senders.", incastCount);
+    for (i = 0; i < incastCount; ++i)
+    {
+        if (rio_writenr(streamFDs[i], &go, 1) < 1)
+        {
+            logFatal("Can't start sender #%d(%s)!", i,
+                strerrorV(errno, errbuf));
+        }
+    }
+    connfd = streamFDs[0];
+}
+
+static void runTest(int connfd)
+{
+    if (reverse)
+    {
+        if (mode == MODE_PROBE)
+        {
+            doProbe(connfd, sendInterval, probeInterval, size, loop,
+                probeLen, packetBuf);
+        }
+        else if (size > 0)
+        {
+            doFixTest(connfd, localTime, size, packetBuf);
+        }
+        else
+        {
+            doLongTest(connfd, timelen, packetBuf);
+        }
+    }
+    else if (mode == MODE_PROBE)
+    {
+        doProbeReceive(connfd, localTime, sendInterval, size, loop, probeLen,
+            packetBuf);
+    }
+    else
+    {
+        // in a session the connection stays open after the test.
+        doReceiveN(connfd, localTime, sessionCount > 0 ? testBytes() : -1,
+            packetBuf);
+    }
+    getTCPCounters(connfd, &lastResult.retrans, &lastResult.rtt);
+    if (mptcp)
+    {
+        logMPTCPInfo(connfd, lastResult.elapsed);
+    }
+    if (fastOpenData())
+    {
+        logMSS(connfd);
+        logMessage("->TCP Fast Open: %s.", fastOpened(connfd) ? "used" :
+            "not used");
+    }
+}
+
+// starts the next test of the session, or ends the session after the last
+// one. a test that didn't complete leaves the stream out of step, so it ends
+// the session as well.
+static int runSessionTest(int connfd)
+{
+    char errbuf[256];
+
+    if (sessionDone++ == sessionCount)
+    {
+        sendSessionHeader(connfd, TYPE_END, 0, 0);
+        return 0;
+    }
+    if (sendSessionHeader(connfd, plan.tests[0].type, localTime, size) < 0)
+    {
+        logError("Can't start test #%d of the session(%s)!", sessionDone,
+            strerrorV(errno, errbuf));
+        return 0;
+    }
+    logMessage("Session test #%d:", sessionDone);
+    runTest(connfd);
+    return lastResult.bytes == testBytes();
+}
+
+static void runSession(int connfd)
+{
+    sessionDone = 0;
+    doSession(connfd, runSessionTest);
+    getTCPCounters(connfd, &lastResult.retrans, &lastResult.rtt);
+}
+
+static inline double rate(const result_t *r)
+{
+    return r->elapsed > 0 ? r->bytes / r->elapsed : 0;
+}
+
+static inline double nsPerByte(const result_t *r)
+{
+    return (r->cost.utime + r->cost.stime) * 1e9 /
+        (r->bytes > 0 ? r->bytes : 1);
+}
+
+// logs the server's results of the test, then the views of the sender and
+// the receiver side by side.
+static void logServerResults(const result_t *server)
+{
+    const result_t *sender = reverse ? &lastResult : server;
+    const result_t *receiver = reverse ? server : &lastResult;
+
+    logMessage("Server summary:");
+    logMessage("->Bytes %s: %ld", reverse ? "received" : "transferred",
+        server->bytes);
+    logMessage("->Time elapsed : %lfs", server->elapsed);
+    logMessage("->Bandwidth: %lfBytes/sec", rate(server));
+    logCost(&server->cost, server->bytes);
+    logMessage("Sender(%s) and receiver(%s):", reverse ? "client" : "server",
+        reverse ? "server" : "client");
+    logMessage("->Bytes: %ld sent, %ld received", sender->bytes,
+        receiver->bytes);
+    logMessage("->Time elapsed: %lfs sending, %lfs receiving",
+        sender->elapsed, receiver->elapsed);
+    logMessage("->Bandwidth: %lfBytes/sec sent, %lfBytes/sec received",
+        rate(sender), rate(receiver));
+    logMessage("->CPU cost: %lfns/Byte sending, %lfns/Byte receiving",
+        nsPerByte(sender), nsPerByte(receiver));
+    logMessage("->TCP retransmits: %ld, RTT: %ldus", sender->retrans,
+        sender->rtt);
+}
+
+// the connection goes from an address of this host to the same address, so
+// both ends read the same CLOCK_MONOTONIC.
+static int sameHost(int fd)
+{
+    struct sockaddr_in local, peer;
+    socklen_t len = sizeof(local), plen = sizeof(peer);
+
+    return getsockname(fd, (struct sockaddr*)&local, &len) == 0 &&
+        getpeername(fd, (struct sockaddr*)&peer, &plen) == 0 &&
+        local.sin_family == AF_INET && peer.sin_family == AF_INET &&
+        local.sin_addr.s_addr == peer.sin_addr.s_addr;
+}
+
+// receives the events of the server after its results, and how far its
+// clock is ahead: none on this host, else the estimate of the sample with
+// the shortest round trip.
+static void receiveTrace(int fd)
+{
+    static char events[MAX_TRACE * TRACE_EVENT];
+    char header[TRACE_HEADER];
+    char clock[TRACE_CLOCK];
+    char byte = 0;
+    int64_t asked, offset, rtt, best = -1;
+    int count, i;
+
+    if (rRecvBytes(fd, header, TRACE_HEADER, "Can't receive the trace") !=
+        RET_SUCC || (count = decodeTraceHeader(header)) < 0 ||
+        rRecvBytes(fd, events, count * TRACE_EVENT,
+        "Can't receive the trace") != RET_SUCC)
+    {
+        return;
+    }
+    for (i = 0; i < TRACE_SAMPLES; ++i)
+    {
+        asked = traceNow();
+        if (rSendBytes(fd, &byte, 1, "Can't ask for the clock") != RET_SUCC ||
+            rRecvBytes(fd, clock, TRACE_CLOCK, "Can't receive the clock") !=
+            RET_SUCC)
+        {
+            return;
+        }
+        offset = decodeTraceClock(clock, asked, &rtt);
+        if (best < 0 || rtt < best)
+        {
+            best = rtt;
+            serverOffset = offset;
+        }
+    }
+    if ((sameClock = sameHost(fd)))
+    {
+        serverOffset = 0;
+    }
+    decodeTraceEvents(events, count, serverTrace);
+    serverTraceCount = count;
+}
+
+// asks the server for its results on a connection of its own, once the
+// data connections are closed. returns -1 if the server sent no results.
+static int fetchResults(result_t *server)
+{
+    char record[RESULTS_LEN];
+    char errbuf[256];
+    int64_t since = traceNow();
+    int fd;
+
+    // an interrupted test leaves the server waiting until it gives up.
+    if (!isLocked(&sigint))
+    {
+        return -1;
+    }
+    if ((fd = fastOpen ?
+        netdialFastOpen(AF_INET, 0, localIP, 0, serverIP, port) :
+        netdial(AF_INET, SOCK_STREAM, 0, localIP, 0, serverIP, port)) < 0)
+    {
+        logWarning("Can't fetch the results of the server(%s).",
+            strerrorV(errno, errbuf));
+        return -1;
+    }
+    if (sendSessionHeader(fd, TYPE_RESULTS, 0, 0) < 0 ||
+        rRecvBytes(fd, record, RESULTS_LEN, "Can't receive the results") !=
+        RET_SUCC || decodeResults(server, record) < 0)
+    {
+        logWarning("No results from the server.");
+        backend->close(fd);
+        return -1;
+    }
+    if (plan.flags & FLAG_TRACE)
+    {
+        receiveTrace(fd);
+    }
+    backend->close(fd);
+    traceSpan(TRACE_RESULTS, -1, since);
+    logServerResults(server);
+    return 0;
+}
+
+// appends the run of t that started at runStart to the store, with the
+// results of the server if it sent them. an interrupted run isn't stored.
+static void storeRun(const planTest_t *t, const result_t *server)
+{
+    storeRecord_t record;
+    char errbuf[256];
+
+    if (!isLocked(&sigint))
+    {
+        return;
+    }
+    memset(&record, 0, sizeof(record));
+    record.start = runStart;
+    record.end = nowUS();
+    if (gethostname(record.host, STORE_NAME - 1) < 0)
+    {
+        strcpy(record.host, "unknown");
+    }
+    snprintf(record.path, STORE_NAME, "%s->%s:%d", localIP ? localIP : "*",
+        serverIP, cport);
+    snprintf(record.backend, sizeof(record.backend), "%s", backend->name);
+    record.type = t->type;
+    record.time = t->type & TYPE_FIX ? 0 : t->time;
+    record.size = t->type & TYPE_FIX ? t->size : 0;
+    record.streams = streams;
+    record.mode = mode;
+    record.probeLen = mode == MODE_PROBE ? probeLen : 0;
+    record.sessions = sessionCount;
+    record.options = (mptcp ? STORE_MPTCP : 0) |
+        (fastOpen ? STORE_FASTOPEN : 0);
+    record.bytes = lastResult.bytes;
+    record.elapsed = lastResult.elapsed;
+    record.utime = lastResult.cost.utime;
+    record.stime = lastResult.cost.stime;
+    record.retrans = lastResult.retrans;
+    record.rtt = lastResult.rtt;
+    record.serverBytes = -1;
+    if (server != NULL)
+    {
+        record.serverBytes = server->bytes;
+        record.serverElapsed = server->elapsed;
+        record.serverUtime = server->cost.utime;
+        record.serverStime = server->cost.stime;
+        record.serverRetrans = server->retrans;
+        record.serverRtt = server->rtt;
+    }
+    if (appendRecord(storePath, &record) < 0)
+    {
+        logError("Can't append the results to %s(%s)!", storePath,
+            strerrorV(errno, errbuf));
+        return;
+    }
+    logMessage("Results appended to %s(configuration %016llx).", storePath,
+        (unsigned long long)record.config);
+}
+
+// the trace of both ends, or of the client alone if the server's is
+// missing.
+static void saveTrace()
+{
+    char errbuf[256];
+
+    if (serverTraceCount == 0)
+    {
+        logWarning("No trace from the server, the trace only has the "
+            "client.");
+    }
+    if (writeTrace(tracePath, serverTrace, serverTraceCount,
+        serverOffset) < 0)
+    {
+        logError("Can't write the trace to %s(%s)!", tracePath,
+            strerrorV(errno, errbuf));
+        return;
+    }
+    if (sameClock)
+    {
+        logMessage("Trace of the test written to %s(server on this host).",
+            tracePath);
+    }
+    else
+    {
+        logMessage("Trace of the test written to %s(server clock %+lldus).",
+            tracePath, (long long)serverOffset);
+    }
+}
+
+// runs a run of a test of the plan on connections of its own.
+static int runPlanTest(const planTest_t *t)
+{
+    result_t server;
+    int ok;
+
+    loadTest(t);
+    connectStreams();
+    runStart = nowUS();
+    if (streams > 1)
+    {
+        doParallel(streams, streamFDs, pStreamNames, runTest);
+    }
+    else
+    {
+        runTest(connfd);
+        backend->close(connfd);
+    }
+    ok = fetchResults(&server) == 0;
+    if (storePath != NULL)
+    {
+        storeRun(t, ok ? &server : NULL);
+    }
+    return 1;
 }
 
 void sigintHandler(int sig)
@@ -290,13 +1089,14 @@ void sigintHandler(int sig)
     int be = errno;
     logVerbose("--SIGINT received.");
     release(&sigint);
+    signalStreams(SIGINT);
     errno = be;
 }
 
 void sigintHandlerEarly(int sig)
 {
     logVerbose("--SIGINT received, exit.");
-    close(connfd);
+    backend->close(connfd);
     exit(0);
 }
 
@@ -310,6 +1110,10 @@ void sigalrmHandler(int sig)
 
 int main(int argc, char **argv)
 {
+    result_t server;
+    int64_t since;
+    int ok = 0;
+
     if (argc == 1)
     {
         printUsageAndExit(argv);
@@ -319,34 +1123,86 @@ int main(int argc, char **argv)
 
     parseArguments(argc, argv);
     printInitLog();
+    setControlKey(secret);
+    if (tracePath != NULL)
+    {
+        initTrace();
+    }
+    if (watchEvery >= 0)
+    {
+        watchTests();
+        return 0;
+    }
+
+    testMode = testModes + mode;
+    logVerbose("Test mode is %s.", testMode->name);
+    fillPacketBuf(packetBuf);
 
     signalNoRestart(SIGINT, sigintHandlerEarly);
-    reconfigureServer();
-    connectToServer();
+    if (incastCount > 0)
+    {
+        startIncast();
+    }
+    else
+    {
+        port = reconfigureServer(serverIP, cport);
+    }
+    if (many.conns > 0)
+    {
+        signalNoRestart(SIGINT, sigintHandler);
+        signalNoRestart(SIGALRM, sigalrmHandler);
+        signalNoRestart(SIGPIPE, SIG_IGN);
+        setLock(&sigint);
+        setLock(&sigalrm);
+        doManyClient(&many, localIPs, localCount, serverIPs, serverCount,
+            port, localTime, packetBuf);
+        return 0;
+    }
+    if (planRuns(&plan) > 1)
+    {
+        signalNoRestart(SIGINT, sigintHandler);
+        signalNoRestart(SIGALRM, sigalrmHandler);
+        signalNoRestart(SIGPIPE, SIG_IGN);
+        setLock(&sigint);
+        doPlan(&plan, runPlanTest);
+        return 0;
+    }
+    if (incastCount == 0)
+    {
+        connectStreams();
+    }
 
     signalNoRestart(SIGINT, sigintHandler);
     signalNoRestart(SIGALRM, sigalrmHandler);
     signalNoRestart(SIGPIPE, SIG_IGN);
     setLock(&sigint);
     setLock(&sigalrm);
-    if (reverse)
+    runStart = nowUS();
+    if (streams == 1)
     {
-#ifdef PROBE
-        doProbe(connfd, sendInterval, probeInterval, size, loop, packetBuf);
-#else
-        if (size > 0)
-        {
-            doFixTest(connfd, localTime, size, packetBuf);
-        }
-        else
-        {
-            doLongTest(connfd, timelen, packetBuf);
-        }
-#endif
+        traceStreamStart(0);
+        (sessionCount > 0 ? runSession : runTest)(connfd);
+        traceStreamEnd();
+        since = traceNow();
+        backend->close(connfd);
+        traceSpan(TRACE_CLOSE, 0, since);
     }
     else
     {
-        doReceive(connfd, localTime, packetBuf);
+        doParallel(streams, streamFDs, pStreamNames,
+            sessionCount > 0 ? runSession : runTest);
+    }
+    if (plan.flags & FLAG_RESULTS)
+    {
+        ok = fetchResults(&server) == 0;
+    }
+    if (storePath != NULL)
+    {
+        storeRun(plan.tests, ok ? &server : NULL);
+    }
+    if (tracePath != NULL)
+    {
+        saveTrace();
     }
     return 0;
 }
@@ -0,0 +1,382 @@
+#include <sys/random.h>
+
+#include "control.h"
+#include "trace.h"
+#include "util.h"
+
+#define ROTL(x, b) (((x) << (b)) | ((x) >> (64 - (b))))
+#define SIPROUND \
+    do \
+    { \
+        v0 += v1; v1 = ROTL(v1, 13); v1 ^= v0; v0 = ROTL(v0, 32); \
+        v2 += v3; v3 = ROTL(v3, 16); v3 ^= v2; \
+        v0 += v3; v3 = ROTL(v3, 21); v3 ^= v0; \
+        v2 += v1; v1 = ROTL(v1, 17); v1 ^= v2; v2 = ROTL(v2, 32); \
+    } while (0)
+
+static uint64_t key[2];
+
+static inline uint64_t getLE64(const uint8_t *p)
+{
+    uint64_t x = 0;
+    int i;
+
+    for (i = 7; i >= 0; --i)
+    {
+        x = x << 8 | p[i];
+    }
+    return x;
+}
+
+static inline void putLE64(uint8_t *p, uint64_t x)
+{
+    int i;
+
+    for (i = 0; i < 8; ++i, x >>= 8)
+    {
+        p[i] = x & 0xFF;
+    }
+}
+
+// SipHash-2-4, a MAC made for short messages.
+static uint64_t siphash(const uint8_t *in, size_t len, const uint64_t *k)
+{
+    uint64_t v0 = k[0] ^ 0x736f6d6570736575ULL;
+    uint64_t v1 = k[1] ^ 0x646f72616e646f6dULL;
+    uint64_t v2 = k[0] ^ 0x6c7967656e657261ULL;
+    uint64_t v3 = k[1] ^ 0x7465646279746573ULL;
+    uint64_t m, b = (uint64_t)len << 56;
+    const uint8_t *end = in + len - len % 8;
+    int i;
+
+    for (; in != end; in += 8)
+    {
+        m = getLE64(in);
+        v3 ^= m;
+        SIPROUND;
+        SIPROUND;
+        v0 ^= m;
+    }
+    for (i = len % 8 - 1; i >= 0; --i)
+    {
+        b |= (uint64_t)in[i] << (8 * i);
+    }
+    v3 ^= b;
+    SIPROUND;
+    SIPROUND;
+    v0 ^= b;
+    v2 ^= 0xff;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+int setControlKey(const char *secret)
+{
+    static const uint64_t seeds[2][2] = {{0, 0}, {1, 0}};
+
+    if (secret == NULL && (secret = getenv("MPERF_KEY")) == NULL)
+    {
+        secret = "";
+    }
+    key[0] = siphash((const uint8_t*)secret, strlen(secret), seeds[0]);
+    key[1] = siphash((const uint8_t*)secret, strlen(secret), seeds[1]);
+    return *secret != 0;
+}
+
+int packControl(char *buf, uint64_t reqid, char code, const char *message,
+    int mlen)
+{
+    uint8_t *p = (uint8_t*)buf;
+    int len = mlen < CONTROL_MESSAGE ? mlen : CONTROL_MESSAGE;
+
+    p[0] = CONTROL_MAGIC >> 24;
+    p[1] = CONTROL_MAGIC >> 16 & 0xFF;
+    p[2] = CONTROL_MAGIC >> 8 & 0xFF;
+    p[3] = CONTROL_MAGIC & 0xFF;
+    putLE64(p + 4, reqid);
+    putLE64(p + 12, nowUS());
+    p[20] = code;
+    memcpy(p + CONTROL_HEADER, message, len);
+    len += CONTROL_HEADER;
+    putLE64(p + len, siphash(p, len, key));
+    return len + CONTROL_MAC;
+}
+
+// stamps a packed datagram of len Bytes with the current time again.
+static void restampControl(char *buf, int len)
+{
+    uint8_t *p = (uint8_t*)buf;
+
+    len -= CONTROL_MAC;
+    putLE64(p + 12, nowUS());
+    putLE64(p + len, siphash(p, len, key));
+}
+
+int unpackControl(const char *buf, int len, uint64_t *reqid, int64_t *sent,
+    char *code, char *message)
+{
+    const uint8_t *p = (const uint8_t*)buf;
+
+    if (len < CONTROL_HEADER + 1 + CONTROL_MAC || len > MAX_DATAGRAM ||
+        ((uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3]) !=
+        CONTROL_MAGIC)
+    {
+        return -1;
+    }
+    len -= CONTROL_MAC;
+    if (getLE64(p + len) != siphash(p, len, key))
+    {
+        return -1;
+    }
+    *reqid = getLE64(p + 4);
+    *sent = getLE64(p + 12);
+    *code = p[20];
+    memcpy(message, p + CONTROL_HEADER, len - CONTROL_HEADER);
+    // a string is terminated even if the sender didn't.
+    message[len - CONTROL_HEADER] = 0;
+    return len - CONTROL_HEADER;
+}
+
+static uint64_t newRequestID()
+{
+    uint64_t reqid;
+    struct timeval now;
+
+    if (getrandom(&reqid, sizeof(reqid), 0) == sizeof(reqid))
+    {
+        return reqid;
+    }
+    gettimeofday(&now, NULL);
+    return (uint64_t)now.tv_sec << 32 ^ now.tv_usec << 12 ^ getpid();
+}
+
+static int openControlSocket(const char *local, const char *server,
+    unsigned short port)
+{
+    struct addrinfo hints, *res;
+    int fd;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    if ((fd = kernelStack->socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+    {
+        return -1;
+    }
+    if (local != NULL)
+    {
+        if (getaddrinfo(local, NULL, &hints, &res) != 0)
+        {
+            kernelStack->close(fd);
+            return -1;
+        }
+        if (kernelStack->bind(fd, res->ai_addr, res->ai_addrlen) < 0)
+        {
+            freeaddrinfo(res);
+            kernelStack->close(fd);
+            return -1;
+        }
+        freeaddrinfo(res);
+    }
+    if (getaddrinfo(server, NULL, &hints, &res) != 0)
+    {
+        kernelStack->close(fd);
+        return -1;
+    }
+    // only the controller's replies are received.
+    ((struct sockaddr_in*)res->ai_addr)->sin_port = htons(port);
+    if (kernelStack->connect(fd, res->ai_addr, res->ai_addrlen) < 0)
+    {
+        freeaddrinfo(res);
+        kernelStack->close(fd);
+        return -1;
+    }
+    freeaddrinfo(res);
+    return fd;
+}
+
+int openControlFD(const char *local, int port)
+{
+    struct sockaddr_in addr;
+    int fd;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (local != NULL && inet_pton(AF_INET, local, &addr.sin_addr) != 1)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    if ((fd = kernelStack->socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0)) < 0)
+    {
+        return -1;
+    }
+    if (kernelStack->bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+    {
+        kernelStack->close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static inline long long nowMS()
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000LL + now.tv_nsec / 1000000;
+}
+
+char controlRequest(const char *local, const char *server,
+    unsigned short port, char code, char *message, int mlen)
+{
+    char request[MAX_DATAGRAM], reply[MAX_DATAGRAM];
+    char errbuf[256];
+    struct pollfd pfd;
+    uint64_t reqid, rid;
+    int64_t sent;
+    long long deadline;
+    int fd, len, n, position, eta;
+    int tries = 0, rto = CONTROL_RTO;
+    char ret;
+
+    if ((fd = openControlSocket(local, server, port)) < 0)
+    {
+        logError("Can't reach controller(%s)!", strerrorV(errno, errbuf));
+        return RET_EWRITE;
+    }
+    reqid = newRequestID();
+    len = packControl(request, reqid, code, message, mlen);
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    while (tries < CONTROL_TRIES)
+    {
+        // a retransmission is fresh whenever it gets there.
+        restampControl(request, len);
+        // a refused earlier datagram only means the controller isn't up yet.
+        if (kernelStack->write(fd, request, len) < 0 && errno != ECONNREFUSED)
+        {
+            logError("Can't send request to controller(%s)!",
+                strerrorV(errno, errbuf));
+            kernelStack->close(fd);
+            return RET_EWRITE;
+        }
+        logVerbose("Request %016llx sent(try %d).", (unsigned long long)reqid,
+            ++tries);
+        deadline = nowMS() + rto;
+        rto = rto * 2 < CONTROL_RTO_MAX ? rto * 2 : CONTROL_RTO_MAX;
+        while ((n = deadline - nowMS()) > 0)
+        {
+            if ((n = poll(&pfd, 1, n)) <= 0)
+            {
+                continue;
+            }
+            if ((n = kernelStack->read(fd, reply, sizeof(reply))) < 0 ||
+                unpackControl(reply, n, &rid, &sent, &ret, message) < 0 ||
+                rid != reqid)
+            {
+                if (n >= 0)
+                {
+                    logWarning("Dropped a reply that isn't ours or fails the "
+                        "MAC(check -K).");
+                }
+                continue;
+            }
+            if (ret != RET_QUEUED)
+            {
+                kernelStack->close(fd);
+                return ret;
+            }
+            if (sscanf(message, "%d%d", &position, &eta) == 2)
+            {
+                logMessage("Queued at position %d, starting in about %ds.",
+                    position, eta);
+            }
+            // the controller sends updates while the test waits.
+            tries = 0;
+            rto = CONTROL_RTO;
+            deadline = nowMS() + MESSAGE_TIMEOUT * 1000;
+        }
+    }
+    logError("No reply from controller after %d tries!", tries);
+    kernelStack->close(fd);
+    return RET_EREAD;
+}
+
+unsigned short configureTest(const plan_t *plan, char *local, int localPort,
+    char *server, unsigned short port, int tcp, int fastOpen)
+{
+    char message[CONTROL_MESSAGE + 1];
+    char text[PLAN_TEXT];
+    char errbuf[256];
+    int64_t since = traceNow();
+    int connfd, len;
+    char ret;
+
+    logVerbose("Trying to reconfigure the server...");
+    len = encodePlan(plan, message);
+    logVerbose("Control message: %s", formatPlan(plan, text));
+    if (!tcp)
+    {
+        // a single datagram carries the request, its reply the data port.
+        ret = controlRequest(local, server, port, SIG_CONF, message, len);
+        traceSpan(TRACE_REQUEST, -1, since);
+        if (ret == RET_EMSG)
+        {
+            logFatal("Reconfigure failed(%s)!", message);
+        }
+        if (ret != RET_SUCC)
+        {
+            logFatal("Reconfigure failed(%s)!", retstr(ret, message));
+        }
+        logVerbose("Data port is %s.", message);
+        return atoi(message);
+    }
+
+    if ((connfd = fastOpen ?
+        netdialFastOpen(AF_INET, 0, local, localPort, server, port) :
+        netdial(AF_INET, SOCK_STREAM, 0, local, localPort, server, port)) < 0)
+    {
+        logFatal("Can't connect to controller(%s)!",
+            strerrorV(errno, errbuf));
+    }
+    traceSpan(TRACE_DIAL, -1, since);
+
+    since = traceNow();
+    if (rSendRequest(connfd, SIG_CONF, message, len) != RET_SUCC)
+    {
+        backend->close(connfd);
+        logFatal("Can't send instruction to controller(%s)!",
+            strerrorV(errno, errbuf));
+    }
+    // the controller explains why the test was refused.
+    if ((ret = recvReturn(connfd, message)) == RET_EMSG)
+    {
+        backend->close(connfd);
+        logFatal("Reconfigure failed(%s)!", message);
+    }
+    if (ret != RET_SUCC)
+    {
+        backend->close(connfd);
+        logFatal("Reconfigure failed(%s)!", retstr(ret, message));
+    }
+    if (rReceiveMessage(connfd, "controller", message) != RET_SUCC)
+    {
+        backend->close(connfd);
+        logFatal("Can't receive the data port!");
+    }
+    traceSpan(TRACE_REQUEST, -1, since);
+    if (fastOpen)
+    {
+        logMessage("TCP Fast Open on the control connection: %s.",
+            fastOpened(connfd) ? "used" : "not used");
+    }
+    backend->close(connfd);
+    logVerbose("Data port is %s.", message);
+    return atoi(message);
+}
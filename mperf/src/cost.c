@@ -0,0 +1,136 @@
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+
+#include "cost.h"
+#include "util.h"
+
+#define GB 1000000000.0
+
+// -2: not opened yet, -1: not available.
+static int cyclesFD = -2;
+static int instructionsFD = -2;
+static int userOnly = 0;
+static struct rusage st;
+
+static int openCounter(unsigned long config, int excludeKernel)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = excludeKernel;
+    attr.exclude_hv = 1;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static void openCounters()
+{
+    char errbuf[256];
+
+    cyclesFD = openCounter(PERF_COUNT_HW_CPU_CYCLES, 0);
+    if (cyclesFD < 0 && (errno == EACCES || errno == EPERM))
+    {
+        // perf_event_paranoid >= 2 allows user-space counting only.
+        userOnly = 1;
+        cyclesFD = openCounter(PERF_COUNT_HW_CPU_CYCLES, 1);
+    }
+    if (cyclesFD < 0)
+    {
+        logVerbose("Hardware counters not available(%s).",
+            strerrorV(errno, errbuf));
+        cyclesFD = instructionsFD = -1;
+        return;
+    }
+    instructionsFD = openCounter(PERF_COUNT_HW_INSTRUCTIONS, userOnly);
+    if (userOnly)
+    {
+        logVerbose("Hardware counters exclude kernel time.");
+    }
+}
+
+static long readCounter(int fd)
+{
+    long val;
+
+    if (fd < 0 || read(fd, &val, sizeof(val)) < (int)sizeof(val))
+    {
+        return -1;
+    }
+    return val;
+}
+
+static inline double tv2s(const struct timeval *tv)
+{
+    return tv->tv_sec + tv->tv_usec / 1000000.0;
+}
+
+void costStart()
+{
+    if (cyclesFD == -2)
+    {
+        openCounters();
+    }
+    if (cyclesFD >= 0)
+    {
+        ioctl(cyclesFD, PERF_EVENT_IOC_RESET, 0);
+        ioctl(cyclesFD, PERF_EVENT_IOC_ENABLE, 0);
+    }
+    if (instructionsFD >= 0)
+    {
+        ioctl(instructionsFD, PERF_EVENT_IOC_RESET, 0);
+        ioctl(instructionsFD, PERF_EVENT_IOC_ENABLE, 0);
+    }
+    getrusage(RUSAGE_SELF, &st);
+}
+
+void costStop(cost_t *cost)
+{
+    struct rusage ed;
+
+    getrusage(RUSAGE_SELF, &ed);
+    if (cyclesFD >= 0)
+    {
+        ioctl(cyclesFD, PERF_EVENT_IOC_DISABLE, 0);
+    }
+    if (instructionsFD >= 0)
+    {
+        ioctl(instructionsFD, PERF_EVENT_IOC_DISABLE, 0);
+    }
+
+    cost->utime = tv2s(&ed.ru_utime) - tv2s(&st.ru_utime);
+    cost->stime = tv2s(&ed.ru_stime) - tv2s(&st.ru_stime);
+    cost->nvcsw = ed.ru_nvcsw - st.ru_nvcsw;
+    cost->nivcsw = ed.ru_nivcsw - st.ru_nivcsw;
+    cost->cycles = readCounter(cyclesFD);
+    cost->instructions = readCounter(instructionsFD);
+}
+
+void logCost(const cost_t *cost, long bytes)
+{
+    double cpu = cost->utime + cost->stime;
+    // avoid dividing by zero when nothing was transferred.
+    double b = bytes > 0 ? bytes : 1;
+
+    logMessage("->CPU time: user %lfs, sys %lfs", cost->utime, cost->stime);
+    logMessage("->Context switches: voluntary %ld, involuntary %ld",
+        cost->nvcsw, cost->nivcsw);
+    // ns per Byte, the same number as CPU seconds per GB.
+    logMessage("->CPU cost: %lfns/Byte", cpu * GB / b);
+    if (cost->cycles >= 0)
+    {
+        logMessage("->Cycles%s: %ld(%lf/Byte, %.0lf/GB)",
+            userOnly ? "(user)" : "", cost->cycles, cost->cycles / b,
+            cost->cycles * GB / b);
+    }
+    if (cost->instructions >= 0)
+    {
+        logMessage("->Instructions%s: %ld(%lf/Byte, %.0lf/GB, IPC %lf)",
+            userOnly ? "(user)" : "", cost->instructions,
+            cost->instructions / b, cost->instructions * GB / b,
+            cost->cycles > 0 ? (double)cost->instructions / cost->cycles : 0);
+    }
+}
@@ -0,0 +1,350 @@
+#include "flows.h"
+#include "util.h"
+
+#define PCAP_MAGIC 0xa1b2c3d4
+#define PCAP_MAGIC_NS 0xa1b23c4d
+
+// link types.
+#define LINK_NULL 0
+#define LINK_ETHERNET 1
+#define LINK_RAW 101
+#define LINK_SLL 113
+#define LINK_SLL2 276
+
+#define ETH_IPV4 0x0800
+#define ETH_IPV6 0x86dd
+#define ETH_VLAN 0x8100
+
+#define HASH_SIZE 65536
+#define MAX_PACKET 262144
+
+#define TCP_SYN 0x02
+#define TCP_ACK 0x10
+
+typedef struct
+{
+    uint32_t magic;
+    uint16_t major;
+    uint16_t minor;
+    int32_t zone;
+    uint32_t sigfigs;
+    uint32_t snaplen;
+    uint32_t linktype;
+} pcapHeader_t;
+
+typedef struct
+{
+    uint32_t sec;
+    uint32_t frac;
+    uint32_t caplen;
+    uint32_t len;
+} pcapRecord_t;
+
+static flow_t *flows;
+static int count, capacity;
+static int buckets[HASH_SIZE];
+
+static inline uint16_t getU16(const uint8_t *p)
+{
+    return p[0] << 8 | p[1];
+}
+
+static inline uint32_t getU32(const uint8_t *p)
+{
+    return (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+static inline uint32_t swap32(uint32_t x, int swapped)
+{
+    return swapped ? __builtin_bswap32(x) : x;
+}
+
+static unsigned int hashKey(const uint8_t *a, uint16_t pa, const uint8_t *b,
+    uint16_t pb)
+{
+    unsigned int h = pa ^ pb;
+    int i;
+
+    // the same for both directions.
+    for (i = 0; i < 16; ++i)
+    {
+        h = h * 31 + (a[i] ^ b[i]);
+    }
+    return h % HASH_SIZE;
+}
+
+// returns the flow and which of its sides sent the packet, creating it if
+// the packet is the first one.
+static flow_t *findFlow(int family, const uint8_t *src, uint16_t sport,
+    const uint8_t *dst, uint16_t dport, int *side, double ts)
+{
+    unsigned int h = hashKey(src, sport, dst, dport);
+    flow_t *f;
+    int i;
+
+    for (i = buckets[h]; i >= 0; i = flows[i].next)
+    {
+        f = flows + i;
+        if (f->family != family)
+        {
+            continue;
+        }
+        if (f->port[0] == sport && f->port[1] == dport &&
+            !memcmp(f->addr[0], src, 16) && !memcmp(f->addr[1], dst, 16))
+        {
+            *side = 0;
+            return f;
+        }
+        if (f->port[1] == sport && f->port[0] == dport &&
+            !memcmp(f->addr[1], src, 16) && !memcmp(f->addr[0], dst, 16))
+        {
+            *side = 1;
+            return f;
+        }
+    }
+
+    if (count == capacity)
+    {
+        capacity = capacity ? capacity * 2 : 256;
+        if ((flows = realloc(flows, sizeof(flow_t) * capacity)) == NULL)
+        {
+            failExit("realloc");
+        }
+    }
+    f = flows + count;
+    memset(f, 0, sizeof(flow_t));
+    f->family = family;
+    memcpy(f->addr[0], src, 16);
+    memcpy(f->addr[1], dst, 16);
+    f->port[0] = sport;
+    f->port[1] = dport;
+    f->start = f->end = ts;
+    f->next = buckets[h];
+    buckets[h] = count++;
+    *side = 0;
+    return f;
+}
+
+static void addSegment(flow_t *f, int side, uint32_t seq, int flags, int len,
+    double ts)
+{
+    uint32_t end;
+
+    // a SYN sent by side 1 means the capture started with packets of the
+    // responder.
+    if ((flags & (TCP_SYN | TCP_ACK)) == TCP_SYN && side == 1 &&
+        !f->seen[1])
+    {
+        flow_t t = *f;
+        int i;
+
+        for (i = 0; i < 2; ++i)
+        {
+            memcpy(f->addr[i], t.addr[1 - i], 16);
+            f->port[i] = t.port[1 - i];
+            f->bytes[i] = t.bytes[1 - i];
+            f->seqStart[i] = t.seqStart[1 - i];
+            f->seqEnd[i] = t.seqEnd[1 - i];
+            f->seen[i] = t.seen[1 - i];
+        }
+        side = 0;
+    }
+    // the SYN takes a sequence number but carries no data.
+    if (flags & TCP_SYN)
+    {
+        ++seq;
+    }
+    if (!f->seen[side])
+    {
+        f->seqStart[side] = f->seqEnd[side] = seq;
+        f->seen[side] = 1;
+    }
+    if (len <= 0)
+    {
+        return;
+    }
+    // sequence numbers wrap, compare them by their difference.
+    end = seq + len;
+    if ((int32_t)(seq - f->seqStart[side]) < 0)
+    {
+        f->seqStart[side] = seq;
+    }
+    if ((int32_t)(end - f->seqEnd[side]) > 0)
+    {
+        f->seqEnd[side] = end;
+    }
+    f->bytes[side] = f->seqEnd[side] - f->seqStart[side];
+    f->end = ts;
+}
+
+static void addPacket(const uint8_t *p, int caplen, int proto, double ts)
+{
+    uint8_t src[16], dst[16];
+    int family, hlen, iplen, tcplen;
+    flow_t *f;
+    int side;
+
+    memset(src, 0, sizeof(src));
+    memset(dst, 0, sizeof(dst));
+    if (proto == ETH_IPV4 && caplen >= 20)
+    {
+        hlen = (p[0] & 0xF) * 4;
+        iplen = getU16(p + 2);
+        if (p[9] != IPPROTO_TCP || (getU16(p + 6) & 0x1FFF) != 0)
+        {
+            return;
+        }
+        family = AF_INET;
+        memcpy(src, p + 12, 4);
+        memcpy(dst, p + 16, 4);
+    }
+    else if (proto == ETH_IPV6 && caplen >= 40)
+    {
+        // extension headers are rare enough to be left out.
+        hlen = 40;
+        iplen = 40 + getU16(p + 4);
+        if (p[6] != IPPROTO_TCP)
+        {
+            return;
+        }
+        family = AF_INET6;
+        memcpy(src, p + 8, 16);
+        memcpy(dst, p + 24, 16);
+    }
+    else
+    {
+        return;
+    }
+    if (caplen < hlen + 20)
+    {
+        return;
+    }
+    p += hlen;
+    tcplen = (p[12] >> 4) * 4;
+
+    f = findFlow(family, src, getU16(p), dst, getU16(p + 2), &side, ts);
+    addSegment(f, side, getU32(p + 4), p[13], iplen - hlen - tcplen, ts);
+}
+
+static int compareStart(const void *a, const void *b)
+{
+    double x = ((const flow_t*)a)->start, y = ((const flow_t*)b)->start;
+    return x < y ? -1 : x > y;
+}
+
+int readFlows(const char *path, flow_t **result, char *errbuf)
+{
+    pcapHeader_t header;
+    pcapRecord_t record;
+    uint8_t *packet;
+    double first = -1, ts, unit;
+    int swapped, proto, link, off;
+    FILE *fp;
+
+    if ((fp = fopen(path, "rb")) == NULL)
+    {
+        strerrorV(errno, errbuf);
+        return -1;
+    }
+    if (fread(&header, sizeof(header), 1, fp) != 1)
+    {
+        sprintf(errbuf, "not a pcap file");
+        fclose(fp);
+        return -1;
+    }
+    swapped = header.magic == __builtin_bswap32(PCAP_MAGIC) ||
+        header.magic == __builtin_bswap32(PCAP_MAGIC_NS);
+    header.magic = swap32(header.magic, swapped);
+    if (header.magic != PCAP_MAGIC && header.magic != PCAP_MAGIC_NS)
+    {
+        // pcapng files can be converted with `editcap -F pcap`.
+        sprintf(errbuf, "not a pcap file");
+        fclose(fp);
+        return -1;
+    }
+    unit = header.magic == PCAP_MAGIC ? 1e-6 : 1e-9;
+    link = swap32(header.linktype, swapped) & 0xFFFF;
+    if (link != LINK_NULL && link != LINK_ETHERNET && link != LINK_RAW &&
+        link != LINK_SLL && link != LINK_SLL2)
+    {
+        sprintf(errbuf, "unsupported link type %d", link);
+        fclose(fp);
+        return -1;
+    }
+    if ((packet = malloc(MAX_PACKET)) == NULL)
+    {
+        failExit("malloc");
+    }
+
+    flows = NULL;
+    count = capacity = 0;
+    memset(buckets, -1, sizeof(buckets));
+    while (fread(&record, sizeof(record), 1, fp) == 1)
+    {
+        int caplen = swap32(record.caplen, swapped);
+
+        if (caplen > MAX_PACKET)
+        {
+            fseek(fp, caplen, SEEK_CUR);
+            continue;
+        }
+        if (fread(packet, 1, caplen, fp) != (size_t)caplen)
+        {
+            break;
+        }
+        ts = swap32(record.sec, swapped) + swap32(record.frac, swapped) * unit;
+        if (first < 0)
+        {
+            first = ts;
+        }
+
+        switch (link)
+        {
+        case LINK_NULL:
+            // AF_INET is 2 everywhere, AF_INET6 differs between systems.
+            off = 4;
+            proto = caplen > 4 && packet[4] >> 4 == 6 ? ETH_IPV6 : ETH_IPV4;
+            break;
+        case LINK_ETHERNET:
+            off = 14;
+            proto = caplen >= 14 ? getU16(packet + 12) : 0;
+            if (proto == ETH_VLAN && caplen >= 18)
+            {
+                off = 18;
+                proto = getU16(packet + 16);
+            }
+            break;
+        case LINK_RAW:
+            off = 0;
+            proto = caplen > 0 && packet[0] >> 4 == 6 ? ETH_IPV6 : ETH_IPV4;
+            break;
+        case LINK_SLL:
+            off = 16;
+            proto = caplen >= 16 ? getU16(packet + 14) : 0;
+            break;
+        default:
+            off = 20;
+            proto = caplen >= 20 ? getU16(packet) : 0;
+        }
+        if (caplen > off)
+        {
+            addPacket(packet + off, caplen - off, proto, ts - first);
+        }
+    }
+    free(packet);
+    fclose(fp);
+
+    qsort(flows, count, sizeof(flow_t), compareStart);
+    *result = flows;
+    return count;
+}
+
+char *flowName(const flow_t *flow, char *buf)
+{
+    char a[INET6_ADDRSTRLEN], b[INET6_ADDRSTRLEN];
+
+    inet_ntop(flow->family, flow->addr[0], a, sizeof(a));
+    inet_ntop(flow->family, flow->addr[1], b, sizeof(b));
+    sprintf(buf, "%s:%d -> %s:%d", a, flow->port[0], b, flow->port[1]);
+    return buf;
+}
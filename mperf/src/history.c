@@ -0,0 +1,515 @@
+#include "plan.h"
+#include "sndrcv.h"
+#include "store.h"
+#include "util.h"
+
+const char *usage =
+    "  -f [path]:\n"
+    "    Specify the results store(mperf-client -o) to read.\n"
+    "    *: Required\n"
+    "  -h:\n"
+    "    Print this message and exit.\n"
+    "  -k [config]:\n"
+    "    The configuration to query, its hash as listed or a unique prefix\n"
+    "    of it. Without -n, print every run of it in the order they started\n"
+    "    and the trend of the metric: its least-squares slope per day and\n"
+    "    the medians of the older and the newer half of the runs.\n"
+    "    (default: list the configurations of the store with their runs).\n"
+    "  -l [path]:\n"
+    "    Specify the file to save the log.\n"
+    "  -m [metric]:\n"
+    "    The metric of the trend and the comparison(default: bandwidth).\n"
+    "      bandwidth: Bytes/sec of the client.\n"
+    "      cpu:       CPU time of the client per Byte(ns).\n"
+    "      time:      seconds the client took.\n"
+    "      retrans:   TCP retransmits of the sender.\n"
+    "      rtt:       smoothed RTT of the sender(us).\n"
+    "  -n [runs]:\n"
+    "    Compare a run with the last [runs] runs of its configuration before\n"
+    "    it: their mean, standard deviation, min, median and max, the share\n"
+    "    of them it beats and how many standard deviations it is off. The\n"
+    "    run is the one of -r, or the last one of -k, or the last one of the\n"
+    "    store. Exits with 2 if it is worse than -z allows.\n"
+    "  -r [record]:\n"
+    "    The run to compare, by its record number as listed.\n"
+    "  -s [days]:\n"
+    "    Only list and fit the runs of the last [days] days.\n"
+    "  -v:\n"
+    "    Print version information and exit.\n"
+    "  -V[level]:\n"
+    "    Print verbose log. Use -V2 for even more verbose log.\n"
+    "  -z [deviations]:\n"
+    "    A run more than [deviations] standard deviations worse than the\n"
+    "    mean of -n is a regression(default: 2).";
+
+// exit status of a regression, 1 is taken by logFatal().
+#define EXIT_REGRESSION 2
+// days the runs of a trend span at least for a slope.
+#define MIN_SPAN (1 / 24.0)
+
+typedef struct
+{
+    const char *name;
+    const char *unit;
+    // a larger value is a better one.
+    int higher;
+    double (*get)(const storeRecord_t *record);
+} metric_t;
+
+static double bandwidth(const storeRecord_t *r)
+{
+    return r->elapsed > 0 ? r->bytes / r->elapsed : 0;
+}
+
+static double cpuCost(const storeRecord_t *r)
+{
+    return (r->utime + r->stime) * 1e9 / (r->bytes > 0 ? r->bytes : 1);
+}
+
+static double testTime(const storeRecord_t *r)
+{
+    return r->elapsed;
+}
+
+// the sender is the client with reverse, the server otherwise.
+static double retransmits(const storeRecord_t *r)
+{
+    return r->type & FLAG_REVERSE || r->serverBytes < 0 ?
+        r->retrans : r->serverRetrans;
+}
+
+static double smoothedRTT(const storeRecord_t *r)
+{
+    return r->type & FLAG_REVERSE || r->serverBytes < 0 ?
+        r->rtt : r->serverRtt;
+}
+
+static const metric_t metrics[] = {
+    { "bandwidth", "Bytes/sec", 1, bandwidth },
+    { "cpu", "ns/Byte", 0, cpuCost },
+    { "time", "s", 0, testTime },
+    { "retrans", "", 0, retransmits },
+    { "rtt", "us", 0, smoothedRTT },
+};
+#define METRIC_COUNT (int)(sizeof(metrics) / sizeof(metrics[0]))
+
+static char *storePath = NULL;
+static char *path = NULL;
+static char *configPrefix = NULL;
+static const metric_t *metric = metrics;
+static int compareRuns = 0;
+static int recordNo = -1;
+static int days = 0;
+static double threshold = 2;
+static store_t store;
+
+static void parseArguments(int argc, char **argv)
+{
+    char c;
+    int i;
+    optind = 0;
+    while ((c = getopt(argc, argv, "f:hk:l:m:n:r:s:vV::z:")) != EOF)
+    {
+        switch (c)
+        {
+        case 'f':
+            storePath = optarg;
+            break;
+        case 'h':
+            printUsageAndExit(argv);
+            break;
+        case 'k':
+            configPrefix = optarg;
+            break;
+        case 'l':
+            path = optarg;
+            break;
+        case 'm':
+            for (i = 0; i < METRIC_COUNT &&
+                 strcmp(metrics[i].name, optarg) != 0; ++i);
+            if (i == METRIC_COUNT)
+            {
+                logFatal("Unknown metric %s.", optarg);
+            }
+            metric = metrics + i;
+            break;
+        case 'n':
+            compareRuns = atoi(optarg);
+            break;
+        case 'r':
+            recordNo = atoi(optarg);
+            break;
+        case 's':
+            days = atoi(optarg);
+            break;
+        case 'v':
+            printVersionAndExit("mperf-history");
+            break;
+        case 'V':
+            if (optarg)
+            {
+                setVerbose(atoi(optarg));
+            }
+            else
+            {
+                setVerbose(1);
+            }
+            break;
+        case 'z':
+            threshold = atof(optarg);
+            break;
+        default:
+            logWarning("Unexpected command-line option %c!", (char)optopt);
+            printUsageAndExit(argv);
+        }
+    }
+
+    if (storePath == NULL)
+    {
+        logFatal("No results store specified.");
+    }
+    if (recordNo >= 0 && compareRuns <= 0)
+    {
+        logFatal("-r needs -n.");
+    }
+    if (recordNo >= 0 && configPrefix != NULL)
+    {
+        logFatal("-r can't be used with -k, the record has a "
+            "configuration.");
+    }
+    if (path != NULL)
+    {
+        redirectLogTo(path);
+    }
+}
+
+static char *formatTime(int64_t us, char *buf)
+{
+    time_t t = us / 1000000;
+    struct tm tm;
+
+    localtime_r(&t, &tm);
+    strftime(buf, 32, "%Y-%m-%d %H:%M:%S", &tm);
+    return buf;
+}
+
+// the configuration of the record for logs, buf takes 512 Bytes.
+static char *formatConfig(const storeRecord_t *r, char *buf)
+{
+    planTest_t test;
+    char *p = buf;
+
+    memset(&test, 0, sizeof(test));
+    test.type = r->type;
+    test.time = r->time;
+    test.size = r->size;
+    test.repeat = 1;
+    p += sprintf(p, "%.63s %.63s(%.15s): ", r->host, r->path, r->backend);
+    formatTest(&test, p);
+    p += strlen(p);
+    p += sprintf(p, ", %d stream%s, %s", r->streams,
+        r->streams > 1 ? "s" : "", r->mode >= 0 && r->mode < MODE_COUNT ?
+        testModes[r->mode].name : "unknown");
+    if (r->probeLen > 0)
+    {
+        p += sprintf(p, " %dB", r->probeLen);
+    }
+    if (r->sessions > 0)
+    {
+        p += sprintf(p, ", session of %d", r->sessions);
+    }
+    if (r->options & STORE_MPTCP)
+    {
+        p += sprintf(p, ", MPTCP");
+    }
+    if (r->options & STORE_FASTOPEN)
+    {
+        p += sprintf(p, ", Fast Open");
+    }
+    return buf;
+}
+
+static inline const storeRecord_t *configRecord(int i)
+{
+    return store.records + store.byConfig[i];
+}
+
+// the configuration the prefix of its hash stands for.
+static uint64_t findPrefix(const char *prefix)
+{
+    char hash[32];
+    uint64_t config, found = 0;
+    int matches = 0, i, first;
+
+    for (i = 0; i < store.count; i += findConfig(&store, config, &first))
+    {
+        config = configRecord(i)->config;
+        sprintf(hash, "%016llx", (unsigned long long)config);
+        if (strncasecmp(hash, prefix, strlen(prefix)) == 0)
+        {
+            found = config;
+            ++matches;
+        }
+    }
+    if (matches == 0)
+    {
+        logFatal("No configuration %s in %s.", prefix, storePath);
+    }
+    if (matches > 1)
+    {
+        logFatal("%s is the prefix of %d configurations.", prefix, matches);
+    }
+    return found;
+}
+
+static int64_t sinceUS()
+{
+    struct timeval now;
+
+    if (days <= 0)
+    {
+        return INT64_MIN;
+    }
+    gettimeofday(&now, NULL);
+    return (now.tv_sec - days * 86400LL) * 1000000LL + now.tv_usec;
+}
+
+static void listConfigs()
+{
+    const storeRecord_t *last;
+    char desc[512], when[32];
+    int64_t since = sinceUS();
+    int i, first, n, from, configs = 0;
+
+    logMessage("Configurations of %s(%d runs):", storePath, store.count);
+    for (i = 0; i < store.count; i += n)
+    {
+        n = findConfig(&store, configRecord(i)->config, &first);
+        from = findSince(&store, store.byConfig + first, n, since);
+        if (from == n)
+        {
+            continue;
+        }
+        last = configRecord(first + n - 1);
+        logMessage("->%016llx: %d runs, last #%d at %s, %s %lf%s, %s",
+            (unsigned long long)last->config, n - from,
+            (int)(last - store.records), formatTime(last->start, when),
+            metric->name, metric->get(last), metric->unit,
+            formatConfig(last, desc));
+        ++configs;
+    }
+    logMessage("->%d configurations", configs);
+}
+
+// sorts the values.
+static double median(double *values, int n)
+{
+    qsort(values, n, sizeof(double), compareDouble);
+    return n % 2 ? values[n / 2] : (values[n / 2 - 1] + values[n / 2]) / 2;
+}
+
+static void showTrend(uint64_t config)
+{
+    const storeRecord_t *r;
+    char desc[512], when[32];
+    double *values, x = 0, sx = 0, sy = 0, sxx = 0, sxy = 0, mean, slope;
+    double older, newer;
+    int i, first, n, from;
+
+    n = findConfig(&store, config, &first);
+    from = findSince(&store, store.byConfig + first, n, sinceUS());
+    first += from;
+    n -= from;
+    if (n == 0)
+    {
+        logFatal("No runs of %016llx in the last %d days.",
+            (unsigned long long)config, days);
+    }
+    if ((values = malloc(sizeof(double) * n)) == NULL)
+    {
+        failExit("malloc");
+    }
+    logMessage("Runs of %016llx, %s:", (unsigned long long)config,
+        formatConfig(configRecord(first), desc));
+    for (i = 0; i < n; ++i)
+    {
+        r = configRecord(first + i);
+        values[i] = metric->get(r);
+        logMessage("->#%d %s: %s %lf%s, %ld Bytes in %lfs",
+            (int)(r - store.records), formatTime(r->start, when),
+            metric->name, values[i], metric->unit, (long)r->bytes,
+            r->elapsed);
+        // days since the first run.
+        x = (r->start - configRecord(first)->start) / 86400e6;
+        sx += x;
+        sy += values[i];
+        sxx += x * x;
+        sxy += x * values[i];
+    }
+    mean = sy / n;
+    logMessage("Trend of %s over %d runs:", metric->name, n);
+    logMessage("->Mean: %lf%s", mean, metric->unit);
+    // a slope per day of runs minutes apart is noise.
+    if (x >= MIN_SPAN && n * sxx - sx * sx > 0)
+    {
+        slope = (n * sxy - sx * sy) / (n * sxx - sx * sx);
+        logMessage("->Slope: %lf%s per day(%+lf%% of the mean)", slope,
+            metric->unit, mean != 0 ? slope * 100 / mean : 0);
+    }
+    if (n > 1)
+    {
+        // the older half leaves the middle run to the newer one.
+        older = median(values, n / 2);
+        for (i = 0; i < n - n / 2; ++i)
+        {
+            values[i] = metric->get(configRecord(first + n / 2 + i));
+        }
+        newer = median(values, n - n / 2);
+        logMessage("->Median: %lf%s of the older %d runs, %lf%s of the "
+            "newer %d(%+lf%%)", older, metric->unit, n / 2, newer,
+            metric->unit, n - n / 2,
+            older != 0 ? (newer - older) * 100 / older : 0);
+    }
+    free(values);
+}
+
+// returns EXIT_REGRESSION if the run is worse than the threshold allows.
+static int compareRun(const storeRecord_t *run)
+{
+    char desc[512], when[32];
+    double *values, value = metric->get(run), mean = 0, var = 0, sd, z;
+    double beats = 0, mid;
+    int i, first, n, pos, k;
+
+    n = findConfig(&store, run->config, &first);
+    for (pos = 0; pos < n && configRecord(first + pos) != run; ++pos);
+    if ((k = pos < compareRuns ? pos : compareRuns) == 0)
+    {
+        logFatal("No run of %016llx before #%d.",
+            (unsigned long long)run->config, (int)(run - store.records));
+    }
+    if ((values = malloc(sizeof(double) * k)) == NULL)
+    {
+        failExit("malloc");
+    }
+    for (i = 0; i < k; ++i)
+    {
+        values[i] = metric->get(configRecord(first + pos - k + i));
+        mean += values[i];
+        // ties count half.
+        if (values[i] == value)
+        {
+            beats += 0.5;
+        }
+        else if ((values[i] < value) == metric->higher)
+        {
+            beats += 1;
+        }
+    }
+    mean /= k;
+    for (i = 0; i < k; ++i)
+    {
+        var += (values[i] - mean) * (values[i] - mean);
+    }
+    sd = k > 1 ? sqrt(var / (k - 1)) : 0;
+    if (sd > 0)
+    {
+        z = (value - mean) / sd;
+    }
+    else
+    {
+        z = value == mean ? 0 : value > mean ? INFINITY : -INFINITY;
+    }
+    mid = median(values, k);
+
+    logMessage("Run #%d of %016llx at %s, %s:", (int)(run - store.records),
+        (unsigned long long)run->config, formatTime(run->start, when),
+        formatConfig(run, desc));
+    logMessage("->%s: %lf%s", metric->name, value, metric->unit);
+    logMessage("->Last %d runs before it: mean %lf, stddev %lf, min %lf, "
+        "median %lf, max %lf", k, mean, sd, values[0], mid, values[k - 1]);
+    logMessage("->Better than %lf%% of them, %+lf standard deviations off "
+        "the mean", beats * 100 / k, z);
+    free(values);
+    if (metric->higher ? z < -threshold : z > threshold)
+    {
+        logMessage("->Regression: worse than %lf standard deviations.",
+            threshold);
+        return EXIT_REGRESSION;
+    }
+    if (metric->higher ? z > threshold : z < -threshold)
+    {
+        logMessage("->Improvement: better than %lf standard deviations.",
+            threshold);
+    }
+    else
+    {
+        logMessage("->Within %lf standard deviations.", threshold);
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    const storeRecord_t *run;
+    char errbuf[256];
+    uint64_t config = 0;
+    int first, n, records, ret = 0;
+
+    if (argc == 1)
+    {
+        printUsageAndExit(argv);
+    }
+
+    initLog();
+    parseArguments(argc, argv);
+    printInitLog();
+
+    if (openStore(&store, storePath) < 0)
+    {
+        logFatal("Can't open the results store %s(%s).", storePath,
+            strerrorV(errno, errbuf));
+    }
+    if (store.count == 0)
+    {
+        logFatal("No runs in %s.", storePath);
+    }
+    if (configPrefix != NULL)
+    {
+        config = findPrefix(configPrefix);
+    }
+    if (compareRuns > 0)
+    {
+        if (recordNo >= 0)
+        {
+            records = (store.len - STORE_HEADER) / STORE_RECORD;
+            if (recordNo >= records ||
+                store.records[recordNo].magic != STORE_MAGIC ||
+                store.records[recordNo].version != STORE_VERSION)
+            {
+                logFatal("No record #%d in %s.", recordNo, storePath);
+            }
+            run = store.records + recordNo;
+        }
+        else if (configPrefix != NULL)
+        {
+            n = findConfig(&store, config, &first);
+            run = configRecord(first + n - 1);
+        }
+        else
+        {
+            run = store.records + store.byTime[store.count - 1];
+        }
+        ret = compareRun(run);
+    }
+    else if (configPrefix != NULL)
+    {
+        showTrend(config);
+    }
+    else
+    {
+        listConfigs();
+    }
+    closeStore(&store);
+    return ret;
+}
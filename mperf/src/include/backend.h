@@ -0,0 +1,41 @@
+#ifndef __BACKEND_H__
+#define __BACKEND_H__
+
+#include <sys/types.h>
+#include <sys/socket.h>
+
+// socket calls go through a backend table so that the same programs can
+// drive the kernel stack or a user-space TCP/IP stack. the backend is chosen
+// at startup with the MPERF_BACKEND environment variable:
+//   kernel: the kernel stack(default).
+//   user:   a user-space stack linked in with the __wrap_ symbol convention
+//           (build with `make STACK=...`).
+typedef struct
+{
+    const char *name;
+    int (*socket)(int domain, int type, int protocol);
+    int (*bind)(int fd, const struct sockaddr *addr, socklen_t len);
+    int (*listen)(int fd, int backlog);
+    int (*accept)(int fd, struct sockaddr *addr, socklen_t *len);
+    int (*connect)(int fd, const struct sockaddr *addr, socklen_t len);
+    ssize_t (*read)(int fd, void *buf, size_t n);
+    ssize_t (*write)(int fd, const void *buf, size_t n);
+    int (*close)(int fd);
+    int (*setsockopt)(int fd, int level, int name, const void *val,
+        socklen_t len);
+    int (*getsockopt)(int fd, int level, int name, void *val,
+        socklen_t *len);
+    ssize_t (*sendto)(int fd, const void *buf, size_t n, int flags,
+        const struct sockaddr *addr, socklen_t len);
+    ssize_t (*recvfrom)(int fd, void *buf, size_t n, int flags,
+        struct sockaddr *addr, socklen_t *len);
+} backend_t;
+
+extern const backend_t *backend;
+// the kernel stack whatever the backend, for the sockets the controller polls
+// with epoll(the UDP control and the metrics endpoint).
+extern const backend_t *kernelStack;
+
+const backend_t *findBackend(const char *name);
+
+#endif
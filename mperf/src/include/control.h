@@ -0,0 +1,59 @@
+#ifndef __CONTROL_H__
+#define __CONTROL_H__
+
+#include <stdint.h>
+
+#include "plan.h"
+
+// control requests and replies over UDP: a single round trip instead of a
+// TCP handshake followed by the exchange on the connection. a datagram is
+//   magic(4) | request id(8) | time(8) | code(1) | message | MAC(8)
+// where time is when it was sent(us since the epoch), code is the
+// instruction of a request or the return value of a reply, the message is
+// binary for a configure and a string otherwise, and the MAC is SipHash-2-4
+// of the rest keyed with the shared secret(-K or MPERF_KEY, empty by
+// default). the client picks a random request id and retransmits with
+// backoff until it gets the final reply. the controller answers a request id
+// it has seen with the reply it already sent, and refuses a new one sent
+// more than CONTROL_WINDOW away from its own clock, so every request is
+// carried out once. a queued test gets RET_QUEUED replies until the final
+// one. the datagrams always go through the kernel stack
+// (kernelStack), a controller with a user-space stack is configured over TCP.
+#define CONTROL_MAGIC 0x6d504354
+#define CONTROL_MESSAGE 1024
+#define CONTROL_HEADER 21
+#define CONTROL_MAC 8
+#define MAX_DATAGRAM (CONTROL_HEADER + CONTROL_MESSAGE + CONTROL_MAC)
+// first retransmission timeout(ms), doubled up to CONTROL_RTO_MAX.
+#define CONTROL_RTO 1000
+#define CONTROL_RTO_MAX 8000
+#define CONTROL_TRIES 6
+// seconds a request is fresh for, the clocks of the hosts have to agree
+// within it.
+#define CONTROL_WINDOW 60
+
+// derives the MAC key from the secret, or from MPERF_KEY if it's NULL.
+// returns 0 if there is no secret, the key is then known to everyone.
+int setControlKey(const char *secret);
+// stamps the datagram with the current time, returns its length.
+int packControl(char *buf, uint64_t reqid, char code, const char *message,
+    int mlen);
+// returns the length of the message, or -1 for a datagram that isn't ours or
+// fails the MAC. message takes up to CONTROL_MESSAGE + 1 Bytes, the message
+// and a NUL. sent is the time of the datagram.
+int unpackControl(const char *buf, int len, uint64_t *reqid, int64_t *sent,
+    char *code, char *message);
+// binds the controller's socket, returns -1 on failure.
+int openControlFD(const char *local, int port);
+// sends the request with the mlen Bytes of message to the controller and
+// waits for the final reply. returns its return value and leaves its message
+// in message, or RET_EREAD if the controller doesn't answer.
+char controlRequest(const char *local, const char *server,
+    unsigned short port, char code, char *message, int mlen);
+// asks the controller at server:port for the test of plan, over a datagram
+// or, with tcp, a connection from local:localPort(Fast Open with fastOpen).
+// returns the data port of the test, a refused test is fatal.
+unsigned short configureTest(const plan_t *plan, char *local, int localPort,
+    char *server, unsigned short port, int tcp, int fastOpen);
+
+#endif
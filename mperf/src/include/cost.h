@@ -0,0 +1,22 @@
+#ifndef __COST_H__
+#define __COST_H__
+
+#include <sys/resource.h>
+
+// CPU cost of a test, collected by costStart()/costStop().
+// cycles and instructions are -1 if perf_event_open() is not permitted.
+typedef struct
+{
+    double utime;
+    double stime;
+    long nvcsw;
+    long nivcsw;
+    long cycles;
+    long instructions;
+} cost_t;
+
+void costStart();
+void costStop(cost_t *cost);
+void logCost(const cost_t *cost, long bytes);
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef __FLOWS_H__
+#define __FLOWS_H__
+
+#include <stdint.h>
+
+// a TCP flow found in a capture. side 0 is the initiator, the end that sent
+// the SYN(or the first packet if the handshake wasn't captured).
+typedef struct
+{
+    int family;
+    uint8_t addr[2][16];
+    uint16_t port[2];
+    // seconds since the first packet of the capture: the first packet of the
+    // flow and its last packet carrying data.
+    double start;
+    double end;
+    // bytes sent by each side, retransmissions are only counted once.
+    long bytes[2];
+    // sequence numbers of the first and after the last byte seen.
+    uint32_t seqStart[2];
+    uint32_t seqEnd[2];
+    int seen[2];
+    // next flow in the same hash bucket.
+    int next;
+} flow_t;
+
+// reads the TCP flows of a pcap file(Ethernet, Linux cooked, raw IP or BSD
+// loopback) into *flows, sorted by their start time. returns the number of
+// flows, or -1 with a message in errbuf.
+int readFlows(const char *path, flow_t **flows, char *errbuf);
+// "ip:port -> ip:port", from the initiator to the responder.
+char *flowName(const flow_t *flow, char *buf);
+
+#endif
@@ -0,0 +1,83 @@
+#ifndef __LIVE_H__
+#define __LIVE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// live statistics of the tests, one entry per test slot in a shared memory
+// block(SMEM_STATS) the controller maps before it forks, so that it answers
+// SIG_STAT and the metrics from a snapshot without signalling the servers.
+// sent and received are counters the rio functions of every stream add to
+// atomically, the other fields change together under a seqlock: the server
+// makes seq odd, writes them and makes it even again, a reader retries while
+// seq is odd or changed under it.
+#define LIVE_IDLE 0
+// configured, waiting for the connections of the next run.
+#define LIVE_WAITING 1
+#define LIVE_RUNNING 2
+#define LIVE_DONE 3
+
+typedef struct
+{
+    uint32_t seq;
+    int32_t state;
+    // data port and process of the server.
+    int32_t port;
+    int32_t pid;
+    // run of the plan in progress, and all of them.
+    int32_t run;
+    int32_t runs;
+    // when the last run started and ended, us since the epoch.
+    int64_t start;
+    int64_t end;
+    // Bytes sent and received by all the servers of the slot so far, and
+    // both of them when the last run started.
+    int64_t sent;
+    int64_t received;
+    int64_t base;
+} liveStat_t;
+
+// the server's entry, NULL in the controller.
+extern liveStat_t *liveStat;
+
+// count the Bytes of a write or a read of the test.
+static inline void liveSent(long bytes)
+{
+    if (liveStat != NULL)
+    {
+        __atomic_fetch_add(&liveStat->sent, bytes, __ATOMIC_RELAXED);
+    }
+}
+
+static inline void liveReceived(long bytes)
+{
+    if (liveStat != NULL)
+    {
+        __atomic_fetch_add(&liveStat->received, bytes, __ATOMIC_RELAXED);
+    }
+}
+
+// maps the block, before any server is forked.
+void initLiveStats();
+// the slot of the servers forked from now on.
+void setLiveSlot(int slot);
+// makes the slot the server's own, LIVE_WAITING for the first run.
+void attachLiveStat(int port, int runs);
+// LIVE_RUNNING starts a run, the others end it.
+void setLiveState(int state, int run);
+// a consistent copy of the slot, returns -1 if its server died while
+// writing it.
+int readLiveStat(int slot, liveStat_t *stat);
+// Bytes of the run going on, or of the last one.
+static inline int64_t liveBytes(const liveStat_t *stat)
+{
+    int64_t bytes = stat->sent + stat->received - stat->base;
+
+    return bytes > 0 ? bytes : 0;
+}
+// ends the test of a server that exited without doing so.
+void liveExited(pid_t pid);
+const char *liveStateName(int state);
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef __MANY_H__
+#define __MANY_H__
+
+// many-connection test: the client opens thousands of mostly idle
+// connections to a single server process, which serves all of them from one
+// epoll loop. the sending end writes a burst of burst bytes on every
+// connection every interval ms, the bursts of different connections are
+// spread evenly over the interval. it needs the kernel stack.
+#define MAX_CONNS 65536
+
+typedef struct
+{
+    int conns;
+    // seconds of traffic after all the connections are open, the server
+    // stops when the client has closed them instead.
+    int timelen;
+    int burst;
+    int interval;
+    // whether this end sends the bursts.
+    int send;
+} many_t;
+
+// connection i goes from the (i mod nlocal)th local address to the
+// (i mod nserver)th server address.
+void doManyClient(const many_t *m, char **locals, int nlocal, char **servers,
+    int nserver, int port, int connectTime, char *buf);
+void doManyServer(const many_t *m, const int *listenfds, int nlisten,
+    char *buf);
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef __METRICS_H__
+#define __METRICS_H__
+
+// counters of the controller, in a shared memory block(SMEM_METRICS) mapped
+// before it forks, so that the processes of the concurrent tests add to them
+// as well. they're served in the Prometheus text format by the controller
+// itself on a port of its own(-m), with the Bytes and the states of the
+// tests from the live statistics(live.h).
+
+// return values of a configure, RET_SUCC to RET_QUEUED.
+#define METRICS_RETS 7
+// upper bounds(seconds) of the buckets of the configure latency, the last
+// one is +Inf.
+#define METRICS_BUCKETS { 0.001, 0.005, 0.01, 0.05, 0.1, 0.5, 1, 5, 10, 30, \
+    60 }
+#define METRICS_BUCKET_COUNT 12
+// seconds a scraper has to send its whole request, from its connect.
+#define METRICS_TIMEOUT 1
+// scrapes read at once, the ones past them are refused.
+#define MAX_SCRAPES 8
+
+// maps the block, before any process is forked.
+void initMetrics();
+// a configure answered with ret after seconds, the time in the queue
+// included.
+void countConfigure(char ret, double seconds);
+// a test ended because the next one took its place.
+void countPreemption();
+// returns the nonblocking listening socket, or -1.
+int openMetricsFD(const char *local, int port);
+// the requests of the scrapes are read without blocking as they come in the
+// event loop of the controller, which watches the fd of every scrape.
+// accepts a scrape on the listener, returns its index with its fd in *fd,
+// or -1.
+int acceptScrape(int listenfd, int *fd);
+// reads what came of scrape i, and answers it once its request is whole.
+// slots is the number of test slots.
+void readScrape(int i, int slots);
+// closes the scrapes past their deadline, returns the ms until the next
+// deadline, -1 for none.
+int expireScrapes();
+// closes the scrapes in a forked process.
+void closeScrapes();
+
+#endif
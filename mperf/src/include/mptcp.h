@@ -0,0 +1,9 @@
+#ifndef __MPTCP_H__
+#define __MPTCP_H__
+
+// logs the subflows of an MPTCP socket and the throughput of each one over
+// the last elapsed seconds. it's kept apart from util.h because it needs the
+// kernel's struct tcp_info, which conflicts with <netinet/tcp.h>.
+void logMPTCPInfo(int fd, double elapsed);
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef __PLAN_H__
+#define __PLAN_H__
+
+#include <stdint.h>
+
+// the control message of a configure: the settings of the server and the
+// tests it runs back to back, a single test being a plan of one. it's sent
+// as
+//   magic(4) | version(4) | flags, streams, mode, probeLen, conns,
+//   interval, priority, count(4 each) | count tests(32 each)
+// with every field a 32-bit integer in network byte order, in the order of
+// plan_t and planTest_t. a message of an unknown version is refused.
+#define PLAN_MAGIC 0x6d50504e
+#define PLAN_VERSION 1
+#define PLAN_HEADER 40
+#define PLAN_TEST 32
+// as many tests as fit in a control message(CONTROL_MESSAGE).
+#define MAX_PLAN 30
+
+typedef struct
+{
+    // TYPE_LONG or TYPE_FIX, with FLAG_REVERSE when the client sends.
+    int type;
+    // runs of the test, each on new data connections.
+    int repeat;
+    // seconds a long test sends.
+    int time;
+    // seconds the receiver, or the sender of a fix test, waits for the test
+    // to end, <= 0 for the default.
+    int timeout;
+    // Bytes of a fix test, packets per probe of a probe test, burst of a
+    // many-connection test or flows of a replay.
+    int size;
+    // probe tests: probes, and ms between two packets and two probes.
+    int loop;
+    int sendInterval;
+    int probeInterval;
+} planTest_t;
+
+typedef struct
+{
+    // FLAG_SESSION, FLAG_MANY, FLAG_INCAST, FLAG_REPLAY, FLAG_PORT,
+    // FLAG_RESULTS and FLAG_TRACE, a plan of more than one run has none of
+    // the first four.
+    int flags;
+    int streams;
+    int mode;
+    int probeLen;
+    // many-connection tests: connections, and ms between two bursts.
+    int conns;
+    int interval;
+    // place of the test in the controller's queue, higher first.
+    int priority;
+    int count;
+    planTest_t tests[MAX_PLAN];
+} plan_t;
+
+// returns the length of the message.
+int encodePlan(const plan_t *plan, char *buf);
+// returns the length of the message, or -1 for a message that isn't a plan
+// of a version we know or is longer than len.
+int decodePlan(plan_t *plan, const char *buf, int len);
+// parses tests like "long 10s; fix 1KB x100; reverse long 10s" into plan
+// (probe tests give their packets per probe as the size). returns NULL, or
+// the item it can't parse.
+char *parsePlan(plan_t *plan, char *text);
+// the test as the text of parsePlan().
+char *formatTest(const planTest_t *test, char *buf);
+// the whole plan for logs, cut short to fit the PLAN_TEXT Bytes of buf.
+#define PLAN_TEXT 2048
+char *formatPlan(const plan_t *plan, char *buf);
+// runs of all tests.
+int planRuns(const plan_t *plan);
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef __PROBES_H__
+#define __PROBES_H__
+
+// USDT probes of provider "mperf", e.g.
+//   bpftrace -e 'usdt:./mperf-server:mperf:conf_done { print(arg0); }'
+// an unattached probe is a single nop, its arguments are only left where the
+// tracer can find them. without <sys/sdt.h>(systemtap-sdt-dev), or with
+// -D NO_USDT, the probes are compiled out.
+//
+// probes:
+//   test_start(kind, fd)           kind: "long", "fix", "probe", "recv"
+//   test_done(kind, fd, bytes, us)
+//   rio_read(fd, n, ret)           every rio_readnr() call
+//   rio_write(fd, n, ret)          every rio_writenr() call
+//   conf_start()                   controller received SIG_CONF
+//   conf_message(message)          control message from the client
+//   conf_done(ret)                 return value sent back to the client
+//   fork(pid)                      controller started a server
+//   signal(sig)                    signal received by controller or server
+//   worker_configured(type, timeout, size)
+//                                  the first test of the plan
+//   udp_send(seq), udp_recv(seq)   UDP packet sent or received
+
+#if !defined(NO_USDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define HAVE_USDT
+#endif
+#endif
+
+#ifdef HAVE_USDT
+#include <sys/sdt.h>
+#define USDT0(name) STAP_PROBE(mperf, name)
+#define USDT1(name, a) STAP_PROBE1(mperf, name, a)
+#define USDT2(name, a, b) STAP_PROBE2(mperf, name, a, b)
+#define USDT3(name, a, b, c) STAP_PROBE3(mperf, name, a, b, c)
+#define USDT4(name, a, b, c, d) STAP_PROBE4(mperf, name, a, b, c, d)
+#else
+// the arguments are still referenced so that they don't become unused.
+#define USDT0(name) do { } while (0)
+#define USDT1(name, a) do { if (0) { (void)(a); } } while (0)
+#define USDT2(name, a, b) do { if (0) { (void)(a); (void)(b); } } while (0)
+#define USDT3(name, a, b, c) \
+    do { if (0) { (void)(a); (void)(b); (void)(c); } } while (0)
+#define USDT4(name, a, b, c, d) \
+    do { if (0) { (void)(a); (void)(b); (void)(c); (void)(d); } } while (0)
+#endif
+
+#endif
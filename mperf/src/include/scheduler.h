@@ -0,0 +1,61 @@
+#ifndef __SCHEDULER_H__
+#define __SCHEDULER_H__
+
+#include <sys/types.h>
+
+#include "plan.h"
+
+// scheduler of the concurrent tests of a controller: tests start in the
+// order of their priority, then of their arrival, as long as a test slot is
+// free and the bandwidth they need fits in the host-wide budget. the test at
+// the head of the queue is never overtaken, so that a test that wants the
+// link alone isn't starved by lighter ones.
+#define MAX_TESTS 64
+#define MAX_QUEUE 256
+#define MAX_JOBS (MAX_TESTS + MAX_QUEUE)
+
+typedef struct
+{
+    // the process serving the control connection of the test and the
+    // controller's end of the socket pair to it, -1 for a free entry.
+    pid_t pid;
+    int fd;
+    // order of arrival, -1 until the test has been requested.
+    long seq;
+    // higher first.
+    int priority;
+    // Bytes/sec the test needs, the whole budget for a test that wants the
+    // link alone.
+    long demand;
+    // estimated seconds the test runs.
+    double duration;
+    // when the test started.
+    double since;
+    // data port slot, -1 while queued.
+    int slot;
+    // place in the queue and estimated seconds until the test starts.
+    int position;
+    int eta;
+    // whether the process of the test has to be told about a new slot,
+    // position or estimate.
+    int changed;
+} job_t;
+
+// sent to the process of a test: the slot to start on, or its place in the
+// queue and estimated wait. position 0 means the test never fits.
+typedef struct
+{
+    int slot;
+    int position;
+    int eta;
+} schedReply_t;
+
+// budget in Bytes/sec, 0 for no budget.
+void initScheduler(int slots, long budget);
+// fills the request of a job from its control message. returns -1 if the
+// test needs more than the whole budget.
+int parseRequest(job_t *job, const plan_t *plan, long seq);
+// starts the queued jobs that fit and estimates when the others start.
+void schedule(job_t *jobs, int n, double now);
+
+#endif
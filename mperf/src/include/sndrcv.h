@@ -1,20 +1,65 @@
 #ifndef __SNDRCV_H__
 #define __SNDRCV_H__
 
+#include "cost.h"
 #include "lock.h"
+#include "plan.h"
+#include "util.h"
+
+// result of the last doLongTest/doFixTest/doReceive call.
+typedef struct
+{
+    long bytes;
+    double elapsed;
+    cost_t cost;
+    // TCP counters of the connection, left to the caller of the test: the
+    // retransmissions and the smoothed RTT(us), summed and the largest one
+    // over parallel streams.
+    long retrans;
+    long rtt;
+} result_t;
+
+// the results of the server, sent back to the client after the test(see
+// FLAG_RESULTS): a magic and the fields of result_t as 64-bit integers in
+// network byte order, times in us.
+#define RESULTS_MAGIC 0x6d505253
+#define RESULTS_LEN 84
+
+// a test mode(MODE_*) picks the loops of the tests once, before they start.
+typedef struct
+{
+    const char *name;
+    long (*sendLoop)(int connfd, char *buf, int *wrote);
+    long (*recvLoop)(int connfd, char *buf, long len, int *ret);
+    // whether the data connections use TCP_NODELAY.
+    int nodelay;
+} testMode_t;
 
 // sndrcv utils
 extern lock_t sigalrm;
 extern lock_t sigint;
+extern result_t lastResult;
+extern const testMode_t testModes[MODE_COUNT];
+extern const testMode_t *testMode;
 
-#ifdef PROBE
+int findTestMode(const char *name);
+void fillPacketBuf(char *buf);
 void doProbe(int connfd, int sendInterval, int probeInterval, int size,
-    int loop, char *packetBuf);
-#else
+    int loop, int pktLen, char *packetBuf);
+void doProbeReceive(int connfd, int timelen, int sendInterval, int size,
+    int loop, int pktLen, char *recvBuf);
 void doFixTest(int connfd, int maxtime, int len, char *packetBuf);
-#endif
 void doLongTest(int connfd, int timelen, char *packetBuf);
 void doReceive(int connfd, int timelen, char *recvBuf);
+void doReceiveN(int connfd, int timelen, long len, char *recvBuf);
+void doSession(int connfd, int (*test)(int connfd));
+void doPlan(const plan_t *plan, int (*test)(const planTest_t *test));
+void doParallel(int n, int *fds, char **names, void (*test)(int connfd));
+// returns the length of the record.
+int encodeResults(const result_t *result, char *buf);
+// returns -1 if the record isn't one.
+int decodeResults(result_t *result, const char *buf);
+void signalStreams(int sig);
 
 static inline int continueTest()
 {
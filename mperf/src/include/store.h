@@ -0,0 +1,106 @@
+#ifndef __STORE_H__
+#define __STORE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// the results store of mperf-client -o, read by mperf-history: a header and
+// a record per test run, appended and never changed. the records have a
+// fixed layout in the byte order of the host, so a reader maps the file and
+// indexes it instead of parsing it. an append takes an exclusive flock() on
+// the file, a record cut short by a crash is left out by the readers and
+// overwritten by the next append.
+#define STORE_MAGIC 0x6d505253
+#define STORE_VERSION 1
+#define STORE_HEADER 64
+#define STORE_RECORD 512
+#define STORE_NAME 64
+
+// options of the test that take part in its configuration.
+#define STORE_MPTCP 1
+#define STORE_FASTOPEN 2
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t recordLen;
+    uint32_t reserved;
+    // when the store was created, us since the epoch.
+    int64_t created;
+    char unused[40];
+} storeHeader_t;
+
+typedef struct
+{
+    // STORE_MAGIC and STORE_VERSION, also in every record so that a reader
+    // can tell a record from garbage.
+    uint32_t magic;
+    uint32_t version;
+    // hash of the configuration, see configHash().
+    uint64_t config;
+    // when the run started and ended, us since the epoch.
+    int64_t start;
+    int64_t end;
+    // the client's host name, "[local ip]->[server ip]:[cport]" with the
+    // first addresses of -B and -c("*" for no -B), and the backend.
+    char host[STORE_NAME];
+    char path[STORE_NAME];
+    char backend[16];
+    // the configuration: the test as in the plan(time of a long test, size
+    // of a fix test) and the settings of the client.
+    int32_t type;
+    int32_t time;
+    int32_t size;
+    int32_t streams;
+    int32_t mode;
+    int32_t probeLen;
+    int32_t sessions;
+    int32_t options;
+    // the results of the client, the sum of its streams.
+    int64_t bytes;
+    double elapsed;
+    double utime;
+    double stime;
+    int64_t retrans;
+    int64_t rtt;
+    // the results of the server, serverBytes is -1 if it sent none.
+    int64_t serverBytes;
+    double serverElapsed;
+    double serverUtime;
+    double serverStime;
+    int64_t serverRetrans;
+    int64_t serverRtt;
+    char unused[208];
+} storeRecord_t;
+
+// a store mapped for reading, with the numbers of its records sorted by
+// configuration then start(byConfig) and by start alone(byTime).
+typedef struct
+{
+    void *map;
+    size_t len;
+    const storeRecord_t *records;
+    int count;
+    int *byConfig;
+    int *byTime;
+} store_t;
+
+// hash(FNV-1a) of the host, the path, the backend and the configuration.
+uint64_t configHash(const storeRecord_t *record);
+// stamps the record with its magic, version and configuration, and appends
+// it to the store at path, created if it doesn't exist. returns -1 with
+// errno set on failure, EINVAL for a file that isn't a store of this
+// version.
+int appendRecord(const char *path, storeRecord_t *record);
+// maps and indexes the store, returns -1 with errno set on failure.
+int openStore(store_t *store, const char *path);
+void closeStore(store_t *store);
+// the runs of config are byConfig[*first] to byConfig[*first + n - 1] in the
+// order they started, returns n.
+int findConfig(const store_t *store, uint64_t config, int *first);
+// the first of the n records of index(a part of byConfig or byTime) that
+// started at since or later, n if none did.
+int findSince(const store_t *store, const int *index, int n, int64_t since);
+
+#endif
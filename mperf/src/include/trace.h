@@ -0,0 +1,98 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <stdint.h>
+
+// phases of a test, recorded with CLOCK_MONOTONIC(us) by the processes of
+// either end into a buffer they share, and written by the client as a
+// Chrome trace(mperf-client -j). a phase of the control exchange has no
+// stream(-1).
+//   client:     dial(-H), request(configure sent until the reply came),
+//               connect, data, close and results per stream.
+//   controller: accept(the request came), queue, terminate(the previous
+//               server), fork(or the wake-up of a pooled server), ready(until
+//               SIGUSR1 came) and reply.
+//   server:     configure(until the listeners are open), connect(accept),
+//               data and close per stream.
+// data goes from the end of the first read or write of a stream to the end
+// of its loop.
+#define TRACE_DIAL 0
+#define TRACE_REQUEST 1
+#define TRACE_ACCEPT 2
+#define TRACE_QUEUE 3
+#define TRACE_TERMINATE 4
+#define TRACE_FORK 5
+#define TRACE_CONFIGURE 6
+#define TRACE_READY 7
+#define TRACE_REPLY 8
+#define TRACE_CONNECT 9
+#define TRACE_DATA 10
+#define TRACE_CLOSE 11
+#define TRACE_RESULTS 12
+#define TRACE_PHASES 13
+
+#define MAX_TRACE 512
+
+typedef struct
+{
+    int32_t phase;
+    int32_t stream;
+    int64_t begin;
+    int64_t end;
+} traceEvent_t;
+
+// the events of the server follow its results when the client asks for them
+// with FLAG_TRACE: count(4) | count events of phase(4), stream(4), begin(8)
+// and end(8). then, TRACE_SAMPLES times, the client writes a byte and the
+// server answers with its clock when the byte came and when it answered(8
+// each), all in network byte order. as NTP does, the client takes the
+// server's clock to be ahead by the mean of the two one-way differences of
+// the sample with the shortest round trip, the one queueing skewed least.
+#define TRACE_HEADER 4
+#define TRACE_EVENT 24
+#define TRACE_CLOCK 16
+#define TRACE_SAMPLES 8
+
+// the first read or write of the stream of this process is still to come.
+extern int traceArmed;
+
+int64_t traceNow();
+// maps a new buffer, the processes forked from now on share it.
+void initTrace();
+void resetTrace();
+void traceEvent(int phase, int stream, int64_t begin, int64_t end);
+void traceFirstByte();
+
+static inline void traceSpan(int phase, int stream, int64_t begin)
+{
+    traceEvent(phase, stream, begin, traceNow());
+}
+
+// a read or a write of the test.
+static inline void traceBytes(long bytes)
+{
+    if (traceArmed && bytes > 0)
+    {
+        traceFirstByte();
+    }
+}
+
+// the stream of this process starts, and ends its data phase.
+void traceStreamStart(int stream);
+void traceStreamEnd();
+
+// returns the length of the events with their header.
+int encodeTrace(char *buf);
+// returns the number of events the header announces, -1 for too many.
+int decodeTraceHeader(const char *buf);
+void decodeTraceEvents(const char *buf, int count, traceEvent_t *events);
+int encodeTraceClock(char *buf, int64_t received);
+// returns how far the clock of the server is ahead by the sample the client
+// asked for at asked, and its round trip in *rtt.
+int64_t decodeTraceClock(const char *buf, int64_t asked, int64_t *rtt);
+// writes the events of the client and those of the server, whose clock is
+// offset ahead, as a Chrome trace. returns -1 with errno set on failure.
+int writeTrace(const char *path, const traceEvent_t *server, int count,
+    int64_t offset);
+
+#endif
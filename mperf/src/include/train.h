@@ -0,0 +1,44 @@
+#ifndef __TRAIN_H__
+#define __TRAIN_H__
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include <arpa/inet.h>
+
+// probe packets of at least PROBE_STAMP_LEN bytes start with the time they
+// were sent, seconds and nanoseconds of CLOCK_MONOTONIC in network byte
+// order. only differences between stamps are used, so the clocks of the two
+// ends needn't agree.
+#define PROBE_STAMP_LEN 8
+
+static inline void putProbeStamp(char *buf)
+{
+    struct timespec ts;
+    uint32_t stamp[2];
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    stamp[0] = htonl((uint32_t)ts.tv_sec);
+    stamp[1] = htonl((uint32_t)ts.tv_nsec);
+    memcpy(buf, stamp, sizeof(stamp));
+}
+
+static inline void getProbeStamp(const char *buf, struct timespec *ts)
+{
+    uint32_t stamp[2];
+
+    memcpy(stamp, buf, sizeof(stamp));
+    ts->tv_sec = ntohl(stamp[0]);
+    ts->tv_nsec = ntohl(stamp[1]);
+}
+
+// estimates the bottleneck capacity and the available bandwidth of a path
+// from the arrival times of probe packets. recv[i] is the arrival time of the
+// ith packet and sent[i] its send time, or NULL if the packets are too small
+// to carry one. packets of len bytes come in trains of size packets, sent gap
+// us apart(0 if sent back-to-back).
+void logTrainAnalysis(const struct timespec *sent,
+    const struct timespec *recv, int count, int size, int len, int gap);
+
+#endif
@@ -2,10 +2,12 @@
 #define __UTIL_H__
 
 #include <ctype.h>
+#include <endian.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <math.h>
 #include <netdb.h>
+#include <poll.h>
 #include <pthread.h>
 #include <semaphore.h>
 #include <setjmp.h>
@@ -25,8 +27,10 @@
 #include <sys/wait.h>
 #include <sys/socket.h>
 
+#include "backend.h"
 #include "lock.h"
 #include "log.h"
+#include "probes.h"
 
 #define PACKET_LEN 131072
 
@@ -34,11 +38,24 @@
 #define SMEM_SERVERPID 0
 #define SMEM_CONTROLLERPID 1
 #define SMEM_MESSAGE 2
+// live statistics of the tests, see live.h.
+#define SMEM_STATS 3
+// counters of the controller, see metrics.h.
+#define SMEM_METRICS 4
 
 #define MESSAGE_TIMEOUT 10
 
+// max number of addresses in a -B/-c/-s list, and of parallel streams.
+#define MAX_ADDRS 16
+#define MAX_STREAMS 64
+// flows of a replay, each of them takes a process on both ends.
+#define MAX_FLOWS 4096
+
 #define SIG_TERM 0
 #define SIG_CONF 1
+// a snapshot of the tests, see live.h. the message is "[port]", the reply
+// has a line per test.
+#define SIG_STAT 2
 
 #define RET_SUCC 0
 #define RET_EMSG 1
@@ -46,15 +63,123 @@
 #define RET_EREAD 3
 #define RET_EWRITE 4
 #define RET_EPROC 5
+// the test waits in the controller's queue, "[position] [seconds]" follows,
+// then another return value.
+#define RET_QUEUED 6
 
 #define TYPE_LONG 0
 #define TYPE_FIX 1
 #define FLAG_REVERSE 2
+#define FLAG_SESSION 4
+// a long test over many mostly idle connections served by epoll, see many.h.
+#define FLAG_MANY 8
+// the server sends only after the client writes a byte on the data
+// connection, so that the client can start several servers at once.
+#define FLAG_INCAST 16
+// replays the flows of a capture: the server serves every connection in its
+// own process, see replay.c.
+#define FLAG_REPLAY 32
+// the controller replies with the data port of the test after RET_SUCC, a
+// controller running concurrent tests gives every test its own port.
+#define FLAG_PORT 64
+// after every run of the test, the client opens one more connection to the
+// data port and asks for the server's results(see encodeResults()).
+#define FLAG_RESULTS 128
+// the server's trace of the test follows its results, see trace.h.
+#define FLAG_TRACE 256
 #define TYPE_REVLONG (TYPE_LONG | FLAG_REVERSE)
 #define TYPE_REVFIX (TYPE_FIX | FLAG_REVERSE)
+// test modes, each of them has its own send and receive loops.
+//   bulk:    send PACKET_LEN packets as fast as possible.
+//   probe:   fix tests send 1-byte probe packets at given intervals.
+//   check:   the receiver checks the content of every packet.
+//   trickle: long tests send a byte every 50ms.
+//   slow:    long tests send a packet every second.
+#define MODE_BULK 0
+#define MODE_PROBE 1
+#define MODE_CHECK 2
+#define MODE_TRICKLE 3
+#define MODE_SLOW 4
+#define MODE_COUNT 5
+
+// ends a session in place of the type of the next test.
+#define TYPE_END -1
+// asks for the results of the test that just ended, see FLAG_RESULTS.
+#define TYPE_RESULTS -2
+
+// in a session, every test is started by this header on the data connection
+// instead of a new configure round trip. all fields are sent in network byte
+// order, arg is the timeout and arg2 the size of the test(see planTest_t).
+#define SESSION_MAGIC 0x6d505353
+
+typedef struct
+{
+    uint32_t magic;
+    int32_t type;
+    int32_t arg;
+    int32_t arg2;
+} sessionHeader_t;
+
+// big-endian integers of the wire formats(plan, results, trace), p needn't
+// be aligned. each returns p past the integer.
+static inline char *put32(char *p, int32_t x)
+{
+    uint32_t n = htonl((uint32_t)x);
+
+    memcpy(p, &n, 4);
+    return p + 4;
+}
+
+static inline char *put64(char *p, int64_t x)
+{
+    uint64_t n = htobe64((uint64_t)x);
+
+    memcpy(p, &n, 8);
+    return p + 8;
+}
+
+static inline const char *get32(const char *p, int32_t *x)
+{
+    uint32_t n;
+
+    memcpy(&n, p, 4);
+    *x = (int32_t)ntohl(n);
+    return p + 4;
+}
+
+static inline const char *get64(const char *p, int64_t *x)
+{
+    uint64_t n;
+
+    memcpy(&n, p, 8);
+    *x = (int64_t)be64toh(n);
+    return p + 8;
+}
 
 #define BOOL(val) (!!(val))
 
+// log2 buckets of bytes returned by a single read(), the last bucket also
+// counts all larger reads.
+#define RIO_HIST_LEN 32
+
+typedef struct
+{
+    long reads;
+    long writes;
+    long partialReads;
+    long partialWrites;
+    long interrupts;
+    long readHist[RIO_HIST_LEN];
+} rioStat_t;
+
+extern rioStat_t rioStat;
+
+static inline int rioBucket(size_t n)
+{
+    int i = 63 - __builtin_clzl(n);
+    return i < RIO_HIST_LEN ? i : RIO_HIST_LEN - 1;
+}
+
 typedef void (*sighandler_t)(int);
 
 static inline char *strerrorV(int num, char *buf)
@@ -64,6 +189,24 @@ static inline char *strerrorV(int num, char *buf)
     return buf;
 }
 
+// CLOCK_MONOTONIC in us.
+static inline int64_t monotonicUS()
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000LL + now.tv_nsec / 1000;
+}
+
+// CLOCK_REALTIME in us, for times that outlive the process.
+static inline int64_t nowUS()
+{
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    return now.tv_sec * 1000000LL + now.tv_usec;
+}
+
 static inline unsigned int alarmWithLog(unsigned int seconds)
 {
     logVerboseL(3, "Alarm %d", seconds);
@@ -103,22 +246,59 @@ static inline void printVersionAndExit(const char *name)
     exit(0);
 }
 
-int netdial(int domain, int proto, char *local, int local_port,
+// protocol is passed to socket(), IPPROTO_MPTCP falls back to TCP if the
+// kernel doesn't support it.
+int netdial(int domain, int proto, int protocol, char *local, int local_port,
+    char *server, int port);
+// a TCP connection whose first write goes in the SYN with TCP Fast Open once
+// the kernel has a cookie of the server, so the caller writes before it
+// reads. without a cookie the SYN asks for one and the write waits for the
+// handshake as usual.
+int netdialFastOpen(int domain, int protocol, char *local, int local_port,
     char *server, int port);
-int open_listenfd(const char *local, int port);
+// whether the SYN of the connection carried data the peer took.
+int fastOpened(int connfd);
+// the retransmissions and the smoothed RTT(us) of a connection, returns -1
+// if the stack doesn't report them.
+int getTCPCounters(int connfd, long *retrans, long *rtt);
+int open_listenfd(const char *local, int port, int protocol);
+int acceptAny(const int *listenfds, int n, struct sockaddr_in *addr,
+    socklen_t *len);
+// acceptAny() that gives up after MESSAGE_TIMEOUT.
+int rAcceptAny(const int *listenfds, int n, struct sockaddr_in *addr,
+    socklen_t *len);
+int splitList(char *list, char **items, int max);
+// qsort() comparator of doubles, ascending.
+int compareDouble(const void *a, const void *b);
+int sendSessionHeader(int connfd, int type, int arg, int arg2);
+int recvSessionHeader(int connfd, int *type, int *arg, int *arg2);
 
 void initSharedMem(int index);
 void setMessage(int index, char *message);
+// like setMessage() for binary data, such as a control message.
+void setBlock(int index, const char *data, int len);
 int getMessage(int index, char *dest);
+char *getSharedMem(int index);
 int rSendMessage(int connfd, const char *name, char *message, int len);
 int rReceiveMessage(int connfd, const char *name, char *buf);
+// rReceiveMessage() that refuses a message longer than max, its length is
+// left in *len.
+int rReceiveBlock(int connfd, const char *name, char *buf, int max, int *len);
+// the instruction and its message in a single write, so that both fit in a
+// Fast Open SYN.
+int rSendRequest(int connfd, char instr, char *message, int len);
 int rSendBytes(int connfd, const char *buf, int n, const char *errorText);
 int rRecvBytes(int connfd, char *buf, int n, const char *errorText);
+// receives the controller's answer to a configure, waiting while the test is
+// queued. the reason of a RET_EMSG is left in message.
+char recvReturn(int connfd, char *message);
 
 char *retstr(char ret, char *buf);
 
 ssize_t rio_readnr(int fd, void *usrbuf, size_t n);
 ssize_t rio_writenr(int fd, const void *usrbuf, size_t n);
+void resetRioStat();
+void logRioStat();
 
 sighandler_t signalNoRestart(int signum, sighandler_t handler);
 
@@ -141,7 +321,7 @@ static inline void failExit(const char *name)
 
 static inline int forceClose(int fd)
 {
-    int ret = close(fd);
+    int ret = backend->close(fd);
     if (ret < 0)
     {
         failExit("close");
@@ -159,9 +339,10 @@ static inline sighandler_t forceSignal(int signum, sighandler_t handler)
     return ret;
 }
 
-static inline int forceOpenListenFD(const char *local, int port)
+static inline int forceOpenListenFD(const char *local, int port,
+    int protocol)
 {
-    int ret = open_listenfd(local, port);
+    int ret = open_listenfd(local, port, protocol);
     if (ret < 0)
     {
         failExit("open_listenfd");
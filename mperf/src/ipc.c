@@ -0,0 +1,402 @@
+#include <sched.h>
+
+#include "sndrcv.h"
+#include "util.h"
+
+const char *usage =
+    "  -h:\n"
+    "    Print this message and exit.\n"
+    "  -l [path]:\n"
+    "    Specify the file to save the log.\n"
+    "  -t [time]:\n"
+    "    Run each transport for [time] seconds(default: 3).\n"
+    "  -T [transports]:\n"
+    "    Comma-separated list of transports to run\n"
+    "    (default: tcp,pipe,unix,shm).\n"
+    "      tcp:  loopback TCP connection.\n"
+    "      pipe: pipe(2).\n"
+    "      unix: AF_UNIX stream socket pair.\n"
+    "      shm:  lock-free single-producer single-consumer ring in shared\n"
+    "            memory.\n"
+    "  -v:\n"
+    "    Print version information and exit.\n"
+    "  -V[level]:\n"
+    "    Print verbose log. Use -V2 for even more verbose log.";
+
+// extra seconds the receiver waits for EOF after the sender stops.
+#define RECV_SLACK 5
+
+// the ring is a power of 2 so positions can be masked, head and tail only
+// grow and sit on separate cache lines to avoid false sharing.
+#define RING_LEN (1 << 22)
+#define RING_MASK (RING_LEN - 1)
+#define CACHE_LINE 64
+
+typedef struct
+{
+    volatile long head __attribute__((aligned(CACHE_LINE)));
+    volatile long tail __attribute__((aligned(CACHE_LINE)));
+    volatile int closed __attribute__((aligned(CACHE_LINE)));
+    char data[RING_LEN] __attribute__((aligned(CACHE_LINE)));
+} ring_t;
+
+typedef struct
+{
+    const char *name;
+    // creates the connected pair, fds[0] for reading, fds[1] for writing.
+    int (*open)(int fds[2]);
+    result_t send;
+    result_t recv;
+    int done;
+} transport_t;
+
+static int timelen = 3;
+static char *path = NULL;
+// strtok() modifies the list, so the default can't be a string literal.
+static char defaultNames[] = "tcp,pipe,unix,shm";
+static char *names = defaultNames;
+static char packetBuf[PACKET_LEN];
+static ring_t *ring;
+static result_t *shared;
+
+static ssize_t ringWrite(int fd, const void *buf, size_t n)
+{
+    long head = ring->head;
+    long space;
+
+    // wait until the receiver makes room, a signal ends the test. we yield
+    // rather than spin so that both sides can share one core.
+    while ((space = RING_LEN - (head - __atomic_load_n(&ring->tail,
+        __ATOMIC_ACQUIRE))) == 0)
+    {
+        if (!continueTest())
+        {
+            errno = EINTR;
+            return -1;
+        }
+        sched_yield();
+    }
+    if ((size_t)space < n)
+    {
+        n = space;
+    }
+    if ((head & RING_MASK) + n > RING_LEN)
+    {
+        size_t first = RING_LEN - (head & RING_MASK);
+        memcpy(ring->data + (head & RING_MASK), buf, first);
+        memcpy(ring->data, (const char*)buf + first, n - first);
+    }
+    else
+    {
+        memcpy(ring->data + (head & RING_MASK), buf, n);
+    }
+    __atomic_store_n(&ring->head, head + n, __ATOMIC_RELEASE);
+    return n;
+}
+
+static ssize_t ringRead(int fd, void *buf, size_t n)
+{
+    long tail = ring->tail;
+    long avail;
+
+    while ((avail = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) - tail)
+        == 0)
+    {
+        if (__atomic_load_n(&ring->closed, __ATOMIC_ACQUIRE))
+        {
+            // the writer may have published data right before closing.
+            if (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == tail)
+            {
+                return 0;
+            }
+            continue;
+        }
+        if (!continueTest())
+        {
+            errno = EINTR;
+            return -1;
+        }
+        sched_yield();
+    }
+    if ((size_t)avail < n)
+    {
+        n = avail;
+    }
+    if ((tail & RING_MASK) + n > RING_LEN)
+    {
+        size_t first = RING_LEN - (tail & RING_MASK);
+        memcpy(buf, ring->data + (tail & RING_MASK), first);
+        memcpy((char*)buf + first, ring->data, n - first);
+    }
+    else
+    {
+        memcpy(buf, ring->data + (tail & RING_MASK), n);
+    }
+    __atomic_store_n(&ring->tail, tail + n, __ATOMIC_RELEASE);
+    return n;
+}
+
+static int ringClose(int fd)
+{
+    __atomic_store_n(&ring->closed, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+static backend_t ringBackend;
+
+static int openTCP(int fds[2])
+{
+    int listenfd;
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+
+    if ((listenfd = open_listenfd("127.0.0.1", 0, 0)) < 0)
+    {
+        return -1;
+    }
+    if (getsockname(listenfd, (struct sockaddr*)&addr, &len) < 0 ||
+        (fds[1] = netdial(AF_INET, SOCK_STREAM, 0, NULL, 0, "127.0.0.1",
+            ntohs(addr.sin_port))) < 0)
+    {
+        backend->close(listenfd);
+        return -1;
+    }
+    fds[0] = backend->accept(listenfd, NULL, NULL);
+    backend->close(listenfd);
+    return fds[0] < 0 ? -1 : 0;
+}
+
+static int openPipe(int fds[2])
+{
+    if (pipe(fds) < 0)
+    {
+        return -1;
+    }
+    // the default 64KiB pipe is smaller than a single PACKET_LEN write,
+    // grow it as far as fs.pipe-max-size allows.
+#ifdef F_SETPIPE_SZ
+    if (fcntl(fds[1], F_SETPIPE_SZ, 1 << 20) < 0)
+    {
+        logVerbose("Can't grow pipe buffer, using the default size.");
+    }
+#endif
+    return 0;
+}
+
+static int openUnix(int fds[2])
+{
+    return socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+}
+
+static int openRing(int fds[2])
+{
+    ring->head = ring->tail = 0;
+    ring->closed = 0;
+    // the ring backend ignores file descriptors.
+    fds[0] = fds[1] = -1;
+    backend = &ringBackend;
+    return 0;
+}
+
+static transport_t transports[] = {
+    { "tcp", openTCP },
+    { "pipe", openPipe },
+    { "unix", openUnix },
+    { "shm", openRing },
+};
+static const int transportCount = sizeof(transports) / sizeof(transport_t);
+
+static void sigalrmHandler(int sig)
+{
+    int be = errno;
+    logVerbose("--SIGALRM received.");
+    release(&sigalrm);
+    errno = be;
+}
+
+static void sigintHandler(int sig)
+{
+    int be = errno;
+    logVerbose("--SIGINT received.");
+    release(&sigint);
+    errno = be;
+}
+
+static void parseArguments(int argc, char **argv)
+{
+    char c;
+    optind = 0;
+    while ((c = getopt(argc, argv, "hl:t:T:vV::")) != EOF)
+    {
+        switch (c)
+        {
+        case 'h':
+            printUsageAndExit(argv);
+            break;
+        case 'l':
+            path = optarg;
+            break;
+        case 't':
+            timelen = atoi(optarg);
+            break;
+        case 'T':
+            names = optarg;
+            break;
+        case 'v':
+            printVersionAndExit("mperf-ipc");
+            break;
+        case 'V':
+            if (optarg)
+            {
+                setVerbose(atoi(optarg));
+            }
+            else
+            {
+                setVerbose(1);
+            }
+            break;
+        default:
+            logWarning("Unexpected command-line option %c!", (char)optopt);
+            printUsageAndExit(argv);
+        }
+    }
+
+    if (timelen <= 0)
+    {
+        logFatal("Invalid test time %d.", timelen);
+    }
+    if (path != NULL)
+    {
+        redirectLogTo(path);
+    }
+}
+
+static void runTransport(transport_t *t)
+{
+    int fds[2];
+    pid_t pid;
+    char errbuf[256];
+    const backend_t *saved = backend;
+
+    logMessage("Testing transport %s...", t->name);
+    if (t->open(fds) < 0)
+    {
+        logError("Can't open transport %s(%s)!", t->name,
+            strerrorV(errno, errbuf));
+        return;
+    }
+
+    setLock(&sigint);
+    setLock(&sigalrm);
+    if ((pid = fork()) < 0)
+    {
+        failExit("fork");
+    }
+    else if (pid == 0)
+    {
+        if (fds[1] >= 0)
+        {
+            backend->close(fds[1]);
+        }
+        doReceive(fds[0], timelen + RECV_SLACK, packetBuf);
+        *shared = lastResult;
+        exit(0);
+    }
+
+    if (fds[0] >= 0)
+    {
+        backend->close(fds[0]);
+    }
+    doLongTest(fds[1], timelen, packetBuf);
+    t->send = lastResult;
+    // EOF tells the receiver to stop.
+    backend->close(fds[1]);
+    backend = saved;
+    if (waitpid(pid, NULL, 0) < 0)
+    {
+        logError("Failed to wait for receiver(%s)!", strerrorV(errno, errbuf));
+        return;
+    }
+    t->recv = *shared;
+    t->done = 1;
+}
+
+static inline double nsPerByte(const result_t *r)
+{
+    return r->bytes > 0 ?
+        (r->cost.utime + r->cost.stime) * 1e9 / r->bytes : 0;
+}
+
+static void printSummary()
+{
+    int i;
+
+    logMessage("IPC baseline summary(%ds per transport):", timelen);
+    logMessage("->%-9s%20s%16s%16s", "Transport", "Bandwidth(B/s)",
+        "Send(ns/Byte)", "Recv(ns/Byte)");
+    for (i = 0; i < transportCount; ++i)
+    {
+        transport_t *t = transports + i;
+        if (!t->done)
+        {
+            continue;
+        }
+        logMessage("->%-9s%20.0lf%16.4lf%16.4lf", t->name,
+            t->recv.elapsed > 0 ? t->recv.bytes / t->recv.elapsed : 0,
+            nsPerByte(&t->send), nsPerByte(&t->recv));
+    }
+}
+
+int main(int argc, char **argv)
+{
+    char *name;
+    int i;
+
+    initLog();
+    parseArguments(argc, argv);
+    printInitLog();
+
+    ringBackend = *backend;
+    ringBackend.name = "shm";
+    ringBackend.read = ringRead;
+    ringBackend.write = ringWrite;
+    ringBackend.close = ringClose;
+
+    ring = mmap(NULL, sizeof(ring_t), PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    shared = mmap(NULL, sizeof(result_t), PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (ring == MAP_FAILED || shared == MAP_FAILED)
+    {
+        failExit("mmap");
+    }
+
+    memset(packetBuf, 0x10, sizeof(packetBuf));
+    signalNoRestart(SIGALRM, sigalrmHandler);
+    signalNoRestart(SIGINT, sigintHandler);
+    signalNoRestart(SIGPIPE, SIG_IGN);
+
+    for (name = strtok(names, ","); name; name = strtok(NULL, ","))
+    {
+        for (i = 0; i < transportCount; ++i)
+        {
+            if (strcmp(name, transports[i].name) == 0)
+            {
+                break;
+            }
+        }
+        if (i == transportCount)
+        {
+            logWarning("Unknown transport %s.", name);
+            continue;
+        }
+        runTransport(transports + i);
+        if (!isLocked(&sigint))
+        {
+            break;
+        }
+    }
+
+    printSummary();
+    return 0;
+}
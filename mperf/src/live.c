@@ -0,0 +1,150 @@
+#include "live.h"
+#include "util.h"
+
+#define MAX_LIVE (int)(SHARED_BLOCK_LEN / sizeof(liveStat_t))
+// reads a reader tries before giving up on a slot left odd.
+#define LIVE_TRIES 1000
+
+liveStat_t *liveStat = NULL;
+static liveStat_t *stats = NULL;
+static int liveSlot = 0;
+
+// the counters outlive the servers, a run starts from where they are.
+static inline int64_t slotBytes(liveStat_t *s)
+{
+    return __atomic_load_n(&s->sent, __ATOMIC_RELAXED) +
+        __atomic_load_n(&s->received, __ATOMIC_RELAXED);
+}
+
+void initLiveStats()
+{
+    initSharedMem(SMEM_STATS);
+    stats = (liveStat_t*)getSharedMem(SMEM_STATS);
+}
+
+void setLiveSlot(int slot)
+{
+    liveSlot = slot < MAX_LIVE ? slot : MAX_LIVE - 1;
+}
+
+// an odd seq stays odd, a server that died while writing leaves it so.
+static inline void beginWrite(liveStat_t *s)
+{
+    __atomic_store_n(&s->seq, s->seq | 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void endWrite(liveStat_t *s)
+{
+    __atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELEASE);
+}
+
+void attachLiveStat(int port, int runs)
+{
+    liveStat_t *s;
+
+    if (stats == NULL)
+    {
+        return;
+    }
+    s = stats + liveSlot;
+    beginWrite(s);
+    __atomic_store_n(&s->state, LIVE_WAITING, __ATOMIC_RELAXED);
+    __atomic_store_n(&s->port, port, __ATOMIC_RELAXED);
+    __atomic_store_n(&s->pid, getpid(), __ATOMIC_RELAXED);
+    __atomic_store_n(&s->run, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&s->runs, runs, __ATOMIC_RELAXED);
+    __atomic_store_n(&s->start, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&s->end, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&s->base, slotBytes(s), __ATOMIC_RELAXED);
+    endWrite(s);
+    liveStat = s;
+}
+
+void setLiveState(int state, int run)
+{
+    liveStat_t *s = liveStat;
+
+    if (s == NULL)
+    {
+        return;
+    }
+    beginWrite(s);
+    __atomic_store_n(&s->state, state, __ATOMIC_RELAXED);
+    __atomic_store_n(&s->run, run, __ATOMIC_RELAXED);
+    if (state == LIVE_RUNNING)
+    {
+        __atomic_store_n(&s->start, nowUS(), __ATOMIC_RELAXED);
+        __atomic_store_n(&s->base, slotBytes(s), __ATOMIC_RELAXED);
+    }
+    else
+    {
+        __atomic_store_n(&s->end, nowUS(), __ATOMIC_RELAXED);
+    }
+    endWrite(s);
+}
+
+int readLiveStat(int slot, liveStat_t *stat)
+{
+    const liveStat_t *s;
+    uint32_t seq;
+    int tries = 0;
+
+    if (stats == NULL || slot < 0 || slot >= MAX_LIVE)
+    {
+        return -1;
+    }
+    s = stats + slot;
+    do
+    {
+        if (tries++ == LIVE_TRIES)
+        {
+            return -1;
+        }
+        seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+        stat->state = __atomic_load_n(&s->state, __ATOMIC_RELAXED);
+        stat->port = __atomic_load_n(&s->port, __ATOMIC_RELAXED);
+        stat->pid = __atomic_load_n(&s->pid, __ATOMIC_RELAXED);
+        stat->run = __atomic_load_n(&s->run, __ATOMIC_RELAXED);
+        stat->runs = __atomic_load_n(&s->runs, __ATOMIC_RELAXED);
+        stat->start = __atomic_load_n(&s->start, __ATOMIC_RELAXED);
+        stat->end = __atomic_load_n(&s->end, __ATOMIC_RELAXED);
+        stat->base = __atomic_load_n(&s->base, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    }
+    while ((seq & 1) || __atomic_load_n(&s->seq, __ATOMIC_RELAXED) != seq);
+    stat->seq = seq;
+    stat->sent = __atomic_load_n(&s->sent, __ATOMIC_RELAXED);
+    stat->received = __atomic_load_n(&s->received, __ATOMIC_RELAXED);
+    return 0;
+}
+
+void liveExited(pid_t pid)
+{
+    liveStat_t *s;
+    int i, state;
+
+    for (i = 0; stats != NULL && i < MAX_LIVE; ++i)
+    {
+        s = stats + i;
+        state = __atomic_load_n(&s->state, __ATOMIC_RELAXED);
+        if (__atomic_load_n(&s->pid, __ATOMIC_RELAXED) != pid ||
+            ((state == LIVE_IDLE || state == LIVE_DONE) &&
+            !(__atomic_load_n(&s->seq, __ATOMIC_RELAXED) & 1)))
+        {
+            continue;
+        }
+        // the server is gone, nobody else writes its slot.
+        beginWrite(s);
+        __atomic_store_n(&s->state, LIVE_DONE, __ATOMIC_RELAXED);
+        __atomic_store_n(&s->end, nowUS(), __ATOMIC_RELAXED);
+        endWrite(s);
+    }
+}
+
+const char *liveStateName(int state)
+{
+    static const char *names[] = { "idle", "waiting", "running", "done" };
+
+    return state >= 0 && state <= LIVE_DONE ? names[state] : "unknown";
+}
@@ -0,0 +1,624 @@
+#include <sys/epoll.h>
+#include <sys/resource.h>
+
+#include "live.h"
+#include "many.h"
+#include "sndrcv.h"
+#include "util.h"
+
+#define MAX_EVENTS 1024
+// connections being established at the same time by the client.
+#define CONNECT_WINDOW 256
+// marks listening sockets in epoll events.
+#define LISTENER 0x80000000u
+
+typedef struct
+{
+    int fd;
+    int connecting;
+    // bytes of the bursts not written yet.
+    long pending;
+    // whether we wait for EPOLLOUT.
+    int writing;
+    long bytes;
+} conn_t;
+
+static conn_t *conns;
+// connections opened so far, and still open.
+static int opened;
+static int live;
+static int epfd;
+static const many_t *test;
+
+// memory in use before the connections were opened and with all of them
+// open. the kernel's slab and TCP buffer memory are of the whole system.
+typedef struct
+{
+    long rss;
+    long slab;
+    long tcp;
+} memory_t;
+
+static memory_t before, after;
+static int measured;
+
+// the server's time from the first to the last accepted connection.
+static struct timespec firstAccept;
+static double acceptTime;
+
+static void readMemory(memory_t *mem)
+{
+    long page = sysconf(_SC_PAGESIZE);
+    char line[256];
+    FILE *fp;
+
+    mem->rss = mem->slab = mem->tcp = 0;
+    if ((fp = fopen("/proc/self/statm", "r")) != NULL)
+    {
+        if (fscanf(fp, "%*d %ld", &mem->rss) == 1)
+        {
+            mem->rss *= page;
+        }
+        fclose(fp);
+    }
+    if ((fp = fopen("/proc/meminfo", "r")) != NULL)
+    {
+        while (fgets(line, sizeof(line), fp))
+        {
+            if (sscanf(line, "Slab: %ld kB", &mem->slab) == 1)
+            {
+                mem->slab <<= 10;
+                break;
+            }
+        }
+        fclose(fp);
+    }
+    if ((fp = fopen("/proc/net/sockstat", "r")) != NULL)
+    {
+        while (fgets(line, sizeof(line), fp))
+        {
+            if (sscanf(line, "TCP: inuse %*d orphan %*d tw %*d alloc %*d "
+                "mem %ld", &mem->tcp) == 1)
+            {
+                mem->tcp *= page;
+                break;
+            }
+        }
+        fclose(fp);
+    }
+}
+
+static void measureMemory()
+{
+    if (!measured)
+    {
+        readMemory(&after);
+        measured = 1;
+    }
+}
+
+// every connection needs a file descriptor.
+static void raiseFDLimit(int need)
+{
+    struct rlimit rl;
+
+    if (getrlimit(RLIMIT_NOFILE, &rl) < 0 || rl.rlim_cur >= (rlim_t)need)
+    {
+        return;
+    }
+    rl.rlim_cur = rl.rlim_max < (rlim_t)need ? rl.rlim_max : (rlim_t)need;
+    if (setrlimit(RLIMIT_NOFILE, &rl) < 0 || rl.rlim_cur < (rlim_t)need)
+    {
+        logWarning("Only %ld file descriptors allowed, raise the hard limit "
+            "(ulimit -Hn) for %d connections.", (long)rl.rlim_cur,
+            test->conns);
+    }
+}
+
+static inline double since(const struct timespec *st)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - st->tv_sec) + (now.tv_nsec - st->tv_nsec) / 1e9;
+}
+
+static inline void setNonBlocking(int fd)
+{
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+static void watch(int i, int op, unsigned int events)
+{
+    struct epoll_event ev;
+
+    ev.events = events;
+    ev.data.u32 = i;
+    if (epoll_ctl(epfd, op, conns[i].fd, &ev) < 0)
+    {
+        failExit("epoll_ctl");
+    }
+}
+
+static void closeConn(int i)
+{
+    // the server sees all the connections open right before the first one
+    // is closed, if not all of them arrived.
+    measureMemory();
+    backend->close(conns[i].fd);
+    conns[i].fd = -1;
+    --live;
+}
+
+static void flush(int i, char *buf)
+{
+    conn_t *c = conns + i;
+    char errbuf[256];
+    ssize_t ret;
+
+    while (c->pending > 0)
+    {
+        ret = backend->write(c->fd, buf,
+            c->pending > PACKET_LEN ? PACKET_LEN : c->pending);
+        if (ret < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                if (!c->writing)
+                {
+                    watch(i, EPOLL_CTL_MOD, EPOLLIN | EPOLLOUT);
+                    c->writing = 1;
+                }
+            }
+            else if (errno != EINTR)
+            {
+                logVerbose("Connection #%d broken(%s).", i,
+                    strerrorV(errno, errbuf));
+                closeConn(i);
+            }
+            return;
+        }
+        c->pending -= ret;
+        c->bytes += ret;
+        liveSent(ret);
+    }
+    if (c->writing)
+    {
+        watch(i, EPOLL_CTL_MOD, EPOLLIN);
+        c->writing = 0;
+    }
+}
+
+// the sender only reads the EOF.
+static void drain(int i, char *buf)
+{
+    conn_t *c = conns + i;
+    char errbuf[256];
+    ssize_t ret;
+
+    while ((ret = backend->read(c->fd, buf, PACKET_LEN)) > 0)
+    {
+        if (!test->send)
+        {
+            c->bytes += ret;
+            liveReceived(ret);
+        }
+    }
+    if (ret == 0)
+    {
+        closeConn(i);
+    }
+    else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+    {
+        logVerbose("Connection #%d broken(%s).", i, strerrorV(errno, errbuf));
+        closeConn(i);
+    }
+}
+
+static void acceptAll(int listenfd)
+{
+    char errbuf[256];
+    int fd;
+
+    while ((fd = backend->accept(listenfd, NULL, NULL)) >= 0)
+    {
+        if (opened == test->conns)
+        {
+            backend->close(fd);
+            continue;
+        }
+        if (opened == 0)
+        {
+            clock_gettime(CLOCK_MONOTONIC, &firstAccept);
+        }
+        acceptTime = since(&firstAccept);
+        setNonBlocking(fd);
+        conns[opened].fd = fd;
+        watch(opened++, EPOLL_CTL_ADD, EPOLLIN);
+        ++live;
+        if (opened == test->conns)
+        {
+            measureMemory();
+        }
+    }
+    if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+    {
+        logError("Unable to accept connection(%s)!", strerrorV(errno, errbuf));
+    }
+}
+
+// runs the traffic until the test ends. connection i sends its kth burst
+// at st + (k * conns + i) * interval / conns, i.e. the global slot
+// k * conns + i.
+static void serve(const struct timespec *st, const int *listenfds,
+    int nlisten, char *buf)
+{
+    struct epoll_event events[MAX_EVENTS];
+    double slot = test->interval / 1000.0 / test->conns;
+    long next = 0;
+    int timeout, n, i;
+    char errbuf[256];
+
+    while (continueTest())
+    {
+        timeout = -1;
+        if (test->send)
+        {
+            double now = since(st);
+
+            for (; next * slot <= now; ++next)
+            {
+                i = next % test->conns;
+                if (i < opened && conns[i].fd >= 0)
+                {
+                    conns[i].pending += test->burst;
+                    flush(i, buf);
+                }
+            }
+            timeout = (int)((next * slot - now) * 1000) + 1;
+        }
+        // the server is done when the client closed all the connections.
+        if (listenfds && opened > 0 && live == 0)
+        {
+            break;
+        }
+
+        if ((n = epoll_wait(epfd, events, MAX_EVENTS, timeout)) < 0)
+        {
+            if (errno != EINTR)
+            {
+                logError("Failed to wait for events(%s)!",
+                    strerrorV(errno, errbuf));
+                break;
+            }
+            continue;
+        }
+        for (i = 0; i < n; ++i)
+        {
+            unsigned int id = events[i].data.u32;
+
+            if (id & LISTENER)
+            {
+                acceptAll(listenfds[id & ~LISTENER]);
+                continue;
+            }
+            if (conns[id].fd >= 0 && (events[i].events & EPOLLOUT))
+            {
+                flush(id, buf);
+            }
+            if (conns[id].fd >= 0 &&
+                (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+            {
+                drain(id, buf);
+            }
+        }
+    }
+}
+
+static void logSummary(double elapsed, const cost_t *cost)
+{
+    long sum = 0, min = 0, max = 0;
+    double squares = 0;
+    int i;
+
+    for (i = 0; i < opened; ++i)
+    {
+        long bytes = conns[i].bytes;
+
+        sum += bytes;
+        squares += (double)bytes * bytes;
+        if (i == 0 || bytes < min)
+        {
+            min = bytes;
+        }
+        if (bytes > max)
+        {
+            max = bytes;
+        }
+    }
+
+    if (opened > 0)
+    {
+        logMessage("->Memory per connection: RSS %ld, kernel slab %ld, TCP "
+            "buffers %ld Bytes", (after.rss - before.rss) / opened,
+            (after.slab - before.slab) / opened,
+            (after.tcp - before.tcp) / opened);
+    }
+    logMessage("->Bytes %s: %ld in %lfs, %lfBytes/sec",
+        test->send ? "sent" : "received", sum, elapsed,
+        elapsed > 0 ? sum / elapsed : 0);
+    logMessage("->Per connection: min %ld, avg %ld, max %ld Bytes",
+        min, opened ? sum / opened : 0, max);
+    // Jain's fairness index, 1 if all the connections got the same, 1/n if
+    // one connection got everything.
+    logMessage("->Fairness(Jain's index): %lf",
+        squares > 0 ? (double)sum * sum / (opened * squares) : 1.0);
+    logCost(cost, sum);
+    lastResult.bytes = sum;
+    lastResult.elapsed = elapsed;
+    lastResult.cost = *cost;
+}
+
+static void setUp(const many_t *m)
+{
+    test = m;
+    opened = live = measured = 0;
+    if ((conns = calloc(m->conns, sizeof(conn_t))) == NULL)
+    {
+        failExit("calloc");
+    }
+    if ((epfd = epoll_create1(0)) < 0)
+    {
+        failExit("epoll_create1");
+    }
+    raiseFDLimit(m->conns + 64);
+    readMemory(&before);
+}
+
+static void tearDown()
+{
+    int i;
+
+    for (i = 0; i < opened; ++i)
+    {
+        if (conns[i].fd >= 0)
+        {
+            backend->close(conns[i].fd);
+        }
+    }
+    close(epfd);
+    free(conns);
+}
+
+static int resolve(char **names, int n, struct sockaddr_in *addrs, int port)
+{
+    struct addrinfo hints, *res;
+    int i;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    for (i = 0; i < n; ++i)
+    {
+        if (getaddrinfo(names[i], NULL, &hints, &res) != 0)
+        {
+            logError("Can't resolve %s!", names[i]);
+            return -1;
+        }
+        memcpy(addrs + i, res->ai_addr, sizeof(struct sockaddr_in));
+        addrs[i].sin_port = htons(port);
+        freeaddrinfo(res);
+    }
+    return 0;
+}
+
+// starts connecting connection i, returns -1 on errors.
+static int startConnect(int i, struct sockaddr_in *local,
+    struct sockaddr_in *server)
+{
+    int fd;
+
+    if ((fd = backend->socket(AF_INET, SOCK_STREAM, 0)) < 0)
+    {
+        return -1;
+    }
+    setNonBlocking(fd);
+    if ((local && backend->bind(fd, (struct sockaddr*)local,
+        sizeof(*local)) < 0) || (backend->connect(fd,
+        (struct sockaddr*)server, sizeof(*server)) < 0 &&
+        errno != EINPROGRESS))
+    {
+        backend->close(fd);
+        return -1;
+    }
+    conns[i].fd = fd;
+    conns[i].connecting = 1;
+    watch(i, EPOLL_CTL_ADD, EPOLLOUT);
+    return 0;
+}
+
+// opens the connections, CONNECT_WINDOW of them at a time. returns the time
+// it took.
+static double connectAll(struct sockaddr_in *locals, int nlocal,
+    struct sockaddr_in *servers, int nserver)
+{
+    struct epoll_event events[MAX_EVENTS];
+    struct timespec st;
+    int started = 0, pending = 0, failed = 0;
+    int n, i, err;
+    socklen_t len;
+    char errbuf[256];
+
+    clock_gettime(CLOCK_MONOTONIC, &st);
+    while (continueTest() && (started < test->conns || pending > 0))
+    {
+        while (started < test->conns && pending < CONNECT_WINDOW)
+        {
+            if (startConnect(started, nlocal ? locals + started % nlocal :
+                NULL, servers + started % nserver) < 0)
+            {
+                if (failed++ == 0)
+                {
+                    logError("Can't connect to server(%s)!",
+                        strerrorV(errno, errbuf));
+                }
+                conns[started].fd = -1;
+            }
+            else
+            {
+                ++pending;
+            }
+            ++started;
+        }
+        if ((n = epoll_wait(epfd, events, MAX_EVENTS, -1)) < 0)
+        {
+            if (errno != EINTR)
+            {
+                failExit("epoll_wait");
+            }
+            continue;
+        }
+        for (i = 0; i < n; ++i)
+        {
+            int id = events[i].data.u32;
+
+            --pending;
+            len = sizeof(err);
+            conns[id].connecting = 0;
+            if (backend->getsockopt(conns[id].fd, SOL_SOCKET, SO_ERROR, &err,
+                &len) < 0 || err != 0)
+            {
+                if (failed++ == 0)
+                {
+                    logError("Can't connect to server(%s)!",
+                        strerrorV(err, errbuf));
+                }
+                epoll_ctl(epfd, EPOLL_CTL_DEL, conns[id].fd, NULL);
+                backend->close(conns[id].fd);
+                conns[id].fd = -1;
+                continue;
+            }
+            // quiet until the traffic starts.
+            watch(id, EPOLL_CTL_MOD, 0);
+            ++live;
+        }
+    }
+    // connections that never completed don't count, the others are moved
+    // to the front.
+    for (i = 0; i < started; ++i)
+    {
+        if (conns[i].connecting)
+        {
+            backend->close(conns[i].fd);
+        }
+        else if (conns[i].fd >= 0)
+        {
+            conns[opened] = conns[i];
+            watch(opened++, EPOLL_CTL_MOD, EPOLLIN);
+        }
+    }
+    if (failed > 0)
+    {
+        logWarning("%d connections failed.", failed);
+    }
+    return since(&st);
+}
+
+void doManyClient(const many_t *m, char **locals, int nlocal, char **servers,
+    int nserver, int port, int connectTime, char *buf)
+{
+    struct sockaddr_in localAddrs[MAX_ADDRS], serverAddrs[MAX_ADDRS];
+    struct timespec st;
+    double elapsed = 0;
+    cost_t cost;
+
+    setUp(m);
+    if (resolve(locals, nlocal, localAddrs, 0) < 0 ||
+        resolve(servers, nserver, serverAddrs, port) < 0)
+    {
+        tearDown();
+        return;
+    }
+
+    logMessage("Opening %d connections...", m->conns);
+    alarmWithLog(connectTime);
+    elapsed = connectAll(localAddrs, nlocal, serverAddrs, nserver);
+    alarmWithLog(0);
+    measureMemory();
+    logMessage("Many-connection test summary:");
+    logMessage("->Connections: %d of %d", live, m->conns);
+    logMessage("->Connect rate: %lf connections/sec(%lfs)",
+        elapsed > 0 ? live / elapsed : 0, elapsed);
+
+    if (continueTest())
+    {
+        logVerbose("Start many-connection traffic.");
+        alarmWithLog(m->timelen);
+        costStart();
+        clock_gettime(CLOCK_MONOTONIC, &st);
+        serve(&st, NULL, 0, buf);
+        elapsed = since(&st);
+        costStop(&cost);
+        alarmWithLog(0);
+    }
+    else
+    {
+        costStart();
+        costStop(&cost);
+    }
+    logSummary(elapsed, &cost);
+    tearDown();
+}
+
+void doManyServer(const many_t *m, const int *listenfds, int nlisten,
+    char *buf)
+{
+    struct epoll_event ev;
+    struct timespec st;
+    double elapsed;
+    cost_t cost;
+    int i;
+
+    setUp(m);
+    for (i = 0; i < nlisten; ++i)
+    {
+        setNonBlocking(listenfds[i]);
+        ev.events = EPOLLIN;
+        ev.data.u32 = LISTENER | i;
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, listenfds[i], &ev) < 0)
+        {
+            failExit("epoll_ctl");
+        }
+    }
+
+    // the clock starts with the first connection.
+    while (opened == 0 && continueTest())
+    {
+        struct epoll_event events[MAX_EVENTS];
+        int n = epoll_wait(epfd, events, MAX_EVENTS, -1);
+
+        for (i = 0; i < n; ++i)
+        {
+            acceptAll(listenfds[events[i].data.u32 & ~LISTENER]);
+        }
+    }
+    costStart();
+    st = firstAccept;
+    serve(&st, listenfds, nlisten, buf);
+    elapsed = since(&st);
+    costStop(&cost);
+
+    logMessage("Many-connection test summary:");
+    logMessage("->Connections: %d of %d", opened, m->conns);
+    logMessage("->Accept rate: %lf connections/sec",
+        acceptTime > 0 ? (opened - 1) / acceptTime : 0);
+    logSummary(elapsed, &cost);
+    tearDown();
+    // the listening sockets may be shared with the controller and the next
+    // servers.
+    for (i = 0; i < nlisten; ++i)
+    {
+        fcntl(listenfds[i], F_SETFL,
+            fcntl(listenfds[i], F_GETFL) & ~O_NONBLOCK);
+    }
+}
@@ -0,0 +1,324 @@
+#include "live.h"
+#include "metrics.h"
+#include "util.h"
+
+#define MAX_REQUEST 2048
+#define MAX_BODY 8192
+
+typedef struct
+{
+    uint64_t tests;
+    uint64_t failed[METRICS_RETS];
+    uint64_t preemptions;
+    // not cumulative, the scrape adds them up.
+    uint64_t buckets[METRICS_BUCKET_COUNT];
+    uint64_t configures;
+    uint64_t configureUS;
+} metrics_t;
+
+// a scrape whose request is still coming.
+typedef struct
+{
+    int fd;
+    int len;
+    int64_t deadline;
+    char request[MAX_REQUEST];
+} scrape_t;
+
+static metrics_t *metrics = NULL;
+static scrape_t scrapes[MAX_SCRAPES];
+static const double bounds[] = METRICS_BUCKETS;
+static const char *retNames[METRICS_RETS] = { "RET_SUCC", "RET_EMSG",
+    "RET_EKILL", "RET_EREAD", "RET_EWRITE", "RET_EPROC", "RET_QUEUED" };
+
+static inline void add(uint64_t *counter, uint64_t n)
+{
+    __atomic_fetch_add(counter, n, __ATOMIC_RELAXED);
+}
+
+static inline uint64_t get(const uint64_t *counter)
+{
+    return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+void initMetrics()
+{
+    int i;
+
+    for (i = 0; i < MAX_SCRAPES; ++i)
+    {
+        scrapes[i].fd = -1;
+    }
+    initSharedMem(SMEM_METRICS);
+    metrics = (metrics_t*)getSharedMem(SMEM_METRICS);
+}
+
+void countConfigure(char ret, double seconds)
+{
+    int i;
+
+    if (metrics == NULL)
+    {
+        return;
+    }
+    if (ret == RET_SUCC)
+    {
+        add(&metrics->tests, 1);
+    }
+    else if (ret > 0 && ret < METRICS_RETS)
+    {
+        add(&metrics->failed[(int)ret], 1);
+    }
+    for (i = 0; i + 1 < METRICS_BUCKET_COUNT && seconds > bounds[i]; ++i);
+    add(&metrics->buckets[i], 1);
+    add(&metrics->configureUS, (uint64_t)(seconds * 1e6 + 0.5));
+    add(&metrics->configures, 1);
+}
+
+void countPreemption()
+{
+    if (metrics != NULL)
+    {
+        add(&metrics->preemptions, 1);
+    }
+}
+
+// the scraper is served with the kernel stack(kernelStack) whatever the
+// tests use.
+int openMetricsFD(const char *local, int port)
+{
+    struct sockaddr_in addr;
+    int fd, on = 1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (local != NULL && inet_pton(AF_INET, local, &addr.sin_addr) != 1)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    if ((fd = kernelStack->socket(AF_INET,
+        SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0)
+    {
+        return -1;
+    }
+    if (kernelStack->setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on,
+        sizeof(on)) < 0 ||
+        kernelStack->bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+        kernelStack->listen(fd, 16) < 0)
+    {
+        kernelStack->close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int writeMetrics(char *body, int slots)
+{
+    char *p = body;
+    liveStat_t stat;
+    uint64_t sent = 0, received = 0, total = 0;
+    int count[LIVE_DONE + 1] = { 0 };
+    int i;
+
+    for (i = 0; i < slots; ++i)
+    {
+        if (readLiveStat(i, &stat) < 0)
+        {
+            continue;
+        }
+        sent += stat.sent;
+        received += stat.received;
+        if (stat.state >= LIVE_IDLE && stat.state <= LIVE_DONE)
+        {
+            ++count[stat.state];
+        }
+    }
+
+    p += sprintf(p, "# HELP mperf_tests_total Tests the controller "
+        "started.\n# TYPE mperf_tests_total counter\n"
+        "mperf_tests_total %llu\n", (unsigned long long)get(&metrics->tests));
+    p += sprintf(p, "# HELP mperf_tests_failed_total Configures that "
+        "started no test, by return value.\n"
+        "# TYPE mperf_tests_failed_total counter\n");
+    for (i = RET_EMSG; i < RET_QUEUED; ++i)
+    {
+        p += sprintf(p, "mperf_tests_failed_total{code=\"%s\"} %llu\n",
+            retNames[i], (unsigned long long)get(&metrics->failed[i]));
+    }
+    p += sprintf(p, "# HELP mperf_preemptions_total Tests ended by the "
+        "next one.\n# TYPE mperf_preemptions_total counter\n"
+        "mperf_preemptions_total %llu\n",
+        (unsigned long long)get(&metrics->preemptions));
+    p += sprintf(p, "# HELP mperf_configure_seconds Time to answer a "
+        "configure, queueing included.\n"
+        "# TYPE mperf_configure_seconds histogram\n");
+    for (i = 0; i < METRICS_BUCKET_COUNT; ++i)
+    {
+        total += get(&metrics->buckets[i]);
+        if (i + 1 < METRICS_BUCKET_COUNT)
+        {
+            p += sprintf(p, "mperf_configure_seconds_bucket{le=\"%g\"} "
+                "%llu\n", bounds[i], (unsigned long long)total);
+        }
+        else
+        {
+            p += sprintf(p, "mperf_configure_seconds_bucket{le=\"+Inf\"} "
+                "%llu\n", (unsigned long long)total);
+        }
+    }
+    p += sprintf(p, "mperf_configure_seconds_sum %.6f\n"
+        "mperf_configure_seconds_count %llu\n",
+        get(&metrics->configureUS) / 1e6,
+        (unsigned long long)get(&metrics->configures));
+    p += sprintf(p, "# HELP mperf_sent_bytes_total Bytes the servers "
+        "sent.\n# TYPE mperf_sent_bytes_total counter\n"
+        "mperf_sent_bytes_total %llu\n"
+        "# HELP mperf_received_bytes_total Bytes the servers received.\n"
+        "# TYPE mperf_received_bytes_total counter\n"
+        "mperf_received_bytes_total %llu\n",
+        (unsigned long long)sent, (unsigned long long)received);
+    p += sprintf(p, "# HELP mperf_tests Test slots by the state of their "
+        "server.\n# TYPE mperf_tests gauge\n");
+    for (i = LIVE_IDLE; i <= LIVE_DONE; ++i)
+    {
+        p += sprintf(p, "mperf_tests{state=\"%s\"} %d\n", liveStateName(i),
+            count[i]);
+    }
+    return p - body;
+}
+
+static void closeScrape(scrape_t *scrape)
+{
+    kernelStack->close(scrape->fd);
+    scrape->fd = -1;
+}
+
+int acceptScrape(int listenfd, int *fd)
+{
+    int i, s;
+
+    if ((s = kernelStack->accept(listenfd, NULL, NULL)) < 0)
+    {
+        return -1;
+    }
+    for (i = 0; i < MAX_SCRAPES && scrapes[i].fd >= 0; ++i);
+    if (i == MAX_SCRAPES ||
+        fcntl(s, F_SETFL, fcntl(s, F_GETFL) | O_NONBLOCK) < 0 ||
+        fcntl(s, F_SETFD, FD_CLOEXEC) < 0)
+    {
+        kernelStack->close(s);
+        return -1;
+    }
+    scrapes[i].fd = *fd = s;
+    scrapes[i].len = 0;
+    scrapes[i].request[0] = 0;
+    scrapes[i].deadline = monotonicUS() + METRICS_TIMEOUT * 1000000LL;
+    return i;
+}
+
+// the answer fits in the send buffer of a new connection, a scraper that
+// doesn't make room gets a truncated one.
+static void answerScrape(scrape_t *scrape, int slots)
+{
+    static char body[MAX_BODY];
+    char header[256];
+    int len;
+
+    if (strncmp(scrape->request, "GET ", 4) != 0)
+    {
+        len = sprintf(body, "Only GET is supported.\n");
+        sprintf(header, "HTTP/1.0 405 Method Not Allowed\r\n");
+    }
+    else if (strncmp(scrape->request + 4, "/metrics ", 9) != 0 &&
+        strncmp(scrape->request + 4, "/ ", 2) != 0)
+    {
+        len = sprintf(body, "Not found, try /metrics.\n");
+        sprintf(header, "HTTP/1.0 404 Not Found\r\n");
+    }
+    else
+    {
+        len = writeMetrics(body, slots);
+        sprintf(header, "HTTP/1.0 200 OK\r\n");
+    }
+    sprintf(header + strlen(header), "Content-Type: text/plain; "
+        "version=0.0.4\r\nContent-Length: %d\r\nConnection: close\r\n\r\n",
+        len);
+    if (kernelStack->sendto(scrape->fd, header, strlen(header),
+        MSG_NOSIGNAL, NULL, 0) == (ssize_t)strlen(header))
+    {
+        kernelStack->sendto(scrape->fd, body, len, MSG_NOSIGNAL, NULL, 0);
+    }
+    closeScrape(scrape);
+}
+
+void readScrape(int i, int slots)
+{
+    scrape_t *scrape = scrapes + i;
+    int n;
+
+    if (scrape->fd < 0)
+    {
+        return;
+    }
+    while ((n = kernelStack->read(scrape->fd, scrape->request + scrape->len,
+        MAX_REQUEST - 1 - scrape->len)) > 0)
+    {
+        scrape->len += n;
+        scrape->request[scrape->len] = 0;
+        if (strstr(scrape->request, "\r\n\r\n") != NULL ||
+            strstr(scrape->request, "\n\n") != NULL)
+        {
+            answerScrape(scrape, slots);
+            return;
+        }
+        if (scrape->len == MAX_REQUEST - 1)
+        {
+            break;
+        }
+    }
+    // the peer is gone, the request is too long or reading failed.
+    if (n >= 0 || (errno != EAGAIN && errno != EINTR))
+    {
+        closeScrape(scrape);
+    }
+}
+
+int expireScrapes()
+{
+    int64_t now = monotonicUS(), next = -1, left;
+    int i;
+
+    for (i = 0; i < MAX_SCRAPES; ++i)
+    {
+        if (scrapes[i].fd < 0)
+        {
+            continue;
+        }
+        if ((left = scrapes[i].deadline - now) <= 0)
+        {
+            logVerbose("--Scrape timed out.");
+            closeScrape(scrapes + i);
+        }
+        else if (next < 0 || left < next)
+        {
+            next = left;
+        }
+    }
+    return next < 0 ? -1 : (int)((next + 999) / 1000);
+}
+
+void closeScrapes()
+{
+    int i;
+
+    for (i = 0; i < MAX_SCRAPES; ++i)
+    {
+        if (scrapes[i].fd >= 0)
+        {
+            closeScrape(scrapes + i);
+        }
+    }
+}
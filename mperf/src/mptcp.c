@@ -0,0 +1,123 @@
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <arpa/inet.h>
+#include <linux/mptcp.h>
+#include <linux/tcp.h>
+
+#include "backend.h"
+#include "log.h"
+#include "mptcp.h"
+
+#ifndef SOL_MPTCP
+#define SOL_MPTCP 284
+#endif
+
+#define MAX_SUBFLOWS 16
+
+static char *addrstr(const struct mptcp_subflow_addrs *addrs, int local,
+    char *buf)
+{
+    char ip[INET6_ADDRSTRLEN];
+    const struct sockaddr_storage *ss = (const struct sockaddr_storage*)
+        (local ? &addrs->ss_local : &addrs->ss_remote);
+
+    if (ss->ss_family == AF_INET)
+    {
+        const struct sockaddr_in *sin = (const struct sockaddr_in*)ss;
+        inet_ntop(AF_INET, &sin->sin_addr, ip, sizeof(ip));
+        sprintf(buf, "%s:%d", ip, ntohs(sin->sin_port));
+    }
+    else if (ss->ss_family == AF_INET6)
+    {
+        const struct sockaddr_in6 *sin6 = (const struct sockaddr_in6*)ss;
+        inet_ntop(AF_INET6, &sin6->sin6_addr, ip, sizeof(ip));
+        sprintf(buf, "[%s]:%d", ip, ntohs(sin6->sin6_port));
+    }
+    else
+    {
+        sprintf(buf, "?");
+    }
+    return buf;
+}
+
+void logMPTCPInfo(int fd, double elapsed)
+{
+    struct mptcp_info info;
+    struct
+    {
+        struct mptcp_subflow_data d;
+        struct tcp_info info[MAX_SUBFLOWS];
+    } tcp;
+    struct
+    {
+        struct mptcp_subflow_data d;
+        struct mptcp_subflow_addrs addrs[MAX_SUBFLOWS];
+    } addrs;
+    socklen_t len = sizeof(info);
+    int haveAddrs;
+    unsigned int i, n;
+    char errbuf[256], local[64], remote[64];
+
+    memset(&info, 0, sizeof(info));
+    if (backend->getsockopt(fd, SOL_MPTCP, MPTCP_INFO, &info, &len) < 0)
+    {
+        strerror_r(errno, errbuf, sizeof(errbuf));
+        logMessage("MPTCP not in use(%s).", errbuf);
+        return;
+    }
+    logMessage("MPTCP summary:");
+    logMessage("->Subflows: %d%s", (int)info.mptcpi_subflows + 1,
+        info.mptcpi_flags & MPTCP_INFO_FLAG_FALLBACK ?
+        "(fallen back to TCP)" : "");
+
+    memset(&tcp, 0, sizeof(tcp));
+    tcp.d.size_subflow_data = sizeof(tcp.d);
+    tcp.d.size_user = sizeof(struct tcp_info);
+    len = sizeof(tcp);
+    if (backend->getsockopt(fd, SOL_MPTCP, MPTCP_TCPINFO, &tcp, &len) < 0)
+    {
+        strerror_r(errno, errbuf, sizeof(errbuf));
+        logWarning("Can't get subflow info(%s).", errbuf);
+        return;
+    }
+
+    memset(&addrs, 0, sizeof(addrs));
+    addrs.d.size_subflow_data = sizeof(addrs.d);
+    addrs.d.size_user = sizeof(struct mptcp_subflow_addrs);
+    len = sizeof(addrs);
+    haveAddrs = backend->getsockopt(
+        fd, SOL_MPTCP, MPTCP_SUBFLOW_ADDRS, &addrs, &len) == 0;
+
+    n = tcp.d.num_subflows < MAX_SUBFLOWS ? tcp.d.num_subflows : MAX_SUBFLOWS;
+    for (i = 0; i < n; ++i)
+    {
+        const struct tcp_info *ti = tcp.info + i;
+        // a test is one-way, the other counter stays near 0.
+        double bytes = (double)ti->tcpi_bytes_acked + ti->tcpi_bytes_received;
+
+        if (haveAddrs && i < addrs.d.num_subflows)
+        {
+            addrstr(addrs.addrs + i, 1, local);
+            addrstr(addrs.addrs + i, 0, remote);
+        }
+        else
+        {
+            strcpy(local, "?");
+            strcpy(remote, "?");
+        }
+        logMessage("->Subflow #%u %s -> %s: acked %llu, received %llu, "
+            "bandwidth %lfBytes/sec", i, local, remote,
+            (unsigned long long)ti->tcpi_bytes_acked,
+            (unsigned long long)ti->tcpi_bytes_received,
+            elapsed > 0 ? bytes / elapsed : 0);
+    }
+    if (tcp.d.num_subflows > MAX_SUBFLOWS)
+    {
+        logMessage("->%u more subflows not shown.",
+            tcp.d.num_subflows - MAX_SUBFLOWS);
+    }
+}
@@ -0,0 +1,264 @@
+#include "plan.h"
+#include "util.h"
+
+int encodePlan(const plan_t *plan, char *buf)
+{
+    const planTest_t *t;
+    char *p = buf;
+    int i;
+
+    p = put32(p, PLAN_MAGIC);
+    p = put32(p, PLAN_VERSION);
+    p = put32(p, plan->flags);
+    p = put32(p, plan->streams);
+    p = put32(p, plan->mode);
+    p = put32(p, plan->probeLen);
+    p = put32(p, plan->conns);
+    p = put32(p, plan->interval);
+    p = put32(p, plan->priority);
+    p = put32(p, plan->count);
+    for (i = 0; i < plan->count; ++i)
+    {
+        t = plan->tests + i;
+        p = put32(p, t->type);
+        p = put32(p, t->repeat);
+        p = put32(p, t->time);
+        p = put32(p, t->timeout);
+        p = put32(p, t->size);
+        p = put32(p, t->loop);
+        p = put32(p, t->sendInterval);
+        p = put32(p, t->probeInterval);
+    }
+    return p - buf;
+}
+
+int decodePlan(plan_t *plan, const char *buf, int len)
+{
+    planTest_t *t;
+    const char *p = buf;
+    int magic, version, i;
+
+    if (len < PLAN_HEADER)
+    {
+        return -1;
+    }
+    p = get32(p, &magic);
+    p = get32(p, &version);
+    if (magic != PLAN_MAGIC || version != PLAN_VERSION)
+    {
+        return -1;
+    }
+    p = get32(p, &plan->flags);
+    p = get32(p, &plan->streams);
+    p = get32(p, &plan->mode);
+    p = get32(p, &plan->probeLen);
+    p = get32(p, &plan->conns);
+    p = get32(p, &plan->interval);
+    p = get32(p, &plan->priority);
+    p = get32(p, &plan->count);
+    if (plan->count <= 0 || plan->count > MAX_PLAN ||
+        PLAN_HEADER + plan->count * PLAN_TEST > len)
+    {
+        return -1;
+    }
+    for (i = 0; i < plan->count; ++i)
+    {
+        t = plan->tests + i;
+        p = get32(p, &t->type);
+        p = get32(p, &t->repeat);
+        p = get32(p, &t->time);
+        p = get32(p, &t->timeout);
+        p = get32(p, &t->size);
+        p = get32(p, &t->loop);
+        p = get32(p, &t->sendInterval);
+        p = get32(p, &t->probeInterval);
+    }
+    return p - buf;
+}
+
+// "10s", "1KB", "2MiB"... the unit of a size is 1024-based.
+static int parseValue(const char *s, int isTime, int *value)
+{
+    static const char *units = "KMG";
+    const char *u;
+    char *end;
+    long v = strtol(s, &end, 10);
+
+    if (end == s || v <= 0)
+    {
+        return -1;
+    }
+    if (isTime)
+    {
+        *value = v;
+        return *end == 0 || strcmp(end, "s") == 0 ? 0 : -1;
+    }
+    if (*end != 0 && (u = strchr(units, toupper(*end))) != NULL)
+    {
+        v <<= 10 * (u - units + 1);
+        ++end;
+        if (*end == 'i')
+        {
+            ++end;
+        }
+    }
+    if (*end != 0 && strcmp(end, "B") != 0)
+    {
+        return -1;
+    }
+    if (v > 0x7FFFFFFF)
+    {
+        return -1;
+    }
+    *value = v;
+    return 0;
+}
+
+static int parseTest(planTest_t *t, char *item)
+{
+    char *save;
+    char *word = strtok_r(item, " \t", &save);
+
+    t->repeat = 1;
+    t->type = 0;
+    if (word != NULL && strcmp(word, "reverse") == 0)
+    {
+        t->type = FLAG_REVERSE;
+        word = strtok_r(NULL, " \t", &save);
+    }
+    if (word == NULL)
+    {
+        return -1;
+    }
+    if (strcmp(word, "long") == 0)
+    {
+        t->type |= TYPE_LONG;
+    }
+    else if (strcmp(word, "fix") == 0)
+    {
+        t->type |= TYPE_FIX;
+    }
+    else
+    {
+        return -1;
+    }
+    if ((word = strtok_r(NULL, " \t", &save)) == NULL ||
+        parseValue(word, !(t->type & TYPE_FIX),
+        t->type & TYPE_FIX ? &t->size : &t->time) < 0)
+    {
+        return -1;
+    }
+    if ((word = strtok_r(NULL, " \t", &save)) != NULL &&
+        (word[0] != 'x' || (t->repeat = atoi(word + 1)) <= 0))
+    {
+        return -1;
+    }
+    return strtok_r(NULL, " \t", &save) == NULL ? 0 : -1;
+}
+
+char *parsePlan(plan_t *plan, char *text)
+{
+    static char bad[256];
+    char *save;
+    char *item;
+    planTest_t t;
+
+    plan->count = 0;
+    for (item = strtok_r(text, ";", &save); item != NULL;
+         item = strtok_r(NULL, ";", &save))
+    {
+        // only the blanks around the items.
+        while (isspace(*item))
+        {
+            ++item;
+        }
+        if (*item == 0)
+        {
+            continue;
+        }
+        snprintf(bad, sizeof(bad), "%s", item);
+        memset(&t, 0, sizeof(t));
+        if (parseTest(&t, item) < 0)
+        {
+            return bad;
+        }
+        if (plan->count == MAX_PLAN)
+        {
+            sprintf(bad, "more than %d tests", MAX_PLAN);
+            return bad;
+        }
+        plan->tests[plan->count++] = t;
+    }
+    if (plan->count == 0)
+    {
+        sprintf(bad, "no test");
+        return bad;
+    }
+    return NULL;
+}
+
+char *formatTest(const planTest_t *test, char *buf)
+{
+    char *p = buf;
+
+    if (test->type & FLAG_REVERSE)
+    {
+        p += sprintf(p, "reverse ");
+    }
+    if (test->type & TYPE_FIX)
+    {
+        p += sprintf(p, "fix %dB", test->size);
+    }
+    else
+    {
+        p += sprintf(p, "long %ds", test->time);
+    }
+    if (test->repeat > 1)
+    {
+        sprintf(p, " x%d", test->repeat);
+    }
+    return buf;
+}
+
+// the plan comes from the network before it's checked, any count and
+// values have to fit.
+char *formatPlan(const plan_t *plan, char *buf)
+{
+    char test[64];
+    int len, i;
+
+    len = snprintf(buf, PLAN_TEXT, "flags %d, streams %d, mode %d, "
+        "probe packet %d, connections %d, interval %d, priority %d:",
+        plan->flags, plan->streams, plan->mode, plan->probeLen, plan->conns,
+        plan->interval, plan->priority);
+    for (i = 0; i < plan->count && i < MAX_PLAN && len < PLAN_TEXT; ++i)
+    {
+        const planTest_t *t = plan->tests + i;
+
+        len += snprintf(buf + len, PLAN_TEXT - len, " %s(timeout %d",
+            formatTest(t, test), t->timeout);
+        if (t->loop > 0 && len < PLAN_TEXT)
+        {
+            len += snprintf(buf + len, PLAN_TEXT - len,
+                ", loop %d, intervals %d/%d", t->loop, t->sendInterval,
+                t->probeInterval);
+        }
+        if (len < PLAN_TEXT)
+        {
+            len += snprintf(buf + len, PLAN_TEXT - len, ")%s",
+                i + 1 < plan->count ? ";" : "");
+        }
+    }
+    return buf;
+}
+
+int planRuns(const plan_t *plan)
+{
+    int i, runs = 0;
+
+    for (i = 0; i < plan->count; ++i)
+    {
+        runs += plan->tests[i].repeat;
+    }
+    return runs;
+}
@@ -0,0 +1,478 @@
+#include "control.h"
+#include "flows.h"
+#include "sndrcv.h"
+#include "util.h"
+
+const char *usage =
+    "  -B [local ip]:\n"
+    "    Specify the local ip address.\n"
+    "  -c [server ip]:\n"
+    "    Specify the server ip address.\n"
+    "    *: Required\n"
+    "  -F [count]:\n"
+    "    Replay only the first [count] flows of the capture(default and\n"
+    "    max: 4096).\n"
+    "  -h:\n"
+    "    Print this message and exit.\n"
+    "  -H:\n"
+    "    Configure the test over a TCP connection to the controller instead\n"
+    "    of a single UDP request.\n"
+    "  -K [secret]:\n"
+    "    Shared secret of the controller's UDP requests(default: $MPERF_KEY,\n"
+    "    or none).\n"
+    "  -l [path]:\n"
+    "    Specify the file to save the log.\n"
+    "  -p [port]:\n"
+    "    Specify port number of server.\n"
+    "    *: Required\n"
+    "  -P [cport]:\n"
+    "    Specify port number of controller(default: [port] + 1).\n"
+    "  -r [path]:\n"
+    "    Specify the pcap file to replay. Every TCP flow of the capture is\n"
+    "    replayed as a connection to the server, started at the same time\n"
+    "    after the start of the replay as in the capture. The client sends\n"
+    "    the bytes the initiator of the flow sent, then the server sends the\n"
+    "    bytes of the responder.\n"
+    "    *: Required\n"
+    "  -T [time]:\n"
+    "    Give up a flow after [time] seconds(default: 60).\n"
+    "  -v:\n"
+    "    Print version information and exit.\n"
+    "  -V[level]:\n"
+    "    Print verbose log. Use -V2 for even more verbose log.\n"
+    "  -x [speed]:\n"
+    "    Replay [speed] times as fast as the capture(default: 1).";
+
+// what happened to a flow of the replay, in seconds after its start.
+typedef struct
+{
+    double start;
+    double done;
+    long up;
+    long down;
+} replayResult_t;
+
+static char *localIP = NULL;
+static char *serverIP = NULL;
+static unsigned short port = 0;
+static unsigned short cport = 0;
+static char *path = NULL;
+static char *tracePath = NULL;
+static int maxFlows = MAX_FLOWS;
+static int timelen = 60;
+static double speed = 1;
+static int tcpControl = 0;
+static char *secret = NULL;
+static char packetBuf[PACKET_LEN];
+
+static flow_t *flows;
+static int flowCount;
+static pid_t flowPID[MAX_FLOWS];
+static volatile int started = 0;
+
+static void parseArguments(int argc, char **argv)
+{
+    char c;
+    optind = 0;
+    while ((c = getopt(argc, argv, "B:c:F:hHK:l:p:P:r:T:vV::x:")) != EOF)
+    {
+        switch (c)
+        {
+        case 'B':
+            localIP = optarg;
+            break;
+        case 'c':
+            serverIP = optarg;
+            break;
+        case 'F':
+            maxFlows = atoi(optarg);
+            break;
+        case 'h':
+            printUsageAndExit(argv);
+            break;
+        case 'H':
+            tcpControl = 1;
+            break;
+        case 'K':
+            secret = optarg;
+            break;
+        case 'l':
+            path = optarg;
+            break;
+        case 'p':
+            port = atoi(optarg);
+            break;
+        case 'P':
+            cport = atoi(optarg);
+            break;
+        case 'r':
+            tracePath = optarg;
+            break;
+        case 'T':
+            timelen = atoi(optarg);
+            break;
+        case 'v':
+            printVersionAndExit("mperf-replay");
+            break;
+        case 'V':
+            if (optarg)
+            {
+                setVerbose(atoi(optarg));
+            }
+            else
+            {
+                setVerbose(1);
+            }
+            break;
+        case 'x':
+            speed = atof(optarg);
+            break;
+        default:
+            logWarning("Unexpected command-line option %c!", (char)optopt);
+            printUsageAndExit(argv);
+        }
+    }
+
+    if (serverIP == NULL)
+    {
+        logFatal("No server IP specified.");
+    }
+    if (port == 0)
+    {
+        logFatal("No legal port number specified.");
+    }
+    if (tracePath == NULL)
+    {
+        logFatal("No capture specified.");
+    }
+    if (cport == 0)
+    {
+        cport = port + 1;
+    }
+    if (maxFlows <= 0 || maxFlows > MAX_FLOWS)
+    {
+        logFatal("Invalid number of flows %d(max %d).", maxFlows, MAX_FLOWS);
+    }
+    if (speed <= 0 || timelen <= 0)
+    {
+        logFatal("Invalid speed %lf or timeout %d.", speed, timelen);
+    }
+    if (path != NULL)
+    {
+        redirectLogTo(path);
+    }
+}
+
+// drops the flows that carried no data, and the ones after the first
+// maxFlows.
+static void loadFlows()
+{
+    char errbuf[256];
+    int n, i;
+
+    if ((n = readFlows(tracePath, &flows, errbuf)) < 0)
+    {
+        logFatal("Can't read %s(%s)!", tracePath, errbuf);
+    }
+    for (i = 0; i < n && flowCount < maxFlows; ++i)
+    {
+        flow_t *f = flows + i;
+
+        if (f->bytes[0] == 0 && f->bytes[1] == 0)
+        {
+            continue;
+        }
+        // a test sends at most INT_MAX bytes.
+        if (f->bytes[0] > 0x7FFFFFFF || f->bytes[1] > 0x7FFFFFFF)
+        {
+            logWarning("Flow #%d truncated to 2GiB.", flowCount);
+            f->bytes[0] = f->bytes[0] > 0x7FFFFFFF ? 0x7FFFFFFF : f->bytes[0];
+            f->bytes[1] = f->bytes[1] > 0x7FFFFFFF ? 0x7FFFFFFF : f->bytes[1];
+        }
+        flows[flowCount++] = *f;
+    }
+    logMessage("Read %d TCP flows from %s, replaying %d of them.", n,
+        tracePath, flowCount);
+    if (flowCount == 0)
+    {
+        logFatal("Nothing to replay.");
+    }
+}
+
+// sets the data port to the one of the test.
+static void reconfigureServer()
+{
+    plan_t plan;
+
+    // a single fix test whose size is the number of flows.
+    memset(&plan, 0, sizeof(plan));
+    plan.flags = FLAG_REPLAY | FLAG_PORT;
+    plan.streams = 1;
+    plan.mode = MODE_BULK;
+    plan.probeLen = 1;
+    plan.count = 1;
+    plan.tests[0].type = TYPE_FIX;
+    plan.tests[0].repeat = 1;
+    plan.tests[0].timeout = timelen;
+    plan.tests[0].size = flowCount;
+    port = configureTest(&plan, localIP, 0, serverIP, cport, tcpControl, 0);
+}
+
+static inline double since(const struct timeval *st)
+{
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    return (now.tv_sec - st->tv_sec) + (now.tv_usec - st->tv_usec) / 1e6;
+}
+
+static void replayFlow(const flow_t *f, replayResult_t *r,
+    const struct timeval *st)
+{
+    char errbuf[256];
+    int connfd;
+
+    r->start = since(st);
+    r->done = -1;
+    if ((connfd = netdial(AF_INET, SOCK_STREAM, 0, localIP, 0, serverIP,
+        port)) < 0)
+    {
+        logError("Can't connect to server(%s)!", strerrorV(errno, errbuf));
+        return;
+    }
+    if (sendSessionHeader(connfd, TYPE_FIX, f->bytes[0], f->bytes[1]) < 0)
+    {
+        logError("Can't send flow header(%s)!", strerrorV(errno, errbuf));
+        backend->close(connfd);
+        return;
+    }
+    if (f->bytes[0] > 0)
+    {
+        doFixTest(connfd, timelen, f->bytes[0], packetBuf);
+        r->up = lastResult.bytes;
+    }
+    if (f->bytes[1] > 0 && continueTest())
+    {
+        doReceiveN(connfd, timelen, f->bytes[1], packetBuf);
+        r->down = lastResult.bytes;
+    }
+    if (r->up == f->bytes[0] && r->down == f->bytes[1])
+    {
+        r->done = since(st);
+    }
+    backend->close(connfd);
+}
+
+// the most intervals [start[i], end[i]) open at the same time.
+static int peakConcurrency(double *start, double *end, int n)
+{
+    int peak = 0, open = 0, i = 0, j = 0;
+
+    qsort(start, n, sizeof(double), compareDouble);
+    qsort(end, n, sizeof(double), compareDouble);
+    while (i < n)
+    {
+        // a flow ending when another one starts counts as concurrent.
+        if (start[i] <= end[j])
+        {
+            if (++open > peak)
+            {
+                peak = open;
+            }
+            ++i;
+        }
+        else
+        {
+            --open;
+            ++j;
+        }
+    }
+    return peak;
+}
+
+static void logReplaySummary(const replayResult_t *results)
+{
+    double *ratio, *start, *end;
+    double orig, replay, lag = 0, origTotal = 0, replayTotal = 0;
+    int i, n = 0, failed = 0;
+    char name[128];
+
+    ratio = malloc(sizeof(double) * flowCount);
+    start = malloc(sizeof(double) * flowCount);
+    end = malloc(sizeof(double) * flowCount);
+    if (!ratio || !start || !end)
+    {
+        failExit("malloc");
+    }
+
+    logMessage("Replay summary:");
+    for (i = 0; i < flowCount; ++i)
+    {
+        const flow_t *f = flows + i;
+        const replayResult_t *r = results + i;
+
+        orig = f->end - f->start;
+        replay = r->done - r->start;
+        if (r->done < 0)
+        {
+            ++failed;
+            logMessage("->Flow #%d(%s): %ld of %ld + %ld of %ld Bytes, "
+                "original %lfs, failed", i, flowName(f, name), r->up,
+                f->bytes[0], r->down, f->bytes[1], orig);
+            continue;
+        }
+        logMessage("->Flow #%d(%s): %ld + %ld Bytes, original %lfs, "
+            "replay %lfs", i, flowName(f, name), f->bytes[0], f->bytes[1],
+            orig, replay);
+        if (orig > 0)
+        {
+            ratio[n++] = replay / orig;
+        }
+        // how late the replay started the flow.
+        if (r->start - f->start / speed > lag)
+        {
+            lag = r->start - f->start / speed;
+        }
+        if (f->end > origTotal)
+        {
+            origTotal = f->end;
+        }
+        if (r->done > replayTotal)
+        {
+            replayTotal = r->done;
+        }
+    }
+
+    if (n > 0)
+    {
+        qsort(ratio, n, sizeof(double), compareDouble);
+        logMessage("->Completion time(replay / original): min %lf, "
+            "median %lf, max %lf", ratio[0], ratio[n / 2], ratio[n - 1]);
+    }
+    logMessage("->Total time: original %lfs, replay %lfs(x%lf speed)",
+        origTotal, replayTotal, speed);
+    for (i = 0; i < flowCount; ++i)
+    {
+        start[i] = flows[i].start;
+        end[i] = flows[i].end;
+    }
+    n = peakConcurrency(start, end, flowCount);
+    for (i = 0; i < flowCount; ++i)
+    {
+        start[i] = results[i].start;
+        end[i] = results[i].done < 0 ? results[i].start : results[i].done;
+    }
+    logMessage("->Peak concurrent flows: original %d, replay %d", n,
+        peakConcurrency(start, end, flowCount));
+    logMessage("->Start lag: max %lfs", lag);
+    if (failed > 0)
+    {
+        logWarning("%d flows failed.", failed);
+    }
+    free(ratio);
+    free(start);
+    free(end);
+}
+
+void sigintHandler(int sig)
+{
+    int be = errno;
+    int i;
+
+    logVerbose("--SIGINT received.");
+    release(&sigint);
+    for (i = 0; i < started; ++i)
+    {
+        if (flowPID[i] > 0)
+        {
+            kill(flowPID[i], SIGINT);
+        }
+    }
+    errno = be;
+}
+
+void sigalrmHandler(int sig)
+{
+    int be = errno;
+    logVerbose("--SIGALRM received.");
+    release(&sigalrm);
+    errno = be;
+}
+
+int main(int argc, char **argv)
+{
+    replayResult_t *results;
+    struct timeval st;
+    char errbuf[256];
+    int i;
+
+    if (argc == 1)
+    {
+        printUsageAndExit(argv);
+    }
+
+    initLog();
+    parseArguments(argc, argv);
+    printInitLog();
+    setControlKey(secret);
+
+    loadFlows();
+    fillPacketBuf(packetBuf);
+    results = mmap(NULL, sizeof(replayResult_t) * flowCount,
+        PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (results == MAP_FAILED)
+    {
+        failExit("mmap");
+    }
+    memset(results, 0, sizeof(replayResult_t) * flowCount);
+
+    reconfigureServer();
+
+    signalNoRestart(SIGINT, sigintHandler);
+    signalNoRestart(SIGALRM, sigalrmHandler);
+    signalNoRestart(SIGPIPE, SIG_IGN);
+    setLock(&sigint);
+    setLock(&sigalrm);
+
+    // every flow runs in its own process, started when it started in the
+    // capture.
+    gettimeofday(&st, NULL);
+    for (i = 0; i < flowCount && continueTest(); ++i)
+    {
+        double wait = flows[i].start / speed - since(&st);
+
+        if (wait > 0)
+        {
+            usleep(wait * 1e6);
+        }
+        if ((flowPID[i] = fork()) < 0)
+        {
+            logError("Can't start flow #%d(%s)!", i, strerrorV(errno, errbuf));
+            results[i].done = -1;
+        }
+        else if (flowPID[i] == 0)
+        {
+            started = 0;
+            logVerbose("Flow #%d started in process %d.", i, getpid());
+            replayFlow(flows + i, results + i, &st);
+            exit(0);
+        }
+        started = i + 1;
+    }
+    for (i = 0; i < started; ++i)
+    {
+        if (flowPID[i] > 0)
+        {
+            while (waitpid(flowPID[i], NULL, 0) < 0 && errno == EINTR);
+        }
+    }
+    for (i = started; i < flowCount; ++i)
+    {
+        results[i].done = -1;
+    }
+
+    logReplaySummary(results);
+    munmap(results, sizeof(replayResult_t) * flowCount);
+    free(flows);
+    return 0;
+}
@@ -0,0 +1,194 @@
+#include "scheduler.h"
+#include "util.h"
+
+// a trickle test sends a byte every 50ms per stream.
+#define TRICKLE_RATE 20
+
+typedef struct
+{
+    double end;
+    long demand;
+} end_t;
+
+static int slots;
+static long budget;
+
+void initScheduler(int count, long rate)
+{
+    slots = count;
+    budget = rate;
+}
+
+// Bytes/sec a test of the plan needs, the whole budget if it takes the link.
+static long testDemand(const plan_t *plan, const planTest_t *t)
+{
+    // only light long tests have a known rate, the others take the link.
+    if ((plan->flags & FLAG_MANY) && plan->interval > 0)
+    {
+        return (long)plan->conns * t->size * 1000 / plan->interval;
+    }
+    if (!(t->type & TYPE_FIX) && plan->mode == MODE_TRICKLE)
+    {
+        return (long)plan->streams * TRICKLE_RATE;
+    }
+    if (!(t->type & TYPE_FIX) && plan->mode == MODE_SLOW)
+    {
+        return (long)plan->streams * PACKET_LEN;
+    }
+    return budget;
+}
+
+// long tests run for their time, a replay until its timeout, probe tests
+// send loop trains every probe interval(ms). fix tests are assumed to get
+// the whole budget, without one they may run until their timeout.
+static double testDuration(const plan_t *plan, const planTest_t *t)
+{
+    if (plan->mode == MODE_PROBE)
+    {
+        return t->loop * t->probeInterval / 1000.0;
+    }
+    if (plan->flags & FLAG_REPLAY)
+    {
+        return t->timeout;
+    }
+    if (!(t->type & TYPE_FIX))
+    {
+        return t->time;
+    }
+    if (budget == 0)
+    {
+        return t->timeout > 0 ? t->timeout : 200;
+    }
+    return (double)t->size / budget;
+}
+
+int parseRequest(job_t *job, const plan_t *plan, long seq)
+{
+    const planTest_t *t;
+    long demand;
+    int i;
+
+    // a plan needs what its heaviest test needs, for all of its tests.
+    job->demand = 0;
+    job->duration = 0;
+    for (i = 0; i < plan->count; ++i)
+    {
+        t = plan->tests + i;
+        if ((demand = testDemand(plan, t)) > job->demand)
+        {
+            job->demand = demand;
+        }
+        job->duration += t->repeat * testDuration(plan, t);
+    }
+
+    job->priority = plan->priority;
+    job->seq = seq;
+    job->slot = -1;
+    job->position = job->eta = -1;
+    job->changed = 0;
+    return budget > 0 && job->demand > budget ? -1 : 0;
+}
+
+static int compareJobs(const void *a, const void *b)
+{
+    const job_t *x = *(const job_t**)a, *y = *(const job_t**)b;
+
+    if (x->priority != y->priority)
+    {
+        return y->priority - x->priority;
+    }
+    return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+static inline int fits(const job_t *job, int running, long used)
+{
+    return running < slots && (budget == 0 || used + job->demand <= budget);
+}
+
+void schedule(job_t *jobs, int n, double now)
+{
+    job_t *queue[MAX_JOBS];
+    end_t ends[MAX_JOBS];
+    int taken[MAX_TESTS];
+    int queued = 0, running = 0, nend = 0;
+    long used = 0;
+    double t;
+    int i, j, first;
+
+    memset(taken, 0, sizeof(taken));
+    for (i = 0; i < n; ++i)
+    {
+        if (jobs[i].fd < 0 || jobs[i].seq < 0)
+        {
+            continue;
+        }
+        if (jobs[i].slot >= 0)
+        {
+            taken[jobs[i].slot] = 1;
+            ++running;
+            used += jobs[i].demand;
+            ends[nend].end = jobs[i].since + jobs[i].duration;
+            ends[nend++].demand = jobs[i].demand;
+        }
+        else
+        {
+            queue[queued++] = jobs + i;
+        }
+    }
+    qsort(queue, queued, sizeof(job_t*), compareJobs);
+
+    // start the head of the queue as long as it fits.
+    for (first = 0; first < queued && fits(queue[first], running, used);
+        ++first)
+    {
+        job_t *job = queue[first];
+
+        for (job->slot = 0; taken[job->slot]; ++job->slot);
+        taken[job->slot] = 1;
+        ++running;
+        used += job->demand;
+        job->since = now;
+        job->changed = 1;
+        ends[nend].end = now + job->duration;
+        ends[nend++].demand = job->demand;
+    }
+
+    // the others start when enough of the tests before them have ended.
+    t = now;
+    for (i = first; i < queued; ++i)
+    {
+        job_t *job = queue[i];
+        int eta;
+
+        while (!fits(job, running, used) && nend > 0)
+        {
+            int min = 0;
+
+            for (j = 1; j < nend; ++j)
+            {
+                if (ends[j].end < ends[min].end)
+                {
+                    min = j;
+                }
+            }
+            if (ends[min].end > t)
+            {
+                t = ends[min].end;
+            }
+            --running;
+            used -= ends[min].demand;
+            ends[min] = ends[--nend];
+        }
+        eta = (int)(t - now + 0.5);
+        if (job->position != i - first + 1 || job->eta != eta)
+        {
+            job->position = i - first + 1;
+            job->eta = eta;
+            job->changed = 1;
+        }
+        ++running;
+        used += job->demand;
+        ends[nend].end = t + job->duration;
+        ends[nend++].demand = job->demand;
+    }
+}
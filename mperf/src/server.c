@@ -1,42 +1,131 @@
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+
+#include "control.h"
+#include "live.h"
+#include "metrics.h"
+#include "plan.h"
+#include "scheduler.h"
+#include "trace.h"
 #include "util.h"
 
 const char *usage =
+    "  -b [Mbit/s]:\n"
+    "    Keep the concurrent tests within a host-wide bandwidth budget.\n"
+    "    Trickle, slow and many-connection long tests need their nominal\n"
+    "    rate, every other test needs the whole budget and runs alone.\n"
+    "    Implies -n 1 without -n.\n"
     "  -h:\n"
     "    Print this message and exit.\n"
+    "  -K [secret]:\n"
+    "    Shared secret that authenticates the UDP control requests and\n"
+    "    replies(default: $MPERF_KEY, or none). The controller takes\n"
+    "    configure and terminate requests as UDP datagrams on [port] as\n"
+    "    well as over TCP, with the kernel stack. A datagram is refused\n"
+    "    when the clocks of the hosts are more than 60s apart.\n"
     "  -l [path]:\n"
     "    Specify the file to save the log of controller.\n"
     "  -L [path]:\n"
     "    Specify the file to save the log of server.\n"
+    "  -m [port]:\n"
+    "    Serve the counters of the controller over HTTP on [port] in the\n"
+    "    Prometheus text format(GET /metrics): tests started, configures\n"
+    "    refused by return value, preemptions, configure latency, Bytes\n"
+    "    sent and received by the servers and the state of the tests.\n"
+    "    Listens on the first -s address. Needs the kernel stack.\n"
+    "  -M:\n"
+    "    Let the server accept MPTCP data connections(falls back to TCP if\n"
+    "    the kernel doesn't support it) and report the subflows.\n"
     "  -k\n"
     "    Use SIGTERM(rather than SIGINT) to kill server if failed\n"
     "    (ensures that up to one child server process can be running at the\n" 
     "    same time. This improves robustness but can cause some logs from\n"
     "    server processes to be lost).\n"
+    "  -n [count]:\n"
+    "    Run up to [count] tests at once(max: 64) instead of one test that\n"
+    "    the next client pre-empts. Every test has its own server on its\n"
+    "    own data port([Port], [Port] - 1, ...), which the client is told,\n"
+    "    and every control connection is served by its own process, so a\n"
+    "    stalled client only delays itself. A client that finds no slot\n"
+    "    free is refused, see -q. Servers are not pooled(-w is ignored)\n"
+    "    and terminate instructions end no test.\n"
     "  -p [port]:\n"
     "    Specify port number of controller.\n"
     "    *: Required\n"
     "  -P [Port]:\n"
     "    Specify port number of server.\n"
     "    (default: [port] - 1)\n"
+    "  -q [seconds]:\n"
+    "    Queue the tests that find no slot(or bandwidth, see -b) free for\n"
+    "    up to [seconds], by priority(mperf-client -Q), then by arrival.\n"
+    "    Waiting clients are told their position and an estimated start\n"
+    "    time. Implies -n 1 without -n.\n"
     "  -s [source IP]:\n"
-    "    Specify the source IP to listen on.\n"
+    "    Specify the source IP to listen on, or a comma-separated list of\n"
+    "    them. Both the controller and the server listen on every address.\n"
     "    (default: unspecified)\n"
     "  -v:\n"
     "    Print version information and exit.\n"
     "  -V[level]:\n"
-    "    Print verbose log. Use -V2 for even more verbose log.";
+    "    Print verbose log. Use -V2 for even more verbose log.\n"
+    "  -w [count]:\n"
+    "    Keep [count] servers forked and initialized in advance, a test\n"
+    "    then only wakes one of them up. The controller holds the listening\n"
+    "    sockets of the servers. Use -w 0 to fork a server that opens its\n"
+    "    own listening sockets for every test.\n"
+    "    (default: 2, max: 16)";
 
 #define SV_RESPONSE 1
 #define MAX_ARGS 256
+#define MAX_POOL 16
+// seconds between two queue updates to a waiting client, well within its
+// MESSAGE_TIMEOUT.
+#define QUEUE_UPDATE (MESSAGE_TIMEOUT / 2)
+
+// what waitFor() waits for.
+#define EV_USR1 0x1
+#define EV_USR2 0x2
+// the running server(chldPID) exited.
+#define EV_EXIT 0x4
+#define EV_TIMEOUT 0x8
+// a control connection is waiting on a listener.
+#define EV_ACCEPT 0x10
+
+// epoll ids, the listeners use their index and the UDP sockets ID_UDP plus
+// their index.
+#define ID_UDP MAX_ADDRS
+#define ID_SIGNAL (2 * MAX_ADDRS)
+#define ID_TIMER (2 * MAX_ADDRS + 1)
+#define ID_PID (2 * MAX_ADDRS + 2)
+#define ID_METRICS (2 * MAX_ADDRS + 3)
+// the scrapes being read use ID_SCRAPE plus their index, and the socket
+// pairs to the processes of the concurrent tests ID_JOB plus theirs.
+#define ID_SCRAPE (2 * MAX_ADDRS + 4)
+#define ID_JOB (ID_SCRAPE + MAX_SCRAPES)
+#define MAX_EVENTS 64
+
+// records from the process of a concurrent test to the controller: the
+// control message of the test, or a reply to send to a UDP client.
+#define JOB_REQUEST 'Q'
+#define JOB_REPLY 'R'
 
-static lock_t sigusr1;
-static lock_t sigusr2;
-static lock_t sigchld;
-static lock_t sigalrm;
+// UDP requests remembered, so that a retransmitted request gets the reply
+// it already got instead of being carried out again: the ones in progress,
+// at most one per job, and 256 done. a request is remembered for as long as
+// it's fresh(CONTROL_WINDOW), after that it's refused for being stale.
+#define MAX_REQUESTS (MAX_JOBS + 256)
+
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
 
 static int port;
 static char *path;
 static char* sourceIP;
+static char *sourceIPs[MAX_ADDRS];
+static int sourceCount = 0;
 
 static int svPort;
 static char *svPath;
@@ -44,11 +133,74 @@ static char *svargv[MAX_ARGS];
 static char **psvargv = svargv;
 
 static int completeKill = 0;
+static int mptcp = 0;
 
 static pid_t chldPID;
 
-static int connfd;
-static int listenfd;
+// idle servers, -1 for the ones that died.
+static pid_t pool[MAX_POOL];
+static int poolCount = 0;
+static int poolSize = 2;
+
+// the concurrent tests, each of them is served by its own process.
+static job_t jobs[MAX_JOBS];
+static long jobCount = 0;
+static int maxTests = 0;
+static int metricsPort = 0;
+static int metricsfd = -1;
+// when the request being served came, for its trace.
+static int64_t acceptedAt;
+// seconds a test may wait for a slot, and the bandwidth budget in Mbit/s.
+static int queueWait = 0;
+static int budget = 0;
+// in the process of a test, its end of the socket pair to the controller.
+static int schedfd = -1;
+
+typedef struct
+{
+    uint64_t reqid;
+    // when the client sent it.
+    int64_t sent;
+    struct sockaddr_in addr;
+    // the UDP socket it came from.
+    int sock;
+    char code;
+    char message[CONTROL_MESSAGE];
+    int mlen;
+    // the last reply sent, a RET_QUEUED one until the final one is sent.
+    char reply[MAX_DATAGRAM];
+    int len;
+    int done;
+} request_t;
+
+static request_t requests[MAX_REQUESTS];
+static int nextRequest = 0;
+// the UDP request being served, NULL for a TCP control connection.
+static request_t *request = NULL;
+// the request of each concurrent test, -1 for a TCP one.
+static int jobRequests[MAX_JOBS];
+
+// the controller blocks SIGUSR1, SIGUSR2 and SIGCHLD and waits for them, for
+// the exit of the running server(pidfd) and for timeouts(timerfd) with
+// epoll, so that waiting costs no CPU.
+static int epfd;
+static int sigfd;
+static int timerfd;
+static int pidfd = -1;
+static sigset_t waitedSignals;
+// the listeners are only watched in the main loop.
+static int epollListeners = 0;
+
+static int connfd = -1;
+static int listenfds[MAX_ADDRS];
+static int listenCount;
+// UDP control sockets on the same addresses, only with the kernel stack.
+static int udpfds[MAX_ADDRS];
+static int udpCount = 0;
+static char *secret = NULL;
+// listening sockets of the servers.
+static int svListenfds[MAX_ADDRS];
+static int svListenCount = 0;
 
 extern int serverMain(int argc, char **argv);
 
@@ -57,69 +209,370 @@ static inline pid_t backupFork()
     return chldPID = fork();
 }
 
-static void sigusr1Handler(int sig)
+static void watch(int fd, int id, unsigned int events, int op)
+{
+    struct epoll_event ev;
+
+    ev.events = events;
+    ev.data.u32 = id;
+    if (epoll_ctl(epfd, op, fd, &ev) < 0)
+    {
+        failExit("epoll_ctl");
+    }
+}
+
+static void watchListeners(int on)
+{
+    int i;
+
+    for (i = 0; epollListeners && i < listenCount; ++i)
+    {
+        watch(listenfds[i], i, on ? EPOLLIN : 0, EPOLL_CTL_MOD);
+    }
+    for (i = 0; i < udpCount; ++i)
+    {
+        watch(udpfds[i], ID_UDP + i, on ? EPOLLIN : 0, EPOLL_CTL_MOD);
+    }
+}
+
+// watches for the exit of the running server. without pidfds(before Linux
+// 5.3) SIGCHLD tells us as well.
+static void watchServer()
 {
-    int be = errno;
-    logVerbose("--SIGUSR1 received.");
-    release(&sigusr1);
-    errno = be;
+    if ((pidfd = syscall(SYS_pidfd_open, chldPID, 0)) >= 0)
+    {
+        watch(pidfd, ID_PID, EPOLLIN, EPOLL_CTL_ADD);
+    }
 }
 
-static void sigusr2Handler(int sig)
+static void unwatchServer()
 {
-    int be = errno;
-    logVerbose("--SIGUSR2 received.");
-    release(&sigusr2);
-    errno = be;
+    if (pidfd >= 0)
+    {
+        close(pidfd);
+        pidfd = -1;
+    }
 }
 
-static void sigalrmHandler(int sig)
+static void serverExited()
 {
-    int be = errno;
-    logVerbose("--SIGALRM received.");
-    release(&sigalrm);
-    errno = be;
+    chldPID = -1;
+    unwatchServer();
 }
 
-static void sigchldHandler(int sig)
+static void reapChildren()
 {
-    int x;
-    int be = errno;
-    logVerbose("--SIGCHLD received.");
-    while ((x = waitpid(0, NULL, WNOHANG)) > 0)
+    int x, i;
+
+    while ((x = waitpid(-1, NULL, WNOHANG)) > 0)
     {
         logMessage("--Child process(%d) terminated", x);
+        liveExited(x);
         if (x == chldPID)
         {
-            chldPID = -1;
+            serverExited();
+        }
+        for (i = 0; i < poolCount; ++i)
+        {
+            if (pool[i] == x)
+            {
+                pool[i] = -1;
+            }
+        }
+    }
+}
+
+// returns the events of the pending signals. SIGUSR1 and SIGUSR2 only count
+// if they come from the running server.
+static int readSignals()
+{
+    struct signalfd_siginfo info;
+    int got = 0;
+
+    while (read(sigfd, &info, sizeof(info)) == sizeof(info))
+    {
+        USDT1(signal, (int)info.ssi_signo);
+        switch (info.ssi_signo)
+        {
+        case SIGUSR1:
+            logVerbose("--SIGUSR1 received from %d.", (int)info.ssi_pid);
+            got |= (pid_t)info.ssi_pid == chldPID ? EV_USR1 : 0;
+            break;
+        case SIGUSR2:
+            logVerbose("--SIGUSR2 received from %d.", (int)info.ssi_pid);
+            got |= (pid_t)info.ssi_pid == chldPID ? EV_USR2 : 0;
+            break;
+        case SIGCHLD:
+            logVerbose("--SIGCHLD received.");
+            if (chldPID > 0)
+            {
+                reapChildren();
+                got |= chldPID == -1 ? EV_EXIT : 0;
+                break;
+            }
+            reapChildren();
+            break;
+        }
+    }
+    return got;
+}
+
+static double monotonic()
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+// tells the processes of the tests that have started or moved in the queue.
+static void notifyJobs()
+{
+    schedReply_t reply;
+    int i;
+
+    for (i = 0; i < MAX_JOBS; ++i)
+    {
+        job_t *job = jobs + i;
+
+        if (job->fd < 0 || !job->changed)
+        {
+            continue;
+        }
+        job->changed = 0;
+        reply.slot = job->slot;
+        reply.position = job->position;
+        reply.eta = job->eta;
+        if (job->slot >= 0)
+        {
+            logMessage("Test(%d) started on data port %d.", job->pid,
+                svPort - job->slot);
+        }
+        else
+        {
+            logVerbose("Test(%d) queued at position %d, starts in about "
+                "%ds.", job->pid, job->position, job->eta);
+        }
+        // a process that has gone away is dropped on its EOF.
+        send(job->fd, &reply, sizeof(reply), MSG_NOSIGNAL);
+    }
+}
+
+static void reschedule()
+{
+    schedule(jobs, MAX_JOBS, monotonic());
+    notifyJobs();
+}
+
+// answers a UDP request, and remembers the answer for its retransmissions.
+static void udpReply(request_t *req, char ret, const char *message)
+{
+    char errbuf[256];
+
+    message = message ? message : "";
+    req->len = packControl(req->reply, req->reqid, ret, message,
+        strlen(message) + 1);
+    req->done = ret != RET_QUEUED;
+    if (kernelStack->sendto(udpfds[req->sock], req->reply, req->len, 0,
+        (struct sockaddr*)&req->addr, sizeof(req->addr)) < 0)
+    {
+        logWarning("Can't send reply to %s(%s).",
+            inet_ntoa(req->addr.sin_addr), strerrorV(errno, errbuf));
+    }
+}
+
+// the process of a test sends the control message of the test and its
+// replies to a UDP client, and closes its end when the test is refused or
+// its server has exited.
+static void readJob(int i)
+{
+    job_t *job = jobs + i;
+    char message[CONTROL_MESSAGE + 2];
+    schedReply_t reply;
+    plan_t plan;
+    ssize_t n;
+
+    if ((n = recv(job->fd, message, sizeof(message) - 1, 0)) > 1 &&
+        message[0] == JOB_REPLY)
+    {
+        message[n] = 0;
+        if (jobRequests[i] >= 0)
+        {
+            udpReply(requests + jobRequests[i], message[1],
+                n > 2 ? message + 2 : NULL);
         }
+        return;
+    }
+    if (n > 1)
+    {
+        message[n] = 0;
+        // the process of the test has checked the message already.
+        if (decodePlan(&plan, message + 1, n - 1) < 0 ||
+            parseRequest(job, &plan, jobCount++) < 0)
+        {
+            logWarning("Test(%d) needs %ld Bytes/sec, more than the "
+                "budget.", job->pid, job->demand);
+            memset(&reply, 0, sizeof(reply));
+            reply.slot = -1;
+            send(job->fd, &reply, sizeof(reply), MSG_NOSIGNAL);
+            job->seq = -1;
+            return;
+        }
+        reschedule();
+        return;
+    }
+    if (n < 0 && (errno == EINTR || errno == EAGAIN))
+    {
+        return;
+    }
+    if (job->slot >= 0)
+    {
+        logMessage("Test(%d) on data port %d ended.", job->pid,
+            svPort - job->slot);
     }
-    if (chldPID != -1)
+    // the process died before it could answer.
+    if (jobRequests[i] >= 0 && !requests[jobRequests[i]].done)
     {
-        logError("--%d not terminated!", chldPID);
+        udpReply(requests + jobRequests[i], RET_EPROC, NULL);
+    }
+    close(job->fd);
+    job->fd = -1;
+    job->seq = -1;
+    job->slot = -1;
+    reschedule();
+}
+
+// waits until one of the events in mask happens, or for at most seconds(0
+// for no timeout, < 0 to only handle what is pending). returns the events
+// that happened, and the ready listener for EV_ACCEPT. children are reaped
+// whatever the mask is.
+static int waitFor(int mask, int seconds, int *listener)
+{
+    struct epoll_event events[MAX_EVENTS];
+    struct itimerspec timer;
+    uint64_t expired;
+    int got = 0;
+    int n, i, fd, scrape;
+
+    memset(&timer, 0, sizeof(timer));
+    timer.it_value.tv_sec = seconds > 0 ? seconds : 0;
+    timerfd_settime(timerfd, 0, &timer, NULL);
+    do
+    {
+        // a scrape never holds the loop past its deadline.
+        if ((n = epoll_wait(epfd, events, MAX_EVENTS,
+            seconds < 0 ? 0 : expireScrapes())) < 0)
+        {
+            if (errno != EINTR)
+            {
+                failExit("epoll_wait");
+            }
+            continue;
+        }
+        for (i = 0; i < n; ++i)
+        {
+            switch (events[i].data.u32)
+            {
+            case ID_SIGNAL:
+                got |= readSignals();
+                break;
+            case ID_TIMER:
+                if (read(timerfd, &expired, sizeof(expired)) > 0)
+                {
+                    got |= EV_TIMEOUT;
+                }
+                break;
+            case ID_PID:
+                // reaped with the SIGCHLD that follows.
+                logVerbose("--Server(%d) exited.", chldPID);
+                serverExited();
+                got |= EV_EXIT;
+                break;
+            case ID_METRICS:
+                if ((scrape = acceptScrape(metricsfd, &fd)) >= 0)
+                {
+                    watch(fd, ID_SCRAPE + scrape, EPOLLIN, EPOLL_CTL_ADD);
+                }
+                break;
+            default:
+                if (events[i].data.u32 >= ID_SCRAPE &&
+                    events[i].data.u32 < ID_JOB)
+                {
+                    readScrape(events[i].data.u32 - ID_SCRAPE,
+                        maxTests > 0 ? maxTests : 1);
+                    break;
+                }
+                if (events[i].data.u32 >= ID_JOB)
+                {
+                    readJob(events[i].data.u32 - ID_JOB);
+                    break;
+                }
+                *listener = events[i].data.u32;
+                got |= EV_ACCEPT;
+            }
+        }
+    } while (!(got & mask) && seconds >= 0);
+
+    timer.it_value.tv_sec = 0;
+    timerfd_settime(timerfd, 0, &timer, NULL);
+    return got;
+}
+
+static void initEvents()
+{
+    int i;
+
+    sigemptyset(&waitedSignals);
+    sigaddset(&waitedSignals, SIGUSR1);
+    sigaddset(&waitedSignals, SIGUSR2);
+    sigaddset(&waitedSignals, SIGCHLD);
+    if (sigprocmask(SIG_BLOCK, &waitedSignals, NULL) < 0)
+    {
+        failExit("sigprocmask");
+    }
+    if ((epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+    {
+        failExit("epoll_create1");
+    }
+    if ((sigfd = signalfd(-1, &waitedSignals, SFD_NONBLOCK | SFD_CLOEXEC))
+        < 0)
+    {
+        failExit("signalfd");
+    }
+    if ((timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC)) < 0)
+    {
+        failExit("timerfd_create");
+    }
+    watch(sigfd, ID_SIGNAL, EPOLLIN, EPOLL_CTL_ADD);
+    watch(timerfd, ID_TIMER, EPOLLIN, EPOLL_CTL_ADD);
+    // a user-space stack's sockets can't be watched by epoll, its listeners
+    // are served by a blocking acceptAny().
+    epollListeners = strcmp(backend->name, "kernel") == 0;
+    for (i = 0; epollListeners && i < listenCount; ++i)
+    {
+        watch(listenfds[i], i, 0, EPOLL_CTL_ADD);
+    }
+    for (i = 0; i < udpCount; ++i)
+    {
+        watch(udpfds[i], ID_UDP + i, 0, EPOLL_CTL_ADD);
+    }
+    // scrapes are answered whatever the controller waits for.
+    if (metricsfd >= 0)
+    {
+        watch(metricsfd, ID_METRICS, EPOLLIN, EPOLL_CTL_ADD);
     }
-    release(&sigchld);
-    errno = be;
 }
 
 static char rTerminate()
 {
     char ret;
 
-    setLock(&sigchld);
-    setLock(&sigalrm);
-    alarmWithLog(SV_RESPONSE);
-
     if ((ret = rKill(chldPID, "server", SIGINT)) != RET_SUCC)
     {
-        alarmWithLog(0);
         return ret;
     }
 
-    spinAND(&sigchld, &sigalrm);
-    alarmWithLog(0);
-
-    if (isLocked(&sigchld))
+    if (!(waitFor(EV_EXIT, SV_RESPONSE, NULL) & EV_EXIT))
     {
         logError(
             "Failed to terminate server with SIGINT(no response in 1 second)!");
@@ -132,11 +585,62 @@ static char rTerminate()
                 return ret;
             }
         }
+        // the server is left behind, SIGCHLD will reap it.
+        unwatchServer();
     }
 
     return RET_SUCC;
 }
 
+// the client's side of the exchange goes over its TCP connection, or is
+// the UDP request being served(connfd < 0). message takes CONTROL_MESSAGE
+// Bytes, its length is left in *len.
+static char recvRequest(int connfd, char *message, int *len)
+{
+    if (connfd >= 0)
+    {
+        return rReceiveBlock(connfd, "client", message, CONTROL_MESSAGE, len);
+    }
+    memcpy(message, request->message, request->mlen);
+    *len = request->mlen;
+    return RET_SUCC;
+}
+
+// sends a return value, followed by the message unless it's NULL. the
+// process of a concurrent test has the controller answer a UDP client.
+static char sendReply(int connfd, char ret, const char *message)
+{
+    char record[CONTROL_MESSAGE + 2];
+    char status;
+
+    if (connfd >= 0)
+    {
+        status = rSendBytes(connfd, &ret, 1,
+            "Failed to send return value to client");
+        if (status == RET_SUCC && message != NULL)
+        {
+            strcpy(record, message);
+            status = rSendMessage(connfd, "client", record,
+                strlen(record) + 1);
+        }
+        return status;
+    }
+    if (schedfd < 0)
+    {
+        udpReply(request, ret, message);
+        return RET_SUCC;
+    }
+    record[0] = JOB_REPLY;
+    record[1] = ret;
+    strcpy(record + 2, message ? message : "");
+    if (send(schedfd, record, message ? strlen(message) + 3 : 2,
+        MSG_NOSIGNAL) < 0)
+    {
+        return RET_EWRITE;
+    }
+    return RET_SUCC;
+}
+
 static void doTerminate(int connfd)
 {
     char ret = RET_SUCC;
@@ -152,7 +656,7 @@ static void doTerminate(int connfd)
     ret = rTerminate();
 
 doTerminate_out:
-    rSendBytes(connfd, &ret, 1, "Failed to send return value to client");
+    sendReply(connfd, ret, NULL);
     if (ret == RET_SUCC)
     {
         logMessage("Terminate completed.");
@@ -164,6 +668,55 @@ doTerminate_out:
     }
 }
 
+// answers with a line "port state run runs Bytes ms" for the test of every
+// slot in use from the slot of the message("[port] [slot]", 0 0 by default),
+// or only for the test on port if it isn't 0. Bytes and ms are those of the
+// run going on, or of the last one. when the lines don't fit in the reply,
+// it ends with "more [slot]" for the slot to ask from next.
+static void doStat(int connfd)
+{
+    char message[CONTROL_MESSAGE + 1];
+    char line[128];
+    liveStat_t stat;
+    struct timeval now;
+    int64_t end;
+    int port = 0, first = 0, i, len = 0;
+    int slots = maxTests > 0 ? maxTests : 1;
+
+    if (recvRequest(connfd, message, &len) != RET_SUCC)
+    {
+        return;
+    }
+    message[len] = 0;
+    sscanf(message, "%d%d", &port, &first);
+    gettimeofday(&now, NULL);
+    message[0] = 0;
+    len = 0;
+    for (i = first > 0 ? first : 0; i < slots; ++i)
+    {
+        if (readLiveStat(i, &stat) < 0 || stat.state == LIVE_IDLE ||
+            (port > 0 && stat.port != port))
+        {
+            continue;
+        }
+        end = stat.state != LIVE_RUNNING ? stat.end :
+            now.tv_sec * 1000000LL + now.tv_usec;
+        sprintf(line, "%d %s %d %d %lld %lld\n", stat.port,
+            liveStateName(stat.state), stat.run, stat.runs,
+            (long long)liveBytes(&stat), stat.start > 0 && end > stat.start ?
+            (long long)(end - stat.start) / 1000 : 0LL);
+        // room for the "more" line.
+        if (len + strlen(line) >= CONTROL_MESSAGE - 16)
+        {
+            sprintf(message + len, "more %d\n", i);
+            break;
+        }
+        strcpy(message + len, line);
+        len += strlen(line);
+    }
+    sendReply(connfd, RET_SUCC, message);
+}
+
 static void pushArg(const char *arg)
 {
     int len;
@@ -176,9 +729,10 @@ static void pushArg(const char *arg)
     memcpy(*(psvargv++), arg, len);
 }
 
-static int buildArgs()
+static int buildArgs(int pooled)
 {
-    char buf[16];
+    char buf[16 * MAX_ADDRS];
+    int i;
     psvargv = svargv;
 
     pushArg("server");
@@ -192,25 +746,77 @@ static int buildArgs()
         pushArg("-l");
         pushArg(svPath);
     }
+    if (mptcp)
+    {
+        pushArg("-M");
+    }
+    if (sourceIP != NULL)
+    {
+        pushArg("-s");
+        pushArg(sourceIP);
+    }
     pushArg("-p");
     sprintf(buf, "%d", svPort);
     pushArg(buf);
+    if (svListenCount > 0)
+    {
+        *buf = 0;
+        for (i = 0; i < svListenCount; ++i)
+        {
+            sprintf(buf + strlen(buf), i ? ",%d" : "%d", svListenfds[i]);
+        }
+        pushArg("-f");
+        pushArg(buf);
+    }
+    if (pooled)
+    {
+        pushArg("-W");
+    }
 
     *psvargv = NULL;
 
     return psvargv - svargv;
 }
 
-static void startAsServer()
+static void startAsServer(int pooled)
 {
-    int argc = buildArgs();
+    int argc = buildArgs(pooled);
+    int i;
     
-    forceClose(connfd);
-    forceClose(listenfd);
-    forceSignal(SIGUSR1, SIG_DFL);
-    forceSignal(SIGCHLD, SIG_DFL);
+    if (connfd >= 0)
+    {
+        forceClose(connfd);
+    }
+    for (i = 0; i < listenCount; ++i)
+    {
+        forceClose(listenfds[i]);
+    }
+    for (i = 0; i < udpCount; ++i)
+    {
+        kernelStack->close(udpfds[i]);
+    }
+    forceClose(epfd);
+    forceClose(sigfd);
+    forceClose(timerfd);
+    if (metricsfd >= 0)
+    {
+        kernelStack->close(metricsfd);
+        metricsfd = -1;
+    }
+    closeScrapes();
+    if (schedfd >= 0)
+    {
+        forceClose(schedfd);
+    }
+    unwatchServer();
     forceSignal(SIGALRM, SIG_DFL);
     forceSignal(SIGPIPE, SIG_DFL);
+    // SIGUSR1 stays blocked in a pooled server until it waits for it.
+    if (pooled)
+    {
+        sigdelset(&waitedSignals, SIGUSR1);
+    }
+    sigprocmask(SIG_UNBLOCK, &waitedSignals, NULL);
 
     logMessage("Server(%d) starting...", getpid());
     resetLogFile();
@@ -218,63 +824,281 @@ static void startAsServer()
     exit(serverMain(argc, svargv));
 }
 
+// forks a server into the pool.
+static void spawnServer()
+{
+    char errbuf[256];
+    pid_t pid;
+
+    if ((pid = fork()) == 0)
+    {
+        startAsServer(1);
+    }
+    if (pid < 0)
+    {
+        logError("Failed to start server(%s)!", strerrorV(errno, errbuf));
+        return;
+    }
+    USDT1(fork, pid);
+    pool[poolCount++] = pid;
+}
+
+// drops the servers that died and forks new ones up to poolSize.
+static void refillPool()
+{
+    int i, n = 0;
+
+    for (i = 0; i < poolCount; ++i)
+    {
+        if (pool[i] > 0)
+        {
+            pool[n++] = pool[i];
+        }
+    }
+    poolCount = n;
+    while (poolCount < poolSize)
+    {
+        int before = poolCount;
+
+        spawnServer();
+        if (poolCount == before)
+        {
+            break;
+        }
+    }
+}
+
+// takes an idle server out of the pool, or returns -1 if there's none.
+static pid_t takeServer()
+{
+    pid_t pid;
+
+    while (poolCount > 0)
+    {
+        if ((pid = pool[--poolCount]) > 0)
+        {
+            return pid;
+        }
+    }
+    return -1;
+}
+
+// asks the controller for a slot for the test, and keeps the client
+// informed of its place in the queue meanwhile with RET_QUEUED and
+// "[position] [seconds]". sets the data port of the slot, or returns why the
+// test didn't start in message.
+static char waitForSlot(int connfd, char *message, int len)
+{
+    char record[CONTROL_MESSAGE + 1];
+    schedReply_t reply;
+    struct pollfd pfd;
+    double deadline = monotonic() + queueWait, left, since = 0;
+    char ret = RET_QUEUED;
+    int timeout, n, eta;
+
+    record[0] = JOB_REQUEST;
+    memcpy(record + 1, message, len);
+    if (send(schedfd, record, len + 1, MSG_NOSIGNAL) < 0)
+    {
+        sprintf(message, "Scheduler not reachable");
+        return RET_EMSG;
+    }
+    pfd.fd = schedfd;
+    pfd.events = POLLIN;
+    memset(&reply, 0, sizeof(reply));
+    while (1)
+    {
+        // the controller answers a new test at once.
+        timeout = -1;
+        if (reply.position > 0)
+        {
+            left = deadline - monotonic();
+            left = left < QUEUE_UPDATE ? left : QUEUE_UPDATE;
+            timeout = left > 0 ? (int)(1000 * left) : 0;
+        }
+        if ((n = poll(&pfd, 1, timeout)) < 0)
+        {
+            if (errno != EINTR)
+            {
+                failExit("poll");
+            }
+            continue;
+        }
+        if (n > 0)
+        {
+            if (recv(schedfd, &reply, sizeof(reply), 0) != sizeof(reply))
+            {
+                sprintf(message, "Scheduler not reachable");
+                return RET_EMSG;
+            }
+            since = monotonic();
+            if (reply.slot >= 0)
+            {
+                svPort -= reply.slot;
+                setLiveSlot(reply.slot);
+                return RET_SUCC;
+            }
+            if (reply.position == 0)
+            {
+                sprintf(message, "The test needs more than the bandwidth "
+                    "budget of %dMbit/s", budget);
+                return RET_EMSG;
+            }
+        }
+        if (queueWait == 0 && budget > 0)
+        {
+            sprintf(message, "No test slot or bandwidth free");
+            return RET_EMSG;
+        }
+        if (queueWait == 0)
+        {
+            sprintf(message, "All %d test slots are busy", maxTests);
+            return RET_EMSG;
+        }
+        if (monotonic() >= deadline)
+        {
+            sprintf(message, "The test didn't start within %d seconds",
+                queueWait);
+            return RET_EMSG;
+        }
+        // the estimate counts down until the scheduler revises it.
+        eta = reply.eta - (int)(monotonic() - since + 0.5);
+        sprintf(message, "%d %d", reply.position, eta > 0 ? eta : 0);
+        if (sendReply(connfd, ret, message) != RET_SUCC)
+        {
+            return RET_EWRITE;
+        }
+    }
+}
+
 static void doConfigure(int connfd)
 {
     char ret;
-    char message[1024];
+    char message[CONTROL_MESSAGE + 1];
+    char text[PLAN_TEXT];
     char errbuf[256];
+    plan_t plan;
+    double start = monotonic();
+    int64_t since = traceNow(), terminated = since;
+    int len, mlen, got;
 
+    USDT0(conf_start);
     logMessage("Trying to reconfigure the server...");
     logVerbose("Existing child: %d", chldPID);
+    plan.flags = 0;
 
-    if (chldPID > 0 && (ret = rTerminate()) != RET_SUCC)
+    if (chldPID > 0)
     {
-        goto doConfigure_out;
+        if ((ret = rTerminate()) != RET_SUCC)
+        {
+            goto doConfigure_out;
+        }
+        countPreemption();
+        terminated = traceNow();
+    }
+    // the previous server is gone, the trace is the new test's.
+    resetTrace();
+    traceEvent(TRACE_ACCEPT, -1, acceptedAt, acceptedAt);
+    if (terminated > since)
+    {
+        traceEvent(TRACE_TERMINATE, -1, since, terminated);
     }
 
-    if ((ret = rReceiveMessage(connfd, "client", message)) != RET_SUCC)
+    if ((ret = recvRequest(connfd, message, &mlen)) != RET_SUCC)
+    {
+        goto doConfigure_out;
+    }
+    if ((len = decodePlan(&plan, message, mlen)) < 0)
+    {
+        sprintf(message, "Unsupported control message, the client needs "
+            "version %d", PLAN_VERSION);
+        ret = RET_EMSG;
+        goto doConfigure_out;
+    }
+    setBlock(SMEM_MESSAGE, message, len);
+    formatPlan(&plan, text);
+    USDT1(conf_message, text);
+    logMessage("Reconfiguring, control message is \"%s\".", text);
+    if (maxTests > 0 && !(plan.flags & FLAG_PORT))
+    {
+        sprintf(message, "The client can't use the data port of its test");
+        ret = RET_EMSG;
+        goto doConfigure_out;
+    }
+    since = traceNow();
+    if (maxTests > 0 &&
+        (ret = waitForSlot(connfd, message, len)) != RET_SUCC)
     {
         goto doConfigure_out;
     }
-    setMessage(SMEM_MESSAGE, message);
-    logMessage("Reconfiguring, control message is \"%s\".", message);
+    if (maxTests > 0)
+    {
+        traceSpan(TRACE_QUEUE, -1, since);
+    }
 
-    setLock(&sigusr1);
-    setLock(&sigusr2);
-    setLock(&sigalrm);
-    alarmWithLog(SV_RESPONSE);
+    // drops the signals left by the previous server.
+    waitFor(0, -1, NULL);
 
-    if (backupFork() == 0)
+    // a pooled server only has to be woken up.
+    since = traceNow();
+    if ((chldPID = takeServer()) > 0 && kill(chldPID, SIGUSR1) == 0)
+    {
+        logMessage("Server(%d) taken from the pool.", chldPID);
+    }
+    else if (backupFork() == 0)
     {
-        startAsServer();
+        startAsServer(0);
     }
     else if (chldPID == -1)
     {
         logError("Failed to start server(%s)!", strerrorV(errno, errbuf));
     }
+    else
+    {
+        USDT1(fork, chldPID);
+    }
+    if (chldPID > 0)
+    {
+        watchServer();
+    }
+    traceSpan(TRACE_FORK, -1, since);
+    since = traceNow();
 
-    spinAND3(&sigusr1, &sigusr2, &sigalrm);
-    alarmWithLog(0);
-
-    if (!isLocked(&sigusr2))
+    // SIGUSR1 when the server is ready, SIGUSR2 when it failed.
+    got = waitFor(EV_USR1 | EV_USR2 | EV_EXIT | EV_TIMEOUT, SV_RESPONSE,
+        NULL);
+    if (got & EV_USR2)
     {
         getMessage(SMEM_MESSAGE, message);
         ret = RET_EMSG;
         goto doConfigure_out;
     }
-    else if (!isLocked(&sigalrm))
+    else if (!(got & EV_USR1))
     {
         ret = RET_EPROC;
         goto doConfigure_out;
     }
+    traceSpan(TRACE_READY, -1, since);
 
 doConfigure_out:
-    rSendBytes(connfd, &ret, 1, "Failed to send return value to client");
+    USDT1(conf_done, ret);
+    countConfigure(ret, monotonic() - start);
+    since = traceNow();
     if (ret == RET_EMSG)
     {
-        logError("Server terminated(%s).", message);
-        rSendMessage(connfd, "client", message, strlen(message) + 1);
+        logError("Test refused(%s).", message);
+        sendReply(connfd, ret, message);
     }
+    else if (ret == RET_SUCC && (plan.flags & FLAG_PORT))
+    {
+        sprintf(message, "%d", svPort);
+        sendReply(connfd, ret, message);
+    }
+    else
+    {
+        sendReply(connfd, ret, NULL);
+    }
+    traceSpan(TRACE_REPLY, -1, since);
     if (ret == RET_SUCC)
     {
         logMessage("Reconfigure completed.");
@@ -288,7 +1112,12 @@ doConfigure_out:
 static void parse(int connfd)
 {
     char c;
-    if (rRecvBytes(connfd, &c, 1, 
+
+    if (connfd < 0)
+    {
+        c = request->code;
+    }
+    if (connfd < 0 || rRecvBytes(connfd, &c, 1, 
         "Failed to receive instruction from client") == RET_SUCC)
     {
         switch (c)
@@ -299,40 +1128,265 @@ static void parse(int connfd)
         case SIG_CONF:
             doConfigure(connfd);
             break;
+        case SIG_STAT:
+            doStat(connfd);
+            break;
         default:
             logWarning("Unrecognized instruction %d.", (int)c);
         }
     }
 }
 
+// serves the control connection of one of the concurrent tests, on the data
+// port of its slot. the process stays until its server exits, the server
+// signals it rather than the controller.
+static void handleTest()
+{
+    int i;
+
+    for (i = 0; i < listenCount; ++i)
+    {
+        forceClose(listenfds[i]);
+    }
+    for (i = 0; i < MAX_JOBS; ++i)
+    {
+        if (jobs[i].fd >= 0)
+        {
+            forceClose(jobs[i].fd);
+        }
+    }
+    for (i = 0; i < udpCount; ++i)
+    {
+        kernelStack->close(udpfds[i]);
+    }
+    forceClose(epfd);
+    forceClose(sigfd);
+    forceClose(timerfd);
+    if (metricsfd >= 0)
+    {
+        kernelStack->close(metricsfd);
+        metricsfd = -1;
+    }
+    closeScrapes();
+    listenCount = udpCount = 0;
+    initEvents();
+    initSharedMem(SMEM_MESSAGE);
+    initTrace();
+
+    parse(connfd);
+    if (connfd >= 0)
+    {
+        backend->close(connfd);
+        connfd = -1;
+    }
+    if (chldPID > 0)
+    {
+        waitFor(EV_EXIT, 0, NULL);
+    }
+    exit(0);
+}
+
+// hands the control connection, or the UDP request req, to a process of
+// its own, which asks the scheduler for a slot through a socket pair once it
+// has the control message.
+static void startTest(int req)
+{
+    char errbuf[256];
+    int sv[2];
+    pid_t pid;
+    int i;
+
+    for (i = 0; i < MAX_JOBS && jobs[i].fd >= 0; ++i);
+    if (i == MAX_JOBS)
+    {
+        logWarning("Too many tests waiting(%d), request refused.",
+            MAX_JOBS);
+        if (req >= 0)
+        {
+            udpReply(requests + req, RET_EPROC, NULL);
+        }
+        return;
+    }
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv) < 0)
+    {
+        logError("Failed to start test(%s)!", strerrorV(errno, errbuf));
+        if (req >= 0)
+        {
+            udpReply(requests + req, RET_EPROC, NULL);
+        }
+        return;
+    }
+    if ((pid = fork()) == 0)
+    {
+        forceClose(sv[0]);
+        schedfd = sv[1];
+        request = req >= 0 ? requests + req : NULL;
+        handleTest();
+    }
+    forceClose(sv[1]);
+    if (pid < 0)
+    {
+        logError("Failed to start test(%s)!", strerrorV(errno, errbuf));
+        forceClose(sv[0]);
+        if (req >= 0)
+        {
+            udpReply(requests + req, RET_EPROC, NULL);
+        }
+        return;
+    }
+    USDT1(fork, pid);
+    jobs[i].pid = pid;
+    jobs[i].fd = sv[0];
+    jobs[i].seq = -1;
+    jobs[i].slot = -1;
+    jobRequests[i] = req;
+    watch(sv[0], ID_JOB + i, EPOLLIN, EPOLL_CTL_ADD);
+}
+
+// serves a UDP request. a retransmission gets the reply sent already, or
+// nothing while the request is in progress. it's known by its id alone, the
+// MAC covers the id but not the source address, so a request replayed from
+// another port is not carried out twice. a request replayed later is stale.
+static void serveDatagram(int sock)
+{
+    char buf[MAX_DATAGRAM], message[CONTROL_MESSAGE + 1];
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    request_t *req;
+    uint64_t reqid;
+    int64_t sent, now;
+    char code;
+    int n, i;
+
+    if ((n = kernelStack->recvfrom(udpfds[sock], buf, sizeof(buf), 0,
+        (struct sockaddr*)&addr, &len)) < 0)
+    {
+        return;
+    }
+    if ((n = unpackControl(buf, n, &reqid, &sent, &code, message)) < 0)
+    {
+        logWarning("Dropped a request from %s that isn't ours or fails the "
+            "MAC.", inet_ntoa(addr.sin_addr));
+        return;
+    }
+    for (i = 0; i < MAX_REQUESTS; ++i)
+    {
+        req = requests + i;
+        if (req->reqid == reqid && reqid != 0)
+        {
+            logVerbose("Request %016llx retransmitted.",
+                (unsigned long long)reqid);
+            if (req->len > 0)
+            {
+                kernelStack->sendto(udpfds[sock], req->reply, req->len, 0,
+                    (struct sockaddr*)&addr, sizeof(addr));
+            }
+            return;
+        }
+    }
+
+    now = nowUS();
+    if (sent < now - CONTROL_WINDOW * 1000000LL ||
+        sent > now + CONTROL_WINDOW * 1000000LL)
+    {
+        logWarning("Dropped request %016llx from %s sent %llds away from "
+            "now(stale, or the clocks disagree).", (unsigned long long)reqid,
+            inet_ntoa(addr.sin_addr), (long long)(sent - now) / 1000000);
+        return;
+    }
+
+    // the oldest requests are forgotten, but not the ones in progress or
+    // still fresh.
+    for (i = 0; i < MAX_REQUESTS; ++i)
+    {
+        req = requests + nextRequest;
+        nextRequest = (nextRequest + 1) % MAX_REQUESTS;
+        if (req->reqid == 0 || (req->done &&
+            req->sent < now - CONTROL_WINDOW * 1000000LL))
+        {
+            break;
+        }
+    }
+    if (i == MAX_REQUESTS)
+    {
+        logWarning("Too many requests in the last %ds(%d), request %016llx "
+            "dropped.", CONTROL_WINDOW, MAX_REQUESTS,
+            (unsigned long long)reqid);
+        return;
+    }
+    memset(req, 0, sizeof(request_t));
+    req->reqid = reqid;
+    req->sent = sent;
+    req->addr = addr;
+    req->sock = sock;
+    req->code = code;
+    memcpy(req->message, message, n);
+    req->mlen = n;
+    acceptedAt = traceNow();
+    logMessage("Request %016llx from %s:%d.", (unsigned long long)reqid,
+        inet_ntoa(addr.sin_addr), ntohs(addr.sin_port));
+
+    if (maxTests > 0)
+    {
+        startTest(req - requests);
+        return;
+    }
+    request = req;
+    parse(-1);
+    // an unrecognized instruction gets no reply.
+    req->done = 1;
+    request = NULL;
+}
+
 static void parseArguments(int argc, char **argv)
 {
     char c;
+    int slots;
     optind = 0;
-    while ((c = getopt(argc, argv, "p:vV::l:hL:s:P:k")) != EOF)
+    while ((c = getopt(argc, argv, "b:p:vV::l:hK:L:m:Ms:P:kn:q:w:")) != EOF)
     {
         switch (c)
         {
+        case 'b':
+            budget = atoi(optarg);
+            break;
         case 'h':
             printUsageAndExit(argv);
             break;
         case 'k':
             completeKill = 1;
             break;
+        case 'K':
+            secret = optarg;
+            break;
         case 'l':
             path = optarg;
             break;
         case 'L':
             svPath = optarg;
             break;
+        case 'm':
+            metricsPort = atoi(optarg);
+            break;
+        case 'M':
+            mptcp = 1;
+            break;
+        case 'n':
+            maxTests = atoi(optarg);
+            break;
         case 'p':
             port = atoi(optarg);
             break;
         case 'P':
             svPort = atoi(optarg);
             break;
+        case 'q':
+            queueWait = atoi(optarg);
+            break;
         case 's':
-            sourceIP = optarg;
+            // keep the original list for the server, splitting modifies it.
+            sourceIP = strdup(optarg);
+            sourceCount = splitList(optarg, sourceIPs, MAX_ADDRS);
             break;
         case 'v':
             printVersionAndExit("mperf-server");
@@ -347,6 +1401,9 @@ static void parseArguments(int argc, char **argv)
                 setVerbose(1);
             }
             break;
+        case 'w':
+            poolSize = atoi(optarg);
+            break;
         default:
             logWarning("Unexpected command-line option %c!", (char)optopt);
             printUsageAndExit(argv);
@@ -361,6 +1418,59 @@ static void parseArguments(int argc, char **argv)
     {
         svPort = port - 1;
     }
+    if (poolSize < 0 || poolSize > MAX_POOL)
+    {
+        logFatal("Invalid pool size %d(max %d).", poolSize, MAX_POOL);
+    }
+    if (maxTests < 0 || maxTests > MAX_TESTS)
+    {
+        logFatal("Invalid number of tests %d(max %d).", maxTests, MAX_TESTS);
+    }
+    if (queueWait < 0 || budget < 0)
+    {
+        logFatal("Invalid queue wait %d or budget %d.", queueWait, budget);
+    }
+    // a queue or a budget alone schedule the tests one at a time.
+    if (maxTests == 0 && (queueWait > 0 || budget > 0))
+    {
+        maxTests = 1;
+    }
+    // the data port of slot i is svPort - i.
+    slots = maxTests > 0 ? maxTests : 1;
+    if (svPort - slots + 1 <= 0)
+    {
+        logFatal("Data ports %d to %d out of range.", svPort - slots + 1,
+            svPort);
+    }
+    if (port >= svPort - slots + 1 && port <= svPort)
+    {
+        logFatal("The controller port %d is one of the data ports %d to %d.",
+            port, svPort - slots + 1, svPort);
+    }
+    if (metricsPort >= svPort - slots + 1 && metricsPort <= svPort)
+    {
+        logFatal("The metrics port %d is one of the data ports %d to %d.",
+            metricsPort, svPort - slots + 1, svPort);
+    }
+    // sockets of a user-space stack may not survive a fork.
+    if (maxTests > 0 && strcmp(backend->name, "kernel") != 0)
+    {
+        logFatal("Concurrent tests need the kernel stack.");
+    }
+    if (metricsPort != 0 && strcmp(backend->name, "kernel") != 0)
+    {
+        logFatal("Metrics need the kernel stack.");
+    }
+    if (maxTests > 0)
+    {
+        poolSize = 0;
+    }
+    if (poolSize > 0 && strcmp(backend->name, "kernel") != 0)
+    {
+        logWarning("Servers are not pooled with the %s stack.",
+            backend->name);
+        poolSize = 0;
+    }
     if (path != NULL)
     {
         redirectLogTo(path);
@@ -370,6 +1480,8 @@ static void parseArguments(int argc, char **argv)
 int main(int argc, char **argv)
 {
     char errbuf[256];
+    int listener;
+    int i;
 
     if (argc == 1)
     {
@@ -380,15 +1492,64 @@ int main(int argc, char **argv)
     parseArguments(argc, argv);
     printInitLog();
 
-    signalNoRestart(SIGUSR1, sigusr1Handler);
-    signalNoRestart(SIGUSR2, sigusr2Handler);
-    signalNoRestart(SIGCHLD, sigchldHandler);
-    signalNoRestart(SIGALRM, sigalrmHandler);
+    // the controller's own timeouts are timerfds, the message functions
+    // install their SIGALRM handler while they run.
+    signalNoRestart(SIGALRM, SIG_IGN);
     signalNoRestart(SIGPIPE, SIG_IGN);
 
     initSharedMem(SMEM_MESSAGE);
+    initLiveStats();
+    initMetrics();
+    initTrace();
+    if (metricsPort != 0 && (metricsfd = openMetricsFD(
+        sourceCount ? sourceIPs[0] : NULL, metricsPort)) < 0)
+    {
+        logFatal("Can't listen for metrics on port %d(%s).", metricsPort,
+            strerrorV(errno, errbuf));
+    }
 
-    listenfd = forceOpenListenFD(sourceIP, port);
+    // without -s, listen on all addresses.
+    listenCount = sourceCount ? sourceCount : 1;
+    for (i = 0; i < listenCount; ++i)
+    {
+        listenfds[i] = forceOpenListenFD(sourceCount ? sourceIPs[i] : NULL,
+            port, 0);
+    }
+    if (poolSize > 0)
+    {
+        svListenCount = listenCount;
+        for (i = 0; i < svListenCount; ++i)
+        {
+            svListenfds[i] = forceOpenListenFD(
+                sourceCount ? sourceIPs[i] : NULL, svPort,
+                mptcp ? IPPROTO_MPTCP : 0);
+        }
+    }
+    // UDP requests are watched with the listeners.
+    if (strcmp(backend->name, "kernel") == 0)
+    {
+        udpCount = listenCount;
+        for (i = 0; i < udpCount; ++i)
+        {
+            if ((udpfds[i] = openControlFD(sourceCount ? sourceIPs[i] : NULL,
+                port)) < 0)
+            {
+                failExit("openControlFD");
+            }
+        }
+    }
+    if (!setControlKey(secret) && udpCount > 0)
+    {
+        logWarning("No -K or MPERF_KEY, anyone who reaches [port] over UDP "
+            "can configure and terminate tests.");
+    }
+    for (i = 0; i < MAX_JOBS; ++i)
+    {
+        jobs[i].fd = -1;
+        jobRequests[i] = -1;
+    }
+    initScheduler(maxTests, budget * 125000L);
+    initEvents();
 
     // initialize complete, start main loop
     while (1) 
@@ -398,37 +1559,62 @@ int main(int argc, char **argv)
         unsigned short clientport;
         char *haddrp;
 
+        // off the path of the next test.
+        refillPool();
+
         logMessage("Listening on port %d.", port);
         clientlen = sizeof(clientaddr);
-        while ((connfd = accept(
-            listenfd, (struct sockaddr *)&clientaddr, &clientlen)) < 0);
+        if (epollListeners)
         {
-            if (errno != 0)
+            // servers that exit meanwhile are reaped.
+            watchListeners(1);
+            waitFor(EV_ACCEPT, 0, &listener);
+            watchListeners(0);
+            if (listener >= ID_UDP)
             {
-                if (errno == EINTR)
-                {
-                    logVerbose("%s", "Accept interrupted.");
-                }
-                else
-                {
-                    logError("Unable to accept connection(%s)!", 
-                        strerrorV(errno, errbuf));
-                }
+                serveDatagram(listener - ID_UDP);
+                continue;
+            }
+            connfd = backend->accept(listenfds[listener],
+                (struct sockaddr*)&clientaddr, &clientlen);
+        }
+        else
+        {
+            // SIGCHLD is blocked, reap the servers that exited since.
+            waitFor(0, -1, NULL);
+            connfd = acceptAny(listenfds, listenCount, &clientaddr,
+                &clientlen);
+        }
+        if (connfd < 0)
+        {
+            if (errno != EAGAIN && errno != EINTR)
+            {
+                logError("Unable to accept connection(%s)!",
+                    strerrorV(errno, errbuf));
             }
-            logMessage("Listening on port %d.", port);
-            clientlen = sizeof(clientaddr);
+            continue;
         }
 
+        acceptedAt = traceNow();
         haddrp = inet_ntoa(clientaddr.sin_addr);
         clientport = clientaddr.sin_port >> 8 | clientaddr.sin_port << 8;
-        logMessage("Connected with %s:%d", haddrp, (int)clientport);
+        logMessage("Connected with %s:%d%s", haddrp, (int)clientport,
+            fastOpened(connfd) ? "(TCP Fast Open)" : "");
 
-        parse(connfd);
-        if (close(connfd) < 0)
+        if (maxTests > 0)
+        {
+            startTest(-1);
+        }
+        else
+        {
+            parse(connfd);
+        }
+        if (backend->close(connfd) < 0)
         {
             logWarning("Error when closing connection(%s).", 
                 strerrorV(errno, errbuf));
         }
+        connfd = -1;
         logMessage("Connection with %s closed.\n", haddrp);
     }
 
@@ -1,49 +1,207 @@
+#include <endian.h>
+
+#include "cost.h"
+#include "live.h"
 #include "sndrcv.h"
+#include "trace.h"
+#include "train.h"
 #include "util.h"
 
 lock_t sigalrm;
 lock_t sigint;
+result_t lastResult;
 
-void doLongTest(int connfd, int timelen, char *packetBuf)
+static pid_t streamPID[MAX_STREAMS];
+static volatile int streamCount;
+
+static inline void setResult(long bytes, double elapsed, const cost_t *cost)
+{
+    lastResult.bytes = bytes;
+    lastResult.elapsed = elapsed;
+    lastResult.cost = *cost;
+    lastResult.retrans = lastResult.rtt = 0;
+}
+
+// the loops below are the hot paths of the tests, there's one for each mode
+// so that none of them checks the mode. the send loops return the bytes
+// sent and leave a short write in *wrote, the receive loops return the bytes
+// received and leave a short read in *ret.
+
+static long sendBulk(int connfd, char *buf, int *wrote)
 {
-    struct timeval st, ed;
     long sum = 0;
-    int wrote = 0;
-    double elapsed;
-    char errbuf[256];
+    int ret;
 
-    logVerbose("Start long test.");
+    while (continueTest())
+    {
+        if ((ret = rio_writenr(connfd, buf, PACKET_LEN)) < PACKET_LEN)
+        {
+            *wrote = ret;
+            break;
+        }
+        sum += ret;
+    }
+    return sum;
+}
 
-    alarmWithLog(timelen);
+// sends a byte every 50ms.
+static long sendTrickle(int connfd, char *buf, int *wrote)
+{
+    long sum = 0;
+    int ret;
+    char c = 0;
 
-    gettimeofday(&st, NULL);
+    while (continueTest())
+    {
+        if ((ret = rio_writenr(connfd, &c, 1)) < 1)
+        {
+            *wrote = ret;
+            break;
+        }
+        sum += ret;
+        usleep(50000);
+    }
+    return sum;
+}
+
+// sends a packet every second.
+static long sendSlow(int connfd, char *buf, int *wrote)
+{
+    long sum = 0;
+    int ret;
 
     while (continueTest())
     {
-        int len;
-#ifndef FIX
-        len = PACKET_LEN;
-        wrote = rio_writenr(connfd, packetBuf, len);
-#else
-        char c = 0;
-        len = 1;
-        wrote = rio_writenr(connfd, &c, len);
-#endif
-        if (wrote < len)
+        if ((ret = rio_writenr(connfd, buf, PACKET_LEN)) < PACKET_LEN)
         {
+            *wrote = ret;
             break;
         }
-        sum += wrote;
-#ifdef SPECIAL
+        sum += ret;
         sleep(1);
-#endif
-#ifdef FIX
-        usleep(50000);
-#endif
     }
+    return sum;
+}
+
+// receives until EOF, or until len bytes if len >= 0.
+static long recvPlain(int connfd, char *buf, long len, int *ret)
+{
+    long sum = 0;
+    int want, got;
+
+    do
+    {
+        errno = 0;
+        want = len < 0 || len - sum > PACKET_LEN ? PACKET_LEN : len - sum;
+        if ((got = rio_readnr(connfd, buf, want)) < want)
+        {
+            *ret = got;
+            break;
+        }
+        sum += got;
+    }
+    while ((len < 0 || sum < len) && continueTest());
+    return sum;
+}
+
+// same as recvPlain, but also checks every received packet against the
+// pattern from fillPacketBuf().
+static long recvCheck(int connfd, char *buf, long len, int *ret)
+{
+    long sum = 0;
+    long i;
+    int want, got;
+
+    do
+    {
+        errno = 0;
+        want = len < 0 || len - sum > PACKET_LEN ? PACKET_LEN : len - sum;
+        if ((got = rio_readnr(connfd, buf, want)) < want)
+        {
+            *ret = got;
+            break;
+        }
+        for (i = 0; i < (got >> 3); ++i)
+        {
+            if (((long*)buf)[i] != i)
+            {
+                logFatal("Value error at %ld(got %ld, expected %ld)",
+                    sum + (i << 3), ((long*)buf)[i], i);
+            }
+        }
+        sum += got;
+    }
+    while ((len < 0 || sum < len) && continueTest());
+    return sum;
+}
+
+const testMode_t testModes[MODE_COUNT] = {
+    [MODE_BULK] = { "bulk", sendBulk, recvPlain, 0 },
+    [MODE_PROBE] = { "probe", sendBulk, recvPlain, 1 },
+    [MODE_CHECK] = { "check", sendBulk, recvCheck, 0 },
+    [MODE_TRICKLE] = { "trickle", sendTrickle, recvPlain, 1 },
+    [MODE_SLOW] = { "slow", sendSlow, recvPlain, 0 },
+};
+const testMode_t *testMode = testModes + MODE_BULK;
+
+int findTestMode(const char *name)
+{
+    int i;
+
+    for (i = 0; i < MODE_COUNT; ++i)
+    {
+        if (strcmp(name, testModes[i].name) == 0)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// fills the packet to send, check mode sends the indexes of the longs in the
+// packet.
+void fillPacketBuf(char *buf)
+{
+    long i;
+
+    if (testMode == testModes + MODE_CHECK)
+    {
+        for (i = 0; i < (PACKET_LEN >> 3); ++i)
+        {
+            ((long*)buf)[i] = i;
+        }
+    }
+    else
+    {
+        memset(buf, 0x10, PACKET_LEN);
+    }
+}
+
+void doLongTest(int connfd, int timelen, char *packetBuf)
+{
+    struct timeval st, ed;
+    long (*sendLoop)(int, char*, int*) = testMode->sendLoop;
+    long sum = 0;
+    int wrote = PACKET_LEN;
+    double elapsed;
+    cost_t cost;
+    char errbuf[256];
+
+    logVerbose("Start long test.");
+
+    alarmWithLog(timelen);
+
+    costStart();
+    resetRioStat();
+    gettimeofday(&st, NULL);
+    USDT2(test_start, "long", connfd);
+
+    sum = sendLoop(connfd, packetBuf, &wrote);
 
     gettimeofday(&ed, NULL);
+    costStop(&cost);
     elapsed = (ed.tv_sec - st.tv_sec) + (ed.tv_usec - st.tv_usec) / 1000000.0;
+    USDT4(test_done, "long", connfd, sum, (long)(elapsed * 1e6));
     alarmWithLog(0);
 
     if (wrote < PACKET_LEN)
@@ -67,55 +225,55 @@ void doLongTest(int connfd, int timelen, char *packetBuf)
     logMessage("->Bytes transferred: %ld", sum);
     logMessage("->Time elapsed : %lfs", elapsed);
     logMessage("->Bandwidth: %lfBytes/sec", sum / elapsed);
+    logCost(&cost, sum);
+    logRioStat();
+    setResult(sum, elapsed, &cost);
 }
 
-#ifdef PROBE
-void doProbe(int connfd, int sendInterval, int probeInterval, int size,
-    int loop, char *packetBuf)
-#else
-void doFixTest(int connfd, int maxtime, int len, char *packetBuf)
-#endif
+static long sendFix(int connfd, char *buf, int len, int *wrote)
+{
+    int left = len;
+    int ret;
+
+    while (left > 0 && continueTest())
+    {
+        int thislen = left > PACKET_LEN ? PACKET_LEN : left;
+
+        if ((ret = rio_writenr(connfd, buf, thislen)) < thislen)
+        {
+            *wrote = ret;
+            break;
+        }
+        left -= ret;
+    }
+    return len - left;
+}
+
+// sends loop probes of size packets of pktLen bytes, sendInterval(us) apart,
+// and waits probeInterval(us) after each probe.
+static long sendProbes(int connfd, char *buf, int sendInterval,
+    int probeInterval, int size, int loop, int pktLen, int *wrote)
 {
-#ifdef PROBE
-    int maxtime = 0;
     int len = loop * size;
-    sendInterval *= 1000;
-    probeInterval *= 1000;
     int ind = 0;
     int lc = 0;
-#endif
-    int targ = len;
-    struct timeval st, ed;
-    double elapsed;
-    int wrote = 0;
-    int thislen = 0;
-    char errbuf[256];
-
-    logVerbose("Start fix test.");
-
-    alarmWithLog(maxtime);
-    
-    // it's a virtual syscall on x64, so we assume it costs 
-    // less than 1us.
-    gettimeofday(&st, NULL);
+    int ret;
 
     while (len > 0 && continueTest())
     {
-#ifdef PROBE
-        int thislen = 1;
-#else
-        int thislen = len > PACKET_LEN ? PACKET_LEN : len;
-#endif
-        int wrote = rio_writenr(connfd, packetBuf, thislen);
+        int sleeplen;
 
-        if (wrote < thislen)
+        if (pktLen >= PROBE_STAMP_LEN)
+        {
+            putProbeStamp(buf);
+        }
+        if ((ret = rio_writenr(connfd, buf, pktLen)) < pktLen)
         {
+            *wrote = ret;
             break;
         }
-
-        len -= wrote;
-#ifdef PROBE
-        int sleeplen = len % size ? sendInterval : probeInterval;
+        --len;
+        sleeplen = len % size ? sendInterval : probeInterval;
         logVerboseL(2, "Probe packet %d:%d sent.", lc, ind);
         logVerboseL(2, "%d us before next probe packet...", sleeplen);
         if (++ind == size)
@@ -123,15 +281,48 @@ void doFixTest(int connfd, int maxtime, int len, char *packetBuf)
             ind = 0;
             ++lc;
         }
-        usleep(sleeplen);
-#endif
+        if (sleeplen > 0)
+        {
+            usleep(sleeplen);
+        }
     }
+    return (long)(loop * size - len) * pktLen;
+}
+
+static void fixTest(int connfd, int maxtime, int targ, char *packetBuf,
+    int sendInterval, int probeInterval, int size, int loop, int pktLen)
+{
+    struct timeval st, ed;
+    double elapsed;
+    long sent;
+    int wrote = 1;
+    const char *kind = loop > 0 ? "probe" : "fix";
+    cost_t cost;
+    char errbuf[256];
+
+    logVerbose("Start fix test.");
+
+    alarmWithLog(maxtime);
+    
+    costStart();
+    resetRioStat();
+    // it's a virtual syscall on x64, so we assume it costs 
+    // less than 1us.
+    gettimeofday(&st, NULL);
+    USDT2(test_start, kind, connfd);
+
+    // a probe test is a fix test sending loop * size bytes slowly.
+    sent = loop > 0 ? sendProbes(connfd, packetBuf, sendInterval,
+        probeInterval, size, loop, pktLen, &wrote) :
+        sendFix(connfd, packetBuf, targ, &wrote);
 
     gettimeofday(&ed, NULL);
+    costStop(&cost);
     alarmWithLog(0);
     elapsed = (ed.tv_sec - st.tv_sec) + (ed.tv_usec - st.tv_usec) / 1000000.0;
+    USDT4(test_done, kind, connfd, sent, (long)(elapsed * 1e6));
 
-    if (wrote < thislen)
+    if (sent < targ)
     {
         if (wrote < 0)
         {
@@ -150,23 +341,78 @@ void doFixTest(int connfd, int maxtime, int len, char *packetBuf)
         {
             logWarning("Send unexpectedly interrupted by signal.");
         }
-        len -= wrote;
     }
 
     logMessage("Fix test summary:");
     logMessage("->Bytes to transfer: %d", targ);
-    logMessage("->Bytes transferred: %d", targ - len);
-    logMessage("->Bandwidth: %lfBytes/sec", (targ - len) / elapsed);
+    logMessage("->Bytes transferred: %ld", sent);
+    logMessage("->Bandwidth: %lfBytes/sec", sent / elapsed);
     logMessage("->Time elapsed : %lfs", elapsed);
+    logCost(&cost, sent);
+    logRioStat();
+    setResult(sent, elapsed, &cost);
 }
 
-void doReceive(int connfd, int timelen, char *recvBuf)
+void doFixTest(int connfd, int maxtime, int len, char *packetBuf)
+{
+    fixTest(connfd, maxtime, len, packetBuf, 0, 0, 0, 0, 0);
+}
+
+// intervals are in ms.
+void doProbe(int connfd, int sendInterval, int probeInterval, int size,
+    int loop, int pktLen, char *packetBuf)
+{
+    fixTest(connfd, 0, loop * size * pktLen, packetBuf, sendInterval * 1000,
+        probeInterval * 1000, size, loop, pktLen);
+}
+
+// logs why a receive loop stopped early, ret is the short read.
+static void logReceiveEnd(int ret, int timelen)
 {
-    int ret;
     char errbuf[256];
+
+    if (ret < 0)
+    {
+        if (errno == EPIPE || errno == ECONNRESET)
+        {
+            logWarning("Connection broken(%s).", strerrorV(errno, errbuf));
+        }
+        else 
+        {
+            logError("Unexpected read error(%s)!", strerrorV(errno, errbuf));
+        }
+    }
+    else if (errno == EINTR)
+    {
+        if (!isLocked(&sigint))
+        {
+            logMessage("Ctrl+C received, terminate.");
+        }
+        else if (!isLocked(&sigalrm))
+        {
+            logMessage("Test timeout after %d seconds, terminate.", timelen);
+        }
+        else
+        {
+            logError("Interrupted by unexpected signal!");
+        }
+    }
+}
+
+void doReceive(int connfd, int timelen, char *recvBuf)
+{
+    doReceiveN(connfd, timelen, -1, recvBuf);
+}
+
+// receives until EOF, or until len bytes if len >= 0.
+void doReceiveN(int connfd, int timelen, long len, char *recvBuf)
+{
+    long (*recvLoop)(int, char*, long, int*) = testMode->recvLoop;
+    int ret = PACKET_LEN;
     double elapsed = 0;
     struct timeval st, ed;
     long byteReceived = 0;
+    cost_t cost;
 
 //    setsockopt(connfd, SOL_SOCKET, SO_RCVBUF,
 //        (const char*)&rwnd,sizeof(int));
@@ -174,72 +420,495 @@ void doReceive(int connfd, int timelen, char *recvBuf)
     logVerbose("Start receving data.");
     logVerbose("Timeout threshold is %d", timelen);
     alarmWithLog(timelen);
+    costStart();
+    resetRioStat();
     gettimeofday(&st, NULL);
-    do
+    USDT2(test_start, "recv", connfd);
+
+    byteReceived = recvLoop(connfd, recvBuf, len, &ret);
+
+    gettimeofday(&ed, NULL);
+    costStop(&cost);
+    alarmWithLog(0);
+
+    if (ret < PACKET_LEN)
     {
-#ifdef CHECK
-        long i;
-#endif
-        errno = 0;
-        if ((ret = rio_readnr(connfd, recvBuf, PACKET_LEN)) < PACKET_LEN)
+        logReceiveEnd(ret, timelen);
+        if (ret > 0)
         {
-            if (ret < 0)
-            {
-                if (errno == EPIPE || errno == ECONNRESET)
-                {
-                    logWarning("Connection broken(%s).", 
-                        strerrorV(errno, errbuf));
-                }
-                else 
-                {
-                    logError("Unexpected read error(%s)!", 
-                        strerrorV(errno, errbuf));
-                }
-            }
-            else
-            {
-                if (errno == EINTR)
-                {
-                    if (!isLocked(&sigint))
-                    {
-                        logMessage("Ctrl+C received, terminate.");
-                    }
-                    else if (!isLocked(&sigalrm))
-                    {
-                        logMessage("Test timeout after %d seconds, terminate.",
-                            timelen);
-                    }
-                    else
-                    {
-                        logError("Interrupted by unexpected signal!");
-                    }
-                }
-                byteReceived += ret;
-            }
-            break;
+            byteReceived += ret;
         }
+    }
+    
+    elapsed = (ed.tv_sec - st.tv_sec) + (ed.tv_usec - st.tv_usec) / 1000000.0;
+    USDT4(test_done, "recv", connfd, byteReceived, (long)(elapsed * 1e6));
+    logMessage("Test summary:");
+    logMessage("->Total time: %lfs", elapsed);
+    logMessage("->Bytes received: %ld", byteReceived);
+    logMessage("->Bandwidth: %lfBytes/sec", byteReceived / elapsed);
+    logCost(&cost, byteReceived);
+    logRioStat();
+    setResult(byteReceived, elapsed, &cost);
+    logMessage("Transfer complete.\n");
+}
 
-#ifdef CHECK
-        for (i = 0; i < (PACKET_LEN >> 3); ++i)
+// reads a probe packet of len bytes. the arrival time is the kernel's receive
+// time of the last byte if kernel is set, or the time the read returned.
+static int readProbe(int connfd, char *buf, int len, struct timespec *ts,
+    int kernel)
+{
+    char control[CMSG_SPACE(sizeof(struct timespec))];
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    int got = 0, ret;
+
+    while (got < len)
+    {
+        if (kernel)
+        {
+            memset(&msg, 0, sizeof(msg));
+            iov.iov_base = buf + got;
+            iov.iov_len = len - got;
+            msg.msg_iov = &iov;
+            msg.msg_iovlen = 1;
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+            ret = recvmsg(connfd, &msg, 0);
+        }
+        else
         {
-            if (((long*)recvBuf)[i] != i)
+            ret = backend->read(connfd, buf + got, len - got);
+        }
+        if (ret <= 0)
+        {
+            return ret < 0 ? -1 : got;
+        }
+        got += ret;
+        liveReceived(ret);
+        traceBytes(ret);
+        // both clocks are realtime, so the arrivals can be compared even if
+        // the kernel leaves out a timestamp.
+        clock_gettime(CLOCK_REALTIME, ts);
+        for (cmsg = kernel ? CMSG_FIRSTHDR(&msg) : NULL; cmsg;
+             cmsg = CMSG_NXTHDR(&msg, cmsg))
+        {
+            if (cmsg->cmsg_level == SOL_SOCKET &&
+                cmsg->cmsg_type == SCM_TIMESTAMPNS)
             {
-                logFatal("Value error at %ld(got %ld, expected %ld)", 
-                    byteReceived + (i << 3), ((long*)recvBuf)[i], i);
+                memcpy(ts, CMSG_DATA(cmsg), sizeof(struct timespec));
             }
         }
-#endif
+    }
+    return got;
+}
+
+// receives loop probes of size packets of pktLen bytes, and estimates the
+// capacity and available bandwidth of the path from their arrival times.
+// sendInterval(ms) is the gap the sender leaves between packets of a probe.
+void doProbeReceive(int connfd, int timelen, int sendInterval, int size,
+    int loop, int pktLen, char *recvBuf)
+{
+    struct timespec *ts, *sent = NULL;
+    struct timeval st, ed;
+    double elapsed;
+    long byteReceived = 0;
+    int count = loop * size;
+    int i, ret = pktLen;
+    int on = 1;
+    int kernel;
+    cost_t cost;
+
+    if ((ts = malloc(sizeof(struct timespec) * (count > 0 ? count : 1)))
+        == NULL || (pktLen >= PROBE_STAMP_LEN && (sent =
+        malloc(sizeof(struct timespec) * (count > 0 ? count : 1))) == NULL))
+    {
+        failExit("malloc");
+    }
+    // kernel timestamps leave out the scheduling delay of the receiver, but
+    // only the kernel stack has them.
+    kernel = strcmp(backend->name, "kernel") == 0 &&
+        backend->setsockopt(connfd, SOL_SOCKET, SO_TIMESTAMPNS, &on,
+        sizeof(on)) == 0;
+    logVerbose("Start receiving probes, timestamps from %s.",
+        kernel ? "the kernel" : "the receiver");
+    alarmWithLog(timelen);
+    costStart();
+    gettimeofday(&st, NULL);
+    USDT2(test_start, "recv", connfd);
+
+    for (i = 0; i < count && continueTest(); ++i)
+    {
+        errno = 0;
+        if ((ret = readProbe(connfd, recvBuf, pktLen, ts + i, kernel))
+            < pktLen)
+        {
+            break;
+        }
         byteReceived += ret;
+        if (sent)
+        {
+            getProbeStamp(recvBuf, sent + i);
+        }
+        logVerboseL(2, "Probe packet %d:%d received.", i / size, i % size);
     }
-    while (continueTest());
 
     gettimeofday(&ed, NULL);
+    costStop(&cost);
     alarmWithLog(0);
-    
+
+    if (ret < pktLen)
+    {
+        logReceiveEnd(ret, timelen);
+        if (ret > 0)
+        {
+            byteReceived += ret;
+        }
+    }
+
     elapsed = (ed.tv_sec - st.tv_sec) + (ed.tv_usec - st.tv_usec) / 1000000.0;
+    USDT4(test_done, "recv", connfd, byteReceived, (long)(elapsed * 1e6));
     logMessage("Test summary:");
     logMessage("->Total time: %lfs", elapsed);
     logMessage("->Bytes received: %ld", byteReceived);
     logMessage("->Bandwidth: %lfBytes/sec", byteReceived / elapsed);
+    logCost(&cost, byteReceived);
+    logTrainAnalysis(sent, ts, i, size, pktLen, sendInterval * 1000);
+    setResult(byteReceived, elapsed, &cost);
+    free(ts);
+    free(sent);
     logMessage("Transfer complete.\n");
 }
+
+static void addCost(cost_t *sum, const cost_t *cost)
+{
+    sum->utime += cost->utime;
+    sum->stime += cost->stime;
+    sum->nvcsw += cost->nvcsw;
+    sum->nivcsw += cost->nivcsw;
+    sum->cycles = sum->cycles < 0 || cost->cycles < 0 ?
+        -1 : sum->cycles + cost->cycles;
+    sum->instructions = sum->instructions < 0 || cost->instructions < 0 ?
+        -1 : sum->instructions + cost->instructions;
+}
+
+// runs the tests of a session one after another on the same connection until
+// test() returns 0, then logs the per-test and total results. the total is
+// also left in lastResult.
+void doSession(int connfd, int (*test)(int connfd))
+{
+    struct timeval st, ed;
+    result_t sum;
+    int count = 0;
+    double minTime = 0, maxTime = 0, testTime = 0;
+
+    memset(&sum, 0, sizeof(sum));
+    gettimeofday(&st, NULL);
+    while (continueTest())
+    {
+        // a timeout only ends the test it happened in.
+        setLock(&sigalrm);
+        if (test(connfd) <= 0)
+        {
+            break;
+        }
+        ++count;
+        sum.bytes += lastResult.bytes;
+        addCost(&sum.cost, &lastResult.cost);
+        testTime += lastResult.elapsed;
+        if (count == 1 || lastResult.elapsed < minTime)
+        {
+            minTime = lastResult.elapsed;
+        }
+        if (lastResult.elapsed > maxTime)
+        {
+            maxTime = lastResult.elapsed;
+        }
+    }
+    gettimeofday(&ed, NULL);
+    sum.elapsed = (ed.tv_sec - st.tv_sec) +
+        (ed.tv_usec - st.tv_usec) / 1000000.0;
+
+    logMessage("Session summary:");
+    logMessage("->Tests: %d", count);
+    logMessage("->Bytes transferred: %ld", sum.bytes);
+    logMessage("->Time elapsed: %lfs", sum.elapsed);
+    if (count > 0)
+    {
+        logMessage("->Test time: min %lfs, avg %lfs, max %lfs", minTime,
+            testTime / count, maxTime);
+        logMessage("->Time between tests: avg %lfs",
+            (sum.elapsed - testTime) / count);
+    }
+    logMessage("->Bandwidth: %lfBytes/sec",
+        sum.elapsed > 0 ? sum.bytes / sum.elapsed : 0);
+    logCost(&sum.cost, sum.bytes);
+    lastResult = sum;
+}
+
+// runs every test of the plan as many times as it repeats, one after another,
+// until test() returns 0, then logs the results of each test of the plan.
+void doPlan(const plan_t *plan, int (*test)(const planTest_t *test))
+{
+    struct timeval st, ed;
+    result_t sums[MAX_PLAN];
+    double minTime[MAX_PLAN], maxTime[MAX_PLAN], testTime = 0, elapsed;
+    int runs[MAX_PLAN];
+    int run = 0, total = planRuns(plan), ok = 1;
+    int i, j;
+    char desc[64];
+
+    memset(sums, 0, sizeof(sums));
+    memset(runs, 0, sizeof(runs));
+    gettimeofday(&st, NULL);
+    for (i = 0; i < plan->count && ok; ++i)
+    {
+        formatTest(plan->tests + i, desc);
+        // a timeout only ends the test it happened in, SIGINT the plan.
+        for (j = 0; j < plan->tests[i].repeat && ok && isLocked(&sigint);
+             ++j)
+        {
+            logMessage("Plan test #%d of %d(%s):", ++run, total, desc);
+            setLock(&sigalrm);
+            if ((ok = test(plan->tests + i)) <= 0)
+            {
+                break;
+            }
+            sums[i].bytes += lastResult.bytes;
+            sums[i].elapsed += lastResult.elapsed;
+            addCost(&sums[i].cost, &lastResult.cost);
+            testTime += lastResult.elapsed;
+            if (runs[i]++ == 0 || lastResult.elapsed < minTime[i])
+            {
+                minTime[i] = lastResult.elapsed;
+            }
+            if (runs[i] == 1 || lastResult.elapsed > maxTime[i])
+            {
+                maxTime[i] = lastResult.elapsed;
+            }
+        }
+    }
+    gettimeofday(&ed, NULL);
+    elapsed = (ed.tv_sec - st.tv_sec) + (ed.tv_usec - st.tv_usec) / 1000000.0;
+
+    logMessage("Plan summary:");
+    for (i = 0, run = 0; i < plan->count; ++i)
+    {
+        formatTest(plan->tests + i, desc);
+        run += runs[i];
+        if (runs[i] == 0)
+        {
+            logMessage("->#%d %s: not run", i + 1, desc);
+            continue;
+        }
+        logMessage("->#%d %s: %d runs, %ld Bytes, %lfBytes/sec, test time "
+            "min %lfs, avg %lfs, max %lfs", i + 1, desc, runs[i],
+            sums[i].bytes, sums[i].elapsed > 0 ?
+            sums[i].bytes / sums[i].elapsed : 0, minTime[i],
+            sums[i].elapsed / runs[i], maxTime[i]);
+    }
+    logMessage("->Tests: %d of %d in %lfs", run, total, elapsed);
+    if (run > 0)
+    {
+        logMessage("->Time between tests: avg %lfs",
+            (elapsed - testTime) / run);
+    }
+}
+
+int encodeResults(const result_t *result, char *buf)
+{
+    uint32_t magic = htonl(RESULTS_MAGIC);
+    char *p = buf + 4;
+
+    memcpy(buf, &magic, 4);
+    p = put64(p, result->bytes);
+    p = put64(p, (long)(result->elapsed * 1e6 + 0.5));
+    p = put64(p, (long)(result->cost.utime * 1e6 + 0.5));
+    p = put64(p, (long)(result->cost.stime * 1e6 + 0.5));
+    p = put64(p, result->cost.nvcsw);
+    p = put64(p, result->cost.nivcsw);
+    p = put64(p, result->cost.cycles);
+    p = put64(p, result->cost.instructions);
+    p = put64(p, result->retrans);
+    p = put64(p, result->rtt);
+    return p - buf;
+}
+
+int decodeResults(result_t *result, const char *buf)
+{
+    uint32_t magic;
+    const char *p = buf + 4;
+    long us;
+
+    memcpy(&magic, buf, 4);
+    if (ntohl(magic) != RESULTS_MAGIC)
+    {
+        return -1;
+    }
+    p = get64(p, &result->bytes);
+    p = get64(p, &us);
+    result->elapsed = us / 1e6;
+    p = get64(p, &us);
+    result->cost.utime = us / 1e6;
+    p = get64(p, &us);
+    result->cost.stime = us / 1e6;
+    p = get64(p, &result->cost.nvcsw);
+    p = get64(p, &result->cost.nivcsw);
+    p = get64(p, &result->cost.cycles);
+    p = get64(p, &result->cost.instructions);
+    p = get64(p, &result->retrans);
+    get64(p, &result->rtt);
+    return 0;
+}
+
+// forwards a signal to the processes of other streams, safe to call in a
+// signal handler.
+void signalStreams(int sig)
+{
+    int i;
+
+    for (i = 1; i < streamCount; ++i)
+    {
+        if (streamPID[i] > 0)
+        {
+            kill(streamPID[i], sig);
+        }
+    }
+}
+
+// result of a stream and when it was done, relative to the start of
+// doParallel.
+typedef struct
+{
+    result_t result;
+    double done;
+} streamResult_t;
+
+static inline double sinceTime(const struct timeval *st)
+{
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    return (now.tv_sec - st->tv_sec) + (now.tv_usec - st->tv_usec) / 1e6;
+}
+
+// runs test() on each stream in its own process, then logs the throughput of
+// each stream and the aggregate, which is also left in lastResult, and when
+// the first and the last stream were done. closes all the streams.
+void doParallel(int n, int *fds, char **names, void (*test)(int connfd))
+{
+    streamResult_t *results;
+    result_t sum;
+    struct timeval st;
+    double first = 0, last = 0;
+    int64_t closing;
+    int i, j;
+    char errbuf[256];
+
+    results = mmap(NULL, sizeof(streamResult_t) * n, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (results == MAP_FAILED)
+    {
+        failExit("mmap");
+    }
+    memset(results, 0, sizeof(streamResult_t) * n);
+    gettimeofday(&st, NULL);
+
+    streamCount = 1;
+    for (i = 1; i < n; ++i)
+    {
+        if ((streamPID[i] = fork()) < 0)
+        {
+            logError("Can't start stream #%d(%s)!", i,
+                strerrorV(errno, errbuf));
+            backend->close(fds[i]);
+            fds[i] = -1;
+            streamPID[i] = 0;
+        }
+        else if (streamPID[i] == 0)
+        {
+            // keep only our own stream, so the others see EOF as soon as
+            // their own process closes them.
+            streamCount = 0;
+            for (j = 0; j < n; ++j)
+            {
+                if (j != i && fds[j] >= 0)
+                {
+                    backend->close(fds[j]);
+                }
+            }
+            logMessage("Stream #%d(%s) started in process %d.", i, names[i],
+                getpid());
+            traceStreamStart(i);
+            test(fds[i]);
+            traceStreamEnd();
+            results[i].result = lastResult;
+            results[i].done = sinceTime(&st);
+            closing = traceNow();
+            backend->close(fds[i]);
+            traceSpan(TRACE_CLOSE, i, closing);
+            exit(0);
+        }
+        else
+        {
+            backend->close(fds[i]);
+            streamCount = i + 1;
+        }
+    }
+
+    traceStreamStart(0);
+    test(fds[0]);
+    traceStreamEnd();
+    results[0].result = lastResult;
+    results[0].done = sinceTime(&st);
+    closing = traceNow();
+    backend->close(fds[0]);
+    traceSpan(TRACE_CLOSE, 0, closing);
+
+    for (i = 1; i < n; ++i)
+    {
+        if (streamPID[i] > 0)
+        {
+            while (waitpid(streamPID[i], NULL, 0) < 0 && errno == EINTR);
+        }
+    }
+    streamCount = 0;
+
+    memset(&sum, 0, sizeof(sum));
+    logMessage("Parallel test summary:");
+    for (i = 0; i < n; ++i)
+    {
+        result_t *r = &results[i].result;
+
+        logMessage("->Stream #%d(%s): %ld Bytes in %lfs, %lfBytes/sec", i,
+            names[i], r->bytes, r->elapsed,
+            r->elapsed > 0 ? r->bytes / r->elapsed : 0);
+        sum.bytes += r->bytes;
+        if (r->elapsed > sum.elapsed)
+        {
+            sum.elapsed = r->elapsed;
+        }
+        addCost(&sum.cost, &r->cost);
+        sum.retrans += r->retrans;
+        if (r->rtt > sum.rtt)
+        {
+            sum.rtt = r->rtt;
+        }
+        // streams that couldn't be started were never done.
+        if (results[i].done > 0 && (first == 0 || results[i].done < first))
+        {
+            first = results[i].done;
+        }
+        if (results[i].done > last)
+        {
+            last = results[i].done;
+        }
+    }
+    logMessage("->Aggregate: %ld Bytes in %lfs, %lfBytes/sec", sum.bytes,
+        sum.elapsed, sum.elapsed > 0 ? sum.bytes / sum.elapsed : 0);
+    logMessage("->Streams done: first after %lfs, last after %lfs", first,
+        last);
+    logCost(&sum.cost, sum.bytes);
+    lastResult = sum;
+    munmap(results, sizeof(streamResult_t) * n);
+}
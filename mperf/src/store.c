@@ -0,0 +1,276 @@
+#include <sys/file.h>
+
+#include "store.h"
+#include "util.h"
+
+_Static_assert(sizeof(storeHeader_t) == STORE_HEADER,
+    "storeHeader_t isn't STORE_HEADER Bytes");
+_Static_assert(sizeof(storeRecord_t) == STORE_RECORD,
+    "storeRecord_t isn't STORE_RECORD Bytes");
+
+// the records being sorted, qsort() has no argument for them.
+static const storeRecord_t *sorting;
+
+static inline uint64_t fnv(uint64_t hash, const void *data, size_t len)
+{
+    const unsigned char *p = data;
+    size_t i;
+
+    for (i = 0; i < len; ++i)
+    {
+        hash = (hash ^ p[i]) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+// strings are hashed up to their end, so that the garbage after it doesn't
+// count.
+uint64_t configHash(const storeRecord_t *record)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    hash = fnv(hash, record->host, strnlen(record->host, STORE_NAME));
+    hash = fnv(hash, "", 1);
+    hash = fnv(hash, record->path, strnlen(record->path, STORE_NAME));
+    hash = fnv(hash, "", 1);
+    hash = fnv(hash, record->backend,
+        strnlen(record->backend, sizeof(record->backend)));
+    hash = fnv(hash, "", 1);
+    // type to options, 32-bit integers in a row.
+    return fnv(hash, &record->type, 8 * sizeof(int32_t));
+}
+
+static int checkHeader(const storeHeader_t *header)
+{
+    if (header->magic != STORE_MAGIC || header->version != STORE_VERSION ||
+        header->recordLen != STORE_RECORD)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
+static int writeAll(int fd, const void *buf, size_t len, off_t offset)
+{
+    ssize_t n;
+
+    while (len > 0)
+    {
+        if ((n = pwrite(fd, buf, len, offset)) < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        buf = (const char*)buf + n;
+        len -= n;
+        offset += n;
+    }
+    return 0;
+}
+
+int appendRecord(const char *path, storeRecord_t *record)
+{
+    storeHeader_t header;
+    struct stat st;
+    off_t end;
+    ssize_t n;
+    int fd, be;
+
+    record->magic = STORE_MAGIC;
+    record->version = STORE_VERSION;
+    record->config = configHash(record);
+    if ((fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644)) < 0)
+    {
+        return -1;
+    }
+    if (flock(fd, LOCK_EX) < 0 || fstat(fd, &st) < 0)
+    {
+        goto appendRecord_out;
+    }
+    if (st.st_size == 0)
+    {
+        memset(&header, 0, sizeof(header));
+        header.magic = STORE_MAGIC;
+        header.version = STORE_VERSION;
+        header.recordLen = STORE_RECORD;
+        header.created = nowUS();
+        if (writeAll(fd, &header, sizeof(header), 0) < 0)
+        {
+            goto appendRecord_out;
+        }
+        st.st_size = STORE_HEADER;
+    }
+    else if ((n = pread(fd, &header, sizeof(header), 0)) < 0)
+    {
+        goto appendRecord_out;
+    }
+    else if (n != sizeof(header) || checkHeader(&header) < 0)
+    {
+        errno = EINVAL;
+        goto appendRecord_out;
+    }
+    // over a record cut short, if any.
+    end = STORE_HEADER +
+        (st.st_size - STORE_HEADER) / STORE_RECORD * STORE_RECORD;
+    if (writeAll(fd, record, sizeof(*record), end) < 0)
+    {
+        goto appendRecord_out;
+    }
+    return close(fd);
+
+appendRecord_out:
+    be = errno;
+    close(fd);
+    errno = be;
+    return -1;
+}
+
+static int compareConfig(const void *a, const void *b)
+{
+    const storeRecord_t *x = sorting + *(const int*)a;
+    const storeRecord_t *y = sorting + *(const int*)b;
+
+    if (x->config != y->config)
+    {
+        return x->config < y->config ? -1 : 1;
+    }
+    if (x->start != y->start)
+    {
+        return x->start < y->start ? -1 : 1;
+    }
+    return *(const int*)a - *(const int*)b;
+}
+
+static int compareTime(const void *a, const void *b)
+{
+    const storeRecord_t *x = sorting + *(const int*)a;
+    const storeRecord_t *y = sorting + *(const int*)b;
+
+    if (x->start != y->start)
+    {
+        return x->start < y->start ? -1 : 1;
+    }
+    return *(const int*)a - *(const int*)b;
+}
+
+// records that aren't records of this version are left out of the indexes.
+int openStore(store_t *store, const char *path)
+{
+    struct stat st;
+    int fd, be, total, i;
+
+    memset(store, 0, sizeof(*store));
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+    {
+        return -1;
+    }
+    if (fstat(fd, &st) < 0)
+    {
+        be = errno;
+        close(fd);
+        errno = be;
+        return -1;
+    }
+    if (st.st_size < STORE_HEADER)
+    {
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+    store->len = st.st_size;
+    store->map = mmap(NULL, store->len, PROT_READ, MAP_SHARED, fd, 0);
+    be = errno;
+    close(fd);
+    if (store->map == MAP_FAILED)
+    {
+        store->map = NULL;
+        errno = be;
+        return -1;
+    }
+    if (checkHeader(store->map) < 0)
+    {
+        closeStore(store);
+        errno = EINVAL;
+        return -1;
+    }
+    store->records = (const storeRecord_t*)((char*)store->map +
+        STORE_HEADER);
+    total = (store->len - STORE_HEADER) / STORE_RECORD;
+    store->byConfig = malloc(sizeof(int) * (total + 1));
+    store->byTime = malloc(sizeof(int) * (total + 1));
+    if (store->byConfig == NULL || store->byTime == NULL)
+    {
+        closeStore(store);
+        errno = ENOMEM;
+        return -1;
+    }
+    for (i = 0; i < total; ++i)
+    {
+        if (store->records[i].magic == STORE_MAGIC &&
+            store->records[i].version == STORE_VERSION)
+        {
+            store->byConfig[store->count] = i;
+            store->byTime[store->count++] = i;
+        }
+    }
+    sorting = store->records;
+    qsort(store->byConfig, store->count, sizeof(int), compareConfig);
+    qsort(store->byTime, store->count, sizeof(int), compareTime);
+    return 0;
+}
+
+void closeStore(store_t *store)
+{
+    if (store->map != NULL)
+    {
+        munmap(store->map, store->len);
+    }
+    free(store->byConfig);
+    free(store->byTime);
+    memset(store, 0, sizeof(*store));
+}
+
+int findConfig(const store_t *store, uint64_t config, int *first)
+{
+    int lo = 0, hi = store->count, mid, end;
+
+    while (lo < hi)
+    {
+        mid = lo + (hi - lo) / 2;
+        if (store->records[store->byConfig[mid]].config < config)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    for (end = lo; end < store->count &&
+         store->records[store->byConfig[end]].config == config; ++end);
+    *first = lo;
+    return end - lo;
+}
+
+int findSince(const store_t *store, const int *index, int n, int64_t since)
+{
+    int lo = 0, hi = n, mid;
+
+    while (lo < hi)
+    {
+        mid = lo + (hi - lo) / 2;
+        if (store->records[index[mid]].start < since)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    return lo;
+}
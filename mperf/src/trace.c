@@ -0,0 +1,260 @@
+#include <endian.h>
+
+#include "trace.h"
+#include "util.h"
+
+typedef struct
+{
+    int count;
+    traceEvent_t events[MAX_TRACE];
+} trace_t;
+
+int traceArmed = 0;
+static trace_t *trace = NULL;
+// the stream of this process, and its first read or write.
+static int traceStream = 0;
+static int64_t firstAt = 0;
+
+static const char *phaseNames[TRACE_PHASES] = { "dial", "request", "accept",
+    "queue", "terminate", "fork", "configure", "ready", "reply", "connect",
+    "data", "close", "results" };
+
+int64_t traceNow()
+{
+    return monotonicUS();
+}
+
+void initTrace()
+{
+    if (trace != NULL)
+    {
+        munmap(trace, sizeof(trace_t));
+    }
+    trace = mmap(NULL, sizeof(trace_t), PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (trace == MAP_FAILED)
+    {
+        failExit("mmap");
+    }
+    trace->count = 0;
+}
+
+void resetTrace()
+{
+    if (trace != NULL)
+    {
+        __atomic_store_n(&trace->count, 0, __ATOMIC_RELAXED);
+    }
+}
+
+// the events past MAX_TRACE are dropped.
+void traceEvent(int phase, int stream, int64_t begin, int64_t end)
+{
+    traceEvent_t *e;
+    int i;
+
+    if (trace == NULL ||
+        (i = __atomic_fetch_add(&trace->count, 1, __ATOMIC_RELAXED)) >=
+        MAX_TRACE)
+    {
+        return;
+    }
+    e = trace->events + i;
+    e->phase = phase;
+    e->stream = stream;
+    e->begin = begin;
+    e->end = end;
+}
+
+void traceFirstByte()
+{
+    traceArmed = 0;
+    firstAt = traceNow();
+}
+
+void traceStreamStart(int stream)
+{
+    if (trace != NULL)
+    {
+        traceStream = stream;
+        firstAt = 0;
+        traceArmed = 1;
+    }
+}
+
+void traceStreamEnd()
+{
+    traceArmed = 0;
+    if (firstAt > 0)
+    {
+        traceSpan(TRACE_DATA, traceStream, firstAt);
+        firstAt = 0;
+    }
+}
+
+static inline int traceCount()
+{
+    int n = trace ? __atomic_load_n(&trace->count, __ATOMIC_RELAXED) : 0;
+
+    return n < MAX_TRACE ? n : MAX_TRACE;
+}
+
+int encodeTrace(char *buf)
+{
+    const traceEvent_t *e;
+    char *p = buf;
+    int i, n = traceCount();
+
+    p = put32(p, n);
+    for (i = 0; i < n; ++i)
+    {
+        e = trace->events + i;
+        p = put32(p, e->phase);
+        p = put32(p, e->stream);
+        p = put64(p, e->begin);
+        p = put64(p, e->end);
+    }
+    return p - buf;
+}
+
+int decodeTraceHeader(const char *buf)
+{
+    int32_t n;
+
+    get32(buf, &n);
+    return n >= 0 && n <= MAX_TRACE ? n : -1;
+}
+
+void decodeTraceEvents(const char *buf, int count, traceEvent_t *events)
+{
+    const char *p = buf;
+    int i;
+
+    for (i = 0; i < count; ++i)
+    {
+        p = get32(p, &events[i].phase);
+        p = get32(p, &events[i].stream);
+        p = get64(p, &events[i].begin);
+        p = get64(p, &events[i].end);
+    }
+}
+
+int encodeTraceClock(char *buf, int64_t received)
+{
+    return put64(put64(buf, received), traceNow()) - buf;
+}
+
+int64_t decodeTraceClock(const char *buf, int64_t asked, int64_t *rtt)
+{
+    int64_t received, sent, now = traceNow();
+
+    get64(get64(buf, &received), &sent);
+    // the time the server held the byte isn't part of the round trip.
+    *rtt = now - asked - (sent - received);
+    return (received - asked + sent - now) / 2;
+}
+
+static inline const char *separator(int *first)
+{
+    const char *s = *first ? "" : ",";
+
+    *first = 0;
+    return s;
+}
+
+static void writeEvents(FILE *f, const traceEvent_t *events, int n, int pid,
+    int64_t base, int *first)
+{
+    const traceEvent_t *e;
+    const char *name;
+    int i;
+
+    for (i = 0; i < n; ++i)
+    {
+        e = events + i;
+        name = e->phase >= 0 && e->phase < TRACE_PHASES ?
+            phaseNames[e->phase] : "unknown";
+        fprintf(f, "%s\n{\"name\":\"%s\",\"cat\":\"%s\",\"pid\":%d,"
+            "\"tid\":%d,\"ts\":%lld", separator(first), name,
+            pid == 1 ? "client" : "server", pid, e->stream + 1,
+            (long long)(e->begin - base));
+        if (e->end > e->begin)
+        {
+            fprintf(f, ",\"ph\":\"X\",\"dur\":%lld}",
+                (long long)(e->end - e->begin));
+        }
+        else
+        {
+            fprintf(f, ",\"ph\":\"i\",\"s\":\"t\"}");
+        }
+    }
+}
+
+static void writeNames(FILE *f, const traceEvent_t *events, int n, int pid,
+    int *first)
+{
+    int seen[MAX_STREAMS + 1] = { 0 };
+    int i, tid;
+
+    fprintf(f, "%s\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,"
+        "\"args\":{\"name\":\"mperf-%s\"}}", separator(first), pid,
+        pid == 1 ? "client" : "server");
+    for (i = 0; i < n; ++i)
+    {
+        tid = events[i].stream + 1;
+        if (tid < 0 || tid > MAX_STREAMS || seen[tid])
+        {
+            continue;
+        }
+        seen[tid] = 1;
+        if (tid == 0)
+        {
+            fprintf(f, ",\n{\"name\":\"thread_name\",\"ph\":\"M\","
+                "\"pid\":%d,\"tid\":0,\"args\":{\"name\":\"control\"}}", pid);
+        }
+        else
+        {
+            fprintf(f, ",\n{\"name\":\"thread_name\",\"ph\":\"M\","
+                "\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"stream #%d\"}}",
+                pid, tid, tid - 1);
+        }
+    }
+}
+
+// the trace starts with the earliest event, the server's events are moved
+// onto the client's clock.
+int writeTrace(const char *path, const traceEvent_t *server, int count,
+    int64_t offset)
+{
+    static traceEvent_t shifted[MAX_TRACE];
+    const traceEvent_t *client = trace ? trace->events : NULL;
+    int n = traceCount(), first = 1, i;
+    int64_t base = INT64_MAX;
+    FILE *f;
+
+    for (i = 0; i < count; ++i)
+    {
+        shifted[i] = server[i];
+        shifted[i].begin -= offset;
+        shifted[i].end -= offset;
+    }
+    for (i = 0; i < n; ++i)
+    {
+        base = client[i].begin < base ? client[i].begin : base;
+    }
+    for (i = 0; i < count; ++i)
+    {
+        base = shifted[i].begin < base ? shifted[i].begin : base;
+    }
+    if ((f = fopen(path, "w")) == NULL)
+    {
+        return -1;
+    }
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    writeEvents(f, client, n, 1, base, &first);
+    writeEvents(f, shifted, count, 2, base, &first);
+    writeNames(f, client, n, 1, &first);
+    writeNames(f, shifted, count, 2, &first);
+    fprintf(f, "\n]}\n");
+    return fclose(f) == 0 ? 0 : -1;
+}
@@ -0,0 +1,146 @@
+#include "train.h"
+#include "util.h"
+
+// a gap that grew by less than this fraction on the path means that the
+// packets didn't queue anywhere.
+#define NO_QUEUEING 0.95
+
+static inline double elapsed(const struct timespec *st,
+    const struct timespec *ed)
+{
+    return (ed->tv_sec - st->tv_sec) + (ed->tv_nsec - st->tv_nsec) / 1e9;
+}
+
+// time between packets i and j when they were sent.
+static inline double sendGap(const struct timespec *sent, int i, int j,
+    int gap)
+{
+    return sent ? elapsed(sent + i, sent + j) : (j - i) * gap / 1e6;
+}
+
+// a pair that queued behind each other at the bottleneck leaves it len / C
+// apart, so the capacity is the median rate of those pairs. a train sent at
+// rate Ri > A leaves the path at Ro = Ri * C / (Ri + C - A), which gives the
+// available bandwidth A = C + Ri - C * Ri / Ro. trains that didn't queue
+// only tell that A >= Ri.
+void logTrainAnalysis(const struct timespec *sent,
+    const struct timespec *recv, int count, int size, int len, int gap)
+{
+    double *pairs;
+    double in, out, duration, capacity;
+    double availSum = 0, bound = 0, inMax = 0;
+    double outSum = 0, outMin = 0, outMax = 0;
+    int npairs = 0, trains = 0, queued = 0;
+    int i, j, end;
+
+    logMessage("Probe train analysis:");
+    if (count < 2 || size < 2)
+    {
+        logMessage("->Not enough packets(%d received, %d per train), need "
+            "at least 2 per train.", count, size);
+        return;
+    }
+    if ((pairs = malloc(sizeof(double) * count)) == NULL)
+    {
+        failExit("malloc");
+    }
+
+    for (i = 0; i < count; i = end)
+    {
+        end = i + size < count ? i + size : count;
+        for (j = i + 1; j < end; ++j)
+        {
+            // packets read together have no useful gap.
+            if ((duration = elapsed(recv + j - 1, recv + j)) > 0 &&
+                sendGap(sent, j - 1, j, gap) < duration * NO_QUEUEING)
+            {
+                pairs[npairs++] = len / duration;
+            }
+        }
+        if (end - i < 2 || (duration = elapsed(recv + i, recv + end - 1)) <= 0)
+        {
+            continue;
+        }
+        out = (double)(end - i - 1) * len / duration;
+        if (trains == 0 || out < outMin)
+        {
+            outMin = out;
+        }
+        if (out > outMax)
+        {
+            outMax = out;
+        }
+        outSum += out;
+        ++trains;
+    }
+
+    duration = elapsed(recv, recv + count - 1);
+    logMessage("->Packets: %d in %d trains, %d Bytes each, send times %s",
+        count, (count + size - 1) / size, len,
+        sent ? "from the sender" : "assumed from the sending interval");
+    logMessage("->Probe load: %lfBytes/sec over %lfs",
+        duration > 0 ? (double)count * len / duration : 0, duration);
+    if (trains == 0)
+    {
+        logMessage("->All packets of a train arrived at once, can't "
+            "estimate(try larger packets).");
+        free(pairs);
+        return;
+    }
+    logMessage("->Train output rate: avg %lf, min %lf, max %lfBytes/sec",
+        outSum / trains, outMin, outMax);
+    if (npairs == 0)
+    {
+        // nothing queued, so the path is faster than the fastest train.
+        logMessage("->Capacity: >= %lfBytes/sec(no packet pair queued, "
+            "send back-to-back with -i 0)", outMax);
+        logMessage("->Available bandwidth: >= %lfBytes/sec", outMax);
+        free(pairs);
+        return;
+    }
+    qsort(pairs, npairs, sizeof(double), compareDouble);
+    capacity = pairs[npairs / 2];
+    logMessage("->Capacity(median of %d queued packet pairs): "
+        "%lfBytes/sec", npairs, capacity);
+
+    for (i = 0; i < count; i += size)
+    {
+        end = i + size < count ? i + size : count;
+        if (end - i < 2 || (duration = elapsed(recv + i, recv + end - 1)) <= 0)
+        {
+            continue;
+        }
+        out = (double)(end - i - 1) * len / duration;
+        // back-to-back trains without send times enter the path at least
+        // at the capacity.
+        in = sendGap(sent, i, end - 1, gap) > 0 ?
+            (end - i - 1) * len / sendGap(sent, i, end - 1, gap) : capacity;
+        if (in > inMax)
+        {
+            inMax = in;
+        }
+        if (out >= in * NO_QUEUEING)
+        {
+            bound = in > bound ? in : bound;
+            continue;
+        }
+        availSum += capacity + in - capacity * in / out;
+        ++queued;
+    }
+
+    logMessage("->Train input rate: max %lfBytes/sec", inMax);
+    if (queued == 0)
+    {
+        logMessage("->Available bandwidth: >= %lfBytes/sec(no train queued, "
+            "probe faster to narrow it down)", bound);
+    }
+    else
+    {
+        availSum /= queued;
+        availSum = availSum < bound ? bound : availSum;
+        availSum = availSum > capacity ? capacity : availSum;
+        logMessage("->Available bandwidth: %lfBytes/sec(from %d queued "
+            "trains)", availSum, queued);
+    }
+    free(pairs);
+}
@@ -82,11 +82,11 @@ static void initConnection()
 
 	memset(&clientInfo, 0, sizeof(clientInfo));
 	memset(&serverInfo, 0, sizeof(serverInfo));
-	close(connfd);
+	backend->close(connfd);
 
 	for (; attempt <= MAX_ATTEMPT; ++attempt)
 	{
-		if ((connfd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) == -1)
+		if ((connfd = backend->socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) == -1)
 		{
 			logError("Attempt #%d failed(%s): Can't create socket!", attempt,
 				strerrorV(errno, errbuf));
@@ -104,7 +104,7 @@ static void initConnection()
 			logFatal("Invalid server IP!");
 		}
 
-		if (bind(connfd, (struct sockaddr*)&serverInfo, len) == -1)
+		if (backend->bind(connfd, (struct sockaddr*)&serverInfo, len) == -1)
 		{
 			logError("Attempt %d failed(%s): Can't bind to port!", attempt,
 				strerrorV(errno, errbuf));
@@ -146,7 +146,7 @@ int main(int argc, char **argv)
 			reinit = 0;
 		}
 		
-		if ((size = recvfrom(connfd, recvBuf, sizeof(long) * 8192, 0, 
+		if ((size = backend->recvfrom(connfd, recvBuf, sizeof(long) * 8192, 0, 
 			(struct sockaddr*)&clientInfo, &len)) == -1)
 		{
 			logError("Socket broken when receiving(%s), trying to restart...",
@@ -155,11 +155,12 @@ int main(int argc, char **argv)
 			continue;
 		}
 
+		USDT1(udp_recv, recvBuf[0]);
 		logMessage("Packet #%ld received from %s:%d(total %ld)", recvBuf[0],
 			inet_ntoa(clientInfo.sin_addr), (int)clientInfo.sin_port,
 			++received);
 
-		if (sendto(connfd, recvBuf, size, 0, 
+		if (backend->sendto(connfd, recvBuf, size, 0, 
 			(struct sockaddr *)&clientInfo, len) == -1)
 		{
 			logError("Socket broken when sending(%s), trying to restart...",
@@ -168,10 +169,11 @@ int main(int argc, char **argv)
 			continue;
 		}
 
+		USDT1(udp_send, recvBuf[0]);
 		logMessage("Packet #%ld sent to %s:%d(total %ld)", recvBuf[0],
 			inet_ntoa(clientInfo.sin_addr), (int)clientInfo.sin_port, ++sent);
 	}
 
-	close(connfd);
+	backend->close(connfd);
 	return 0;
 }
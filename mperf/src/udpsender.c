@@ -135,12 +135,12 @@ static void initConnection()
 	char errbuf[256];
 
 	memset(&serverInfo, 0, sizeof(serverInfo));
-	close(connfd);
+	backend->close(connfd);
 
 	for (; attempt <= MAX_ATTEMPT; ++attempt)
 	{
     	if ((connfd = netdial(
-        	AF_INET, SOCK_DGRAM, localIP, 0, serverIP, port)) < 0)
+        	AF_INET, SOCK_DGRAM, 0, localIP, 0, serverIP, port)) < 0)
 		{
 			logError("initConnection failure #%d(%s): Can't create socket!", 
 				attempt, strerrorV(errno, errbuf));
@@ -189,7 +189,7 @@ static void *do_receive(void *arg)
 
 	while (received != toSend)
 	{
-		if (recvfrom(connfd, recvBuf, sizeof(long) * size, 0, 
+		if (backend->recvfrom(connfd, recvBuf, sizeof(long) * size, 0, 
 			(struct sockaddr*)&serverInfo, &len) == -1)
 		{
 			logError("I/O failure #%d: Socket broken when receving(%s).",
@@ -202,6 +202,7 @@ static void *do_receive(void *arg)
 			continue;
 		}
 
+		USDT1(udp_recv, *recvBuf);
 		logMessage("Packet #%ld received(total %ld).", *recvBuf, ++received);
 		attempt = 1;
 	}
@@ -236,7 +237,7 @@ static void *do_send(void *arg)
 		else if (ret > 0)
 		{
 			*sendBuf = ++sent;
-			if (sendto(connfd, sendBuf, sizeof(long) * size, 0, 
+			if (backend->sendto(connfd, sendBuf, sizeof(long) * size, 0, 
 				(struct sockaddr*)&serverInfo, len) == -1)
 			{			
 				logError("I/O failure #%d: Socket broken when sending(%s).",
@@ -248,6 +249,7 @@ static void *do_send(void *arg)
 				tryInitConnection();
 				continue;
 			}
+			USDT1(udp_send, sent);
 		}
 		else
 		{
@@ -310,7 +312,7 @@ int main(int argc, char **argv)
 	pthread_join(receiver, NULL);
 	pthread_join(sender, NULL);
 
-	close(connfd);
+	backend->close(connfd);
 
 	return 0;
 }
@@ -1,6 +1,9 @@
+#include "live.h"
+#include "trace.h"
 #include "util.h"
 
 static char *smem[16];
+rioStat_t rioStat;
 
 sighandler_t signalNoRestart(int signum, sighandler_t handler) 
 {
@@ -36,11 +39,18 @@ void initSharedMem(int index)
 
 void setMessage(int index, char *message)
 {
-    int len;
+    setBlock(index, message, strlen(message) + 1);
+}
 
-    len = strlen(message) + 1;
+void setBlock(int index, const char *data, int len)
+{
     *(int*)smem[index] = len;
-    memcpy(smem[index] + sizeof(int), message, len);
+    memcpy(smem[index] + sizeof(int), data, len);
+}
+
+char *getSharedMem(int index)
+{
+    return smem[index];
 }
 
 int getMessage(int index, char *dest)
@@ -79,6 +89,9 @@ char *retstr(char ret, char *buf)
         sprintf(buf, "Server not running(RET_EPROC, %d)", 
             RET_EPROC);
         break;
+    case RET_QUEUED:
+        sprintf(buf, "Test queued(RET_QUEUED, %d)", RET_QUEUED);
+        break;
     default:
         sprintf(buf, "Value not defined(%d)", (int)ret);
     }
@@ -153,6 +166,63 @@ int rReceiveMessage(int connfd, const char *name, char *buf)
     return RET_SUCC;
 }
 
+int rReceiveBlock(int connfd, const char *name, char *buf, int max, int *len)
+{
+    sighandler_t oldHandler;
+    int msglen;
+
+    oldHandler = signalNoRestart(SIGALRM, timeoutHandler);
+    alarmWithLog(MESSAGE_TIMEOUT);
+    if (rio_readnr(connfd, (char*)&msglen, sizeof(msglen)) <
+        (ssize_t)sizeof(msglen))
+    {
+        cancelTimeout(oldHandler);
+        logError("Can't receive length from %s!", name);
+        return RET_EREAD;
+    }
+    if (msglen < 0 || msglen > max)
+    {
+        cancelTimeout(oldHandler);
+        logError("Message of %d Bytes from %s is too long!", msglen, name);
+        return RET_EREAD;
+    }
+    if (rio_readnr(connfd, buf, msglen) < msglen)
+    {
+        cancelTimeout(oldHandler);
+        logError("Can't receive message from %s!", name);
+        return RET_EREAD;
+    }
+    cancelTimeout(oldHandler);
+    logVerbose("Received message with length=%d from %s", msglen, name);
+    *len = msglen;
+    return RET_SUCC;
+}
+
+int rSendRequest(int connfd, char instr, char *message, int len)
+{
+    static char buf[2048];
+    sighandler_t oldHandler;
+    char errbuf[256];
+
+    buf[0] = instr;
+    memcpy(buf + 1, &len, sizeof(int));
+    memcpy(buf + 1 + sizeof(int), message, len);
+
+    oldHandler = signalNoRestart(SIGALRM, timeoutHandler);
+    alarmWithLog(MESSAGE_TIMEOUT);
+    if (rio_writenr(connfd, buf, 1 + sizeof(int) + len) <
+        1 + (int)sizeof(int) + len)
+    {
+        cancelTimeout(oldHandler);
+        logError("Can't send request to controller!(%s)",
+            strerrorV(errno, errbuf));
+        return RET_EWRITE;
+    }
+    cancelTimeout(oldHandler);
+    logVerbose("Sent request %d with length=%d to controller", instr, len);
+    return RET_SUCC;
+}
+
 int rSendBytes(int connfd, const char *buf, int len, const char *errorText)
 {
     sighandler_t oldHandler;
@@ -189,7 +259,36 @@ int rRecvBytes(int connfd, char *buf, int len, const char *errorText)
     return RET_SUCC;
 }
 
+char recvReturn(int connfd, char *message)
+{
+    int position, eta;
+    char ret;
+
+    // a queued test hears from the controller every few seconds until it
+    // starts.
+    do
+    {
+        if (rRecvBytes(connfd, &ret, 1, "Failed to receive return value")
+            != RET_SUCC)
+        {
+            return RET_EREAD;
+        }
+        if ((ret == RET_QUEUED || ret == RET_EMSG) &&
+            rReceiveMessage(connfd, "controller", message) != RET_SUCC)
+        {
+            return RET_EREAD;
+        }
+        if (ret == RET_QUEUED && sscanf(message, "%d%d", &position, &eta) == 2)
+        {
+            logMessage("Queued at position %d, starting in about %ds.",
+                position, eta);
+        }
+    } while (ret == RET_QUEUED);
+    return ret;
+}
+
 // rio_read/write that returns on interrupt.
+// they only update rioStat here, use logRioStat() to format the counters.
 ssize_t rio_readnr(int fd, void *usrbuf, size_t n) 
 {
     size_t nleft = n;
@@ -199,17 +298,19 @@ ssize_t rio_readnr(int fd, void *usrbuf, size_t n)
 
     while (nleft > 0)
     {
-        if ((nread = read(fd, bufp, nleft)) < 0)
+        ++rioStat.reads;
+        if ((nread = backend->read(fd, bufp, nleft)) < 0)
         {
             if (errno == EINTR)
             {
+                ++rioStat.interrupts;
                 logVerbose("Read interrupted.");
                 break;
             }
             else
             {
                 logError("Read error(%s).", strerrorV(errno, errbuf));
-                logVerboseL(2, "Got %ld bytes.", (ssize_t)(n - nleft));
+                USDT3(rio_read, fd, n, -1);
                 return -1; 
             }
         } 
@@ -218,11 +319,18 @@ ssize_t rio_readnr(int fd, void *usrbuf, size_t n)
             logMessage("EOF reached.");
             break;
         }    
+        if ((size_t)nread < nleft)
+        {
+            ++rioStat.partialReads;
+        }
+        ++rioStat.readHist[rioBucket(nread)];
         nleft -= nread;
         bufp += nread;
     }
 
-    logVerboseL(2, "Got %ld bytes.", (ssize_t)(n - nleft));
+    USDT3(rio_read, fd, n, n - nleft);
+    liveReceived(n - nleft);
+    traceBytes(n - nleft);
     return (n - nleft);
 }
 
@@ -235,10 +343,12 @@ ssize_t rio_writenr(int fd, const void *usrbuf, size_t n)
 
     while (nleft > 0) 
     {
-        if ((nwritten = write(fd, bufp, nleft)) <= 0) 
+        ++rioStat.writes;
+        if ((nwritten = backend->write(fd, bufp, nleft)) <= 0) 
         {
             if (errno == EINTR)
             {
+                ++rioStat.interrupts;
                 logVerbose("Write interrupted.");
                 n -= nleft;
                 break;
@@ -250,20 +360,101 @@ ssize_t rio_writenr(int fd, const void *usrbuf, size_t n)
                 break;
             }
         }
+        if ((size_t)nwritten < nleft)
+        {
+            ++rioStat.partialWrites;
+        }
         nleft -= nwritten;
         bufp += nwritten;
     }
 
-    logVerboseL(2, "Sent %ld bytes.", (ssize_t)n);
+    // n is the return value here, the request is what's written plus nleft.
+    USDT3(rio_write, fd, bufp - (const char*)usrbuf + nleft, n);
+    liveSent(bufp - (const char*)usrbuf);
+    traceBytes(bufp - (const char*)usrbuf);
     return n;
 }
 
+void resetRioStat()
+{
+    memset(&rioStat, 0, sizeof(rioStat));
+}
+
+static char *sizestr(long size, char *buf)
+{
+    static const char *unit[] = { "B", "KiB", "MiB", "GiB" };
+    int i = 0;
+
+    while (size >= 1024 && i < 3)
+    {
+        size >>= 10;
+        ++i;
+    }
+    sprintf(buf, "%ld%s", size, unit[i]);
+    return buf;
+}
+
+void logRioStat()
+{
+    long reads = 0;
+    int i;
+    char lo[32], hi[32];
+
+    for (i = 0; i < RIO_HIST_LEN; ++i)
+    {
+        reads += rioStat.readHist[i];
+    }
+
+    logMessage("->Syscalls: read %ld, write %ld", rioStat.reads,
+        rioStat.writes);
+    logMessage("->Partial reads: %ld, partial writes: %ld",
+        rioStat.partialReads, rioStat.partialWrites);
+    logMessage("->Interrupted(EINTR): %ld", rioStat.interrupts);
+    if (reads == 0)
+    {
+        return;
+    }
+    logMessage("->Bytes per read:");
+    for (i = 0; i < RIO_HIST_LEN; ++i)
+    {
+        if (rioStat.readHist[i] && i == RIO_HIST_LEN - 1)
+        {
+            // the last bucket also counts all larger reads.
+            logMessage("-->>= %s: %ld(%.2lf%%)", sizestr(1L << i, lo),
+                rioStat.readHist[i], 100.0 * rioStat.readHist[i] / reads);
+        }
+        else if (rioStat.readHist[i])
+        {
+            logMessage("-->[%s, %s): %ld(%.2lf%%)", sizestr(1L << i, lo),
+                sizestr(1L << (i + 1), hi), rioStat.readHist[i],
+                100.0 * rioStat.readHist[i] / reads);
+        }
+    }
+}
+
+// socket() that falls back to TCP if the kernel doesn't support MPTCP.
+// other errors(e.g. EMFILE) are the caller's, not a reason to run over TCP.
+static int openSocket(int domain, int type, int protocol)
+{
+    int s = backend->socket(domain, type, protocol);
+    char errbuf[256];
+
+    if (s < 0 && protocol == IPPROTO_MPTCP && (errno == EPROTONOSUPPORT ||
+        errno == EINVAL || errno == ENOPROTOOPT))
+    {
+        logWarning("MPTCP not available(%s), falling back to TCP.",
+            strerrorV(errno, errbuf));
+        s = backend->socket(domain, type, 0);
+    }
+    return s;
+}
+
 // open_listenfd code comes from CS:APP2e example code pack: 
 // http://csapp.cs.cmu.edu/public/code.html
 // Modified to support bind local IP(code from below).
 typedef struct sockaddr SA;
 #define LISTENQ 1024 
-int open_listenfd(const char *local, int port)
+int open_listenfd(const char *local, int port, int protocol)
 {
     int listenfd, optval = 1;
     int ret = -1;
@@ -279,11 +470,11 @@ int open_listenfd(const char *local, int port)
     }
 
     /* Create a socket descriptor */
-    if ((listenfd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+    if ((listenfd = openSocket(AF_INET, SOCK_STREAM, protocol)) < 0)
         goto open_listenfd_out;
 
     /* Eliminates "Address already in use" error from bind. */
-    if (setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR,
+    if (backend->setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR,
                    (const void *)&optval, sizeof(int)) < 0)
         goto open_listenfd_out;
 
@@ -302,12 +493,18 @@ int open_listenfd(const char *local, int port)
         addr.sin_port = htons((unsigned short)port);
         serveraddr = &addr;
     }
-    if (bind(listenfd, (SA *)serveraddr, sizeof(SA)) < 0)
+    if (backend->bind(listenfd, (SA *)serveraddr, sizeof(SA)) < 0)
         goto open_listenfd_out;
 
     /* Make it a listening socket ready to accept connection requests */
-    if (listen(listenfd, LISTENQ) < 0)
+    if (backend->listen(listenfd, LISTENQ) < 0)
         goto open_listenfd_out;
+
+    /* Accept TCP Fast Open, as far as net.ipv4.tcp_fastopen allows it */
+    optval = LISTENQ;
+    if (backend->setsockopt(listenfd, IPPROTO_TCP, TCP_FASTOPEN,
+                   (const void *)&optval, sizeof(int)) < 0)
+        logVerbose("TCP Fast Open not available on listener.");
     
     ret = listenfd;
 
@@ -319,13 +516,119 @@ open_listenfd_out:
     return ret;
 }
 
+// accept() on whichever of the listening sockets is ready first.
+int acceptAny(const int *listenfds, int n, struct sockaddr_in *addr,
+    socklen_t *len)
+{
+    struct pollfd pfds[MAX_ADDRS];
+    int i;
+
+    if (n == 1)
+    {
+        return backend->accept(listenfds[0], (struct sockaddr*)addr, len);
+    }
+    for (i = 0; i < n; ++i)
+    {
+        pfds[i].fd = listenfds[i];
+        pfds[i].events = POLLIN;
+    }
+    if (poll(pfds, n, -1) < 0)
+    {
+        return -1;
+    }
+    for (i = 0; i < n; ++i)
+    {
+        if (pfds[i].revents & POLLIN)
+        {
+            return backend->accept(listenfds[i], (struct sockaddr*)addr, len);
+        }
+    }
+    errno = EAGAIN;
+    return -1;
+}
+
+int rAcceptAny(const int *listenfds, int n, struct sockaddr_in *addr,
+    socklen_t *len)
+{
+    sighandler_t oldHandler;
+    int connfd;
+
+    oldHandler = signalNoRestart(SIGALRM, timeoutHandler);
+    alarmWithLog(MESSAGE_TIMEOUT);
+    connfd = acceptAny(listenfds, n, addr, len);
+    cancelTimeout(oldHandler);
+    return connfd;
+}
+
+// splits a comma-separated list in place, returns the number of items.
+int splitList(char *list, char **items, int max)
+{
+    int n = 0;
+    char *save;
+    char *item;
+
+    for (item = strtok_r(list, ",", &save); item && n < max;
+         item = strtok_r(NULL, ",", &save))
+    {
+        items[n++] = item;
+    }
+    return n;
+}
+
+int compareDouble(const void *a, const void *b)
+{
+    double x = *(const double*)a, y = *(const double*)b;
+
+    return x < y ? -1 : x > y;
+}
+
+int sendSessionHeader(int connfd, int type, int arg, int arg2)
+{
+    sessionHeader_t header;
+
+    header.magic = htonl(SESSION_MAGIC);
+    header.type = htonl(type);
+    header.arg = htonl(arg);
+    header.arg2 = htonl(arg2);
+    if (rio_writenr(connfd, &header, sizeof(header)) < (ssize_t)sizeof(header))
+    {
+        return -1;
+    }
+    return 0;
+}
+
+// returns 0 at the end of the session(TYPE_END or EOF), -1 on errors.
+int recvSessionHeader(int connfd, int *type, int *arg, int *arg2)
+{
+    sessionHeader_t header;
+    ssize_t ret = rio_readnr(connfd, &header, sizeof(header));
+
+    if (ret == 0)
+    {
+        return 0;
+    }
+    if (ret < (ssize_t)sizeof(header) || ntohl(header.magic) != SESSION_MAGIC)
+    {
+        if (ret >= 0)
+        {
+            errno = EPROTO;
+        }
+        return -1;
+    }
+    *type = (int32_t)ntohl(header.type);
+    *arg = (int32_t)ntohl(header.arg);
+    *arg2 = (int32_t)ntohl(header.arg2);
+    return *type == TYPE_END ? 0 : 1;
+}
+
 /* netdial and netannouce code comes from libtask: http://swtch.com/libtask/
  * Copyright: http://swtch.com/libtask/COPYRIGHT
 */
 
 /* make connection to server */
-int
-netdial(int domain, int proto, char *local, int local_port, char *server, int port)
+static int
+dial(int domain, int proto, int protocol, char *local, int local_port,
+    char *server, int port, int fastOpen)
 {
     struct addrinfo hints, *local_res, *server_res;
     int s;
@@ -345,7 +648,7 @@ netdial(int domain, int proto, char *local, int local_port, char *server, int po
     if (getaddrinfo(server, NULL, &hints, &server_res) != 0)
         return -1;
 
-    s = socket(server_res->ai_family, proto, 0);
+    s = openSocket(server_res->ai_family, proto, protocol);
     if (s < 0) {
 	if (local)
 	    freeaddrinfo(local_res);
@@ -361,8 +664,8 @@ netdial(int domain, int proto, char *local, int local_port, char *server, int po
             local_res->ai_addr = (struct sockaddr *)lcladdr;
         }
 
-        if (bind(s, (struct sockaddr *) local_res->ai_addr, local_res->ai_addrlen) < 0) {
-	    close(s);
+        if (backend->bind(s, (struct sockaddr *) local_res->ai_addr, local_res->ai_addrlen) < 0) {
+	    backend->close(s);
 	    freeaddrinfo(local_res);
 	    freeaddrinfo(server_res);
             return -1;
@@ -376,22 +679,27 @@ netdial(int domain, int proto, char *local, int local_port, char *server, int po
         myaddr.sin_family = AF_INET;
         myaddr.sin_addr.s_addr = htonl(INADDR_ANY);
         myaddr.sin_port = htons(local_port);
-        if (bind(s, (struct sockaddr*)&myaddr, 
+        if (backend->bind(s, (struct sockaddr*)&myaddr, 
             sizeof(struct sockaddr_in)) < 0) 
         {
-            close(s);
+            backend->close(s);
             return -1;
         }
     }
 
-    if (setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &val, sizeof(val)) == -1) {
-        close(s);
+    if (backend->setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &val, sizeof(val)) == -1) {
+        backend->close(s);
         return -1;
     }
     
+    /* the first write goes in the SYN if the kernel has a cookie */
+    if (fastOpen && backend->setsockopt(s, IPPROTO_TCP, TCP_FASTOPEN_CONNECT,
+        &val, sizeof(val)) < 0)
+        logVerbose("TCP Fast Open not available.");
+
     ((struct sockaddr_in *) server_res->ai_addr)->sin_port = htons(port);
-    if (connect(s, (struct sockaddr *) server_res->ai_addr, server_res->ai_addrlen) < 0 && errno != EINPROGRESS) {
-	close(s);
+    if (backend->connect(s, (struct sockaddr *) server_res->ai_addr, server_res->ai_addrlen) < 0 && errno != EINPROGRESS) {
+	backend->close(s);
 	freeaddrinfo(server_res);
         return -1;
     }
@@ -399,3 +707,44 @@ netdial(int domain, int proto, char *local, int local_port, char *server, int po
     freeaddrinfo(server_res);
     return s;
 }
+
+int
+netdial(int domain, int proto, int protocol, char *local, int local_port,
+    char *server, int port)
+{
+    return dial(domain, proto, protocol, local, local_port, server, port, 0);
+}
+
+int
+netdialFastOpen(int domain, int protocol, char *local, int local_port,
+    char *server, int port)
+{
+    return dial(domain, SOCK_STREAM, protocol, local, local_port, server,
+        port, 1);
+}
+
+int fastOpened(int connfd)
+{
+    struct tcp_info info;
+    socklen_t len = sizeof(info);
+
+    if (backend->getsockopt(connfd, IPPROTO_TCP, TCP_INFO, &info, &len) < 0)
+    {
+        return 0;
+    }
+    return (info.tcpi_options & TCPI_OPT_SYN_DATA) != 0;
+}
+
+int getTCPCounters(int connfd, long *retrans, long *rtt)
+{
+    struct tcp_info info;
+    socklen_t len = sizeof(info);
+
+    if (backend->getsockopt(connfd, IPPROTO_TCP, TCP_INFO, &info, &len) < 0)
+    {
+        return -1;
+    }
+    *retrans = info.tcpi_total_retrans;
+    *rtt = info.tcpi_rtt;
+    return 0;
+}
@@ -1,4 +1,10 @@
+#include <sys/prctl.h>
+
+#include "live.h"
+#include "many.h"
+#include "mptcp.h"
 #include "sndrcv.h"
+#include "trace.h"
 #include "util.h"
 
 static const char *svusage = 
@@ -6,31 +12,115 @@ static const char *svusage =
     "    Print this message and exit.\n"
     "  -l [path]:\n"
     "    Specify the file to save the log.\n"
+    "  -M:\n"
+    "    Listen with MPTCP(falls back to TCP if not supported).\n"
+    "  -f [fds]:\n"
+    "    Serve the listening sockets inherited from the controller, given as\n"
+    "    a comma-separated list of file descriptors, instead of opening new\n"
+    "    ones.\n"
     "  -p [port]:\n"
     "    Specify port number of server.\n"
     "    *: Required\n"
     "  -s [source IP]:\n"
-    "    Specify the source IP to listen on.\n"
+    "    Specify the source IP to listen on, or a comma-separated list of\n"
+    "    them.\n"
     "    (default: unspecified)\n"
     "  -V[level]:\n"
-    "    Print verbose log. Use -V2 for even more verbose log.";
+    "    Print verbose log. Use -V2 for even more verbose log.\n"
+    "  -W:\n"
+    "    Wait in the controller's pool until it sends SIGUSR1 for a test.";
 
-static char type = TYPE_FIX;
-static int arg = 1024;
-static int arg2 = 200;
+static plan_t plan;
+// the test being served, the tests of a session change its size and timeout.
+static planTest_t test;
+static int streams = 1;
+static int session = 0;
+static int incast = 0;
+static int replay = 0;
+static pid_t flowPID[MAX_FLOWS];
+static int flowCount = 0;
+static int probeLen = 1;
+static many_t many;
 static char packetBuf[PACKET_LEN];
 
 static int running = 0;
+// run of the plan in progress, for the live statistics.
+static int planRun = 0;
 
 static int port;
 static char *path;
-static char* sourceIP;
+static char *sourceIPs[MAX_ADDRS];
+static int sourceCount = 0;
+static char *inheritedFDs[MAX_ADDRS];
+static int inheritedCount = 0;
+static int pooled = 0;
+static volatile sig_atomic_t woken = 0;
+static int mptcp = 0;
+static int listenfds[MAX_ADDRS];
+static int listenCount;
+static int connfds[MAX_STREAMS];
+static char streamNames[MAX_STREAMS][32];
+static char *pStreamNames[MAX_STREAMS];
+
+// makes t the test being served, with the default timeouts of the server.
+static void loadTest(const planTest_t *t)
+{
+    test = *t;
+    if (test.timeout <= 0)
+    {
+        // a long receiver waits a little longer than the sender sends.
+        test.timeout = test.type == TYPE_REVLONG ? test.time + 10 : 200;
+    }
+    if (test.type == TYPE_LONG)
+    {
+        test.timeout = test.time;
+    }
+}
+
+// returns why the test can't be served, or NULL.
+static const char *checkTest(const planTest_t *t, char *message)
+{
+    if (t->repeat <= 0)
+    {
+        sprintf(message, "Invalid repeat count %d", t->repeat);
+    }
+    else if (t->type == TYPE_LONG || t->type == TYPE_REVLONG)
+    {
+        if (t->time <= 0)
+        {
+            sprintf(message, "Invalid long test time %d", t->time);
+        }
+        else
+        {
+            return NULL;
+        }
+    }
+    else if (t->type != TYPE_FIX && t->type != TYPE_REVFIX)
+    {
+        sprintf(message, "Unrecognized type %d", t->type);
+    }
+    else if (t->size <= 0)
+    {
+        sprintf(message, "Invalid fix test size %d", t->size);
+    }
+    else if (testMode == testModes + MODE_PROBE &&
+        (t->loop <= 0 || t->sendInterval < 0 || t->probeInterval < 0))
+    {
+        sprintf(message, "Invalid probe test");
+    }
+    else
+    {
+        return NULL;
+    }
+    return message;
+}
 
 static void configure()
 {
-    static char message[256];
-    int targ, ttype, targ2;
+    static char message[SHARED_BLOCK_LEN];
+    const planTest_t *t;
     int pid = getppid();
+    int i;
 
     logMessage("Trying to reconfigure server(%d).", getpid());
     if (getMessage(SMEM_MESSAGE, message) < 0)
@@ -38,53 +128,149 @@ static void configure()
         logError("Can't receive arguments: shared memory not initialized.");
         goto configure_fail_out;
     }
+    // the controller has checked the version.
+    if (decodePlan(&plan, message, SHARED_BLOCK_LEN) < 0)
+    {
+        sprintf(message, "Unsupported control message");
+        goto configure_error_out;
+    }
+    // only meant for the controller.
+    plan.flags &= ~FLAG_PORT;
+    t = plan.tests;
 
-    sscanf(message, "%d%d%d", &ttype, &targ, &targ2);
-    switch (ttype & ~FLAG_REVERSE)
+    if (plan.probeLen <= 0 || plan.probeLen > PACKET_LEN)
     {
-    case TYPE_LONG:
-        arg = targ;
-        type = (char)ttype;
-        if (arg <= 0)
+        sprintf(message, "Invalid probe packet size %d", plan.probeLen);
+        goto configure_error_out;
+    }
+    probeLen = plan.probeLen;
+    if (plan.mode < 0 || plan.mode >= MODE_COUNT)
+    {
+        sprintf(message, "Unrecognized test mode %d", plan.mode);
+        goto configure_error_out;
+    }
+    testMode = testModes + plan.mode;
+    if (plan.mode != MODE_BULK)
+    {
+        logMessage("Reconfigured with mode = %s.", testMode->name);
+    }
+    if (plan.streams <= 0 || plan.streams > MAX_STREAMS)
+    {
+        sprintf(message, "Invalid number of streams %d", plan.streams);
+        goto configure_error_out;
+    }
+    streams = plan.streams;
+    if (streams > 1)
+    {
+        logMessage("Reconfigured with %d parallel streams.", streams);
+    }
+    // every run of a plan has connections of its own.
+    if (planRuns(&plan) > 1 && (plan.flags & (FLAG_SESSION | FLAG_MANY |
+        FLAG_INCAST | FLAG_REPLAY)))
+    {
+        sprintf(message, "Plans can't have sessions, many-connection tests, "
+            "incasts or replays");
+        goto configure_error_out;
+    }
+    session = BOOL(plan.flags & FLAG_SESSION);
+    if (session && (t->type & ~FLAG_REVERSE) != TYPE_FIX)
+    {
+        sprintf(message, "Sessions only support fix tests");
+        goto configure_error_out;
+    }
+    if (session)
+    {
+        logMessage("Reconfigured as a session, tests are started by the "
+            "client.");
+    }
+    incast = BOOL(plan.flags & FLAG_INCAST);
+    if (incast && ((t->type & FLAG_REVERSE) || session))
+    {
+        sprintf(message, "Only senders without sessions can join an incast");
+        goto configure_error_out;
+    }
+    if (incast)
+    {
+        logMessage("Reconfigured as an incast sender, waiting for the "
+            "client's start byte.");
+    }
+    if (plan.flags & FLAG_MANY)
+    {
+        if ((t->type & ~FLAG_REVERSE) != TYPE_LONG || session ||
+            streams > 1 || plan.conns <= 0 || plan.conns > MAX_CONNS ||
+            t->size <= 0 || plan.interval <= 0)
         {
-            logError("Invalid long test time %d", arg);
-            goto configure_fail_out;
+            sprintf(message, "Invalid many-connection test");
+            goto configure_error_out;
         }
-        logMessage("Reconfigured with type = long, reverse = %d, "
-            "timeout = %d", BOOL(ttype & FLAG_REVERSE), targ);
-        break;
-    case TYPE_FIX:
-        arg = targ;
-        arg2 = targ2;
-        type = (char)ttype;
-        if (arg <= 0)
+        if (strcmp(backend->name, "kernel") != 0)
         {
-            arg = 200;
+            sprintf(message, "Many-connection tests need the kernel stack");
+            goto configure_error_out;
         }
-        if (targ2 <= 0)
+        many.conns = plan.conns;
+        many.timelen = t->time;
+        many.burst = t->size;
+        many.interval = plan.interval;
+        // like other long tests, -s lets the client send.
+        many.send = !(t->type & FLAG_REVERSE);
+        logMessage("Reconfigured as a many-connection test, connections = "
+            "%d, burst = %d, interval = %d", plan.conns, t->size,
+            plan.interval);
+    }
+    // the size of a replay is the number of flows, each of them brings its
+    // own sizes.
+    if (plan.flags & FLAG_REPLAY)
+    {
+        if (t->type != TYPE_FIX || session || incast || streams > 1 ||
+            t->size <= 0 || t->size > MAX_FLOWS)
         {
-            logError("Invalid fix test size %d", targ2);
-            goto configure_fail_out;
+            sprintf(message, "Invalid replay");
+            goto configure_error_out;
         }
-#ifdef PROBE
+        replay = 1;
+        loadTest(t);
+        logMessage("Reconfigured as a replay, flows = %d, timeout = %d",
+            test.size, test.timeout);
+        goto configure_out;
+    }
+    for (i = 0; i < plan.count; ++i)
+    {
+        if (checkTest(plan.tests + i, message) != NULL)
+        {
+            goto configure_error_out;
+        }
+    }
+    loadTest(t);
+    if (plan.count > 1 || t->repeat > 1)
+    {
+        logMessage("Reconfigured with a plan of %d tests, %d runs.",
+            plan.count, planRuns(&plan));
+    }
+    else if (testMode == testModes + MODE_PROBE && (t->type & TYPE_FIX))
+    {
         logMessage("Reconfigured with type = fix, reverse = %d, "
-            "loop = %d, sendInterval = %d, probeInterval = %d, size = %d", 
-            BOOL(ttype & FLAG_REVERSE), targ, (targ2 >> 24) & 0xFF,
-            targ2 & 0xFFFF, (targ2 >> 16) & 0xFF);
-#else
+            "loop = %d, sendInterval = %d, probeInterval = %d, "
+            "size = %d, packet = %d", BOOL(t->type & FLAG_REVERSE), t->loop,
+            t->sendInterval, t->probeInterval, t->size, probeLen);
+    }
+    else if (t->type & TYPE_FIX)
+    {
         logMessage("Reconfigured with type = fix, reverse = %d, "
-            "timeout = %d, size = %d", BOOL(ttype & FLAG_REVERSE), targ, targ2);
-#endif
-        break;
-    default:
-        sprintf(message, "Unrecognized type %d", ttype);
-        logWarning("%s", message);
-        setMessage(SMEM_MESSAGE, message);
-        goto configure_fail_out;
+            "timeout = %d, size = %d", BOOL(t->type & FLAG_REVERSE),
+            test.timeout, t->size);
+    }
+    else
+    {
+        logMessage("Reconfigured with type = long, reverse = %d, "
+            "timeout = %d", BOOL(t->type & FLAG_REVERSE), test.timeout);
     }
 
     goto configure_out;
 
+configure_error_out:
+    logWarning("%s", message);
+    setMessage(SMEM_MESSAGE, message);
 configure_fail_out:
     // send SIGUSR2 and exit
     if (rKill(pid, "controller", SIGUSR2) != RET_SUCC)
@@ -93,16 +279,21 @@ configure_fail_out:
     }
     exit(0);
 configure_out:
-    if (rKill(pid, "controller", SIGUSR1) != RET_SUCC)
-    {
-        logError("Can't contact with controller!");
-    }
+    USDT3(worker_configured, test.type, test.timeout, test.size);
 }
 
 static void sigintHandler(int sig)
 {
     int be = errno;
+    int i;
+
+    USDT1(signal, sig);
     logVerbose("--SIGINT received.");
+    signalStreams(SIGINT);
+    for (i = 0; i < flowCount; ++i)
+    {
+        kill(flowPID[i], SIGINT);
+    }
     // not running, we simply exit as expected.
     if (!running)
     {
@@ -116,55 +307,229 @@ static void sigintHandler(int sig)
 static void sigalrmHandler(int sig)
 {
     int be = errno;
+    USDT1(signal, sig);
     logVerbose("--SIGALRM received.");
     release(&sigalrm);
     errno = be;
 }
 
+// bytes transferred by a single fix test.
+static inline long testBytes()
+{
+    return testMode == testModes + MODE_PROBE ?
+        (long)test.loop * test.size * probeLen : test.size;
+}
+
+// a probe test takes loop * (size * sendInterval + probeInterval) ms, we give
+// it 10 more seconds before timing out.
+static inline int probeTime()
+{
+    return (test.loop * (test.size * test.sendInterval +
+        test.probeInterval)) / 1000 + 10;
+}
+
 static void parse(int connfd)
 {
-    switch (type)
+    switch (test.type)
     {
     case TYPE_LONG:
-        doLongTest(connfd, arg, packetBuf);
+        doLongTest(connfd, test.time, packetBuf);
         break;
     case TYPE_FIX:
-#ifdef PROBE
-        doProbe(connfd, (arg2 >> 24) & 0xFF, arg2 & 0xFFFF, (arg2 >> 16) & 0xFF,
-            arg, packetBuf);
-#else
-        doFixTest(connfd, arg, arg2, packetBuf);
-#endif
+        if (testMode == testModes + MODE_PROBE)
+        {
+            doProbe(connfd, test.sendInterval, test.probeInterval,
+                test.size, test.loop, probeLen, packetBuf);
+        }
+        else
+        {
+            doFixTest(connfd, test.timeout, test.size, packetBuf);
+        }
         break;
     case TYPE_REVLONG:
+        doReceive(connfd, test.timeout, packetBuf);
+        break;
     case TYPE_REVFIX:
-        doReceive(connfd, arg, packetBuf);
+        if (testMode == testModes + MODE_PROBE)
+        {
+            doProbeReceive(connfd, probeTime(), test.sendInterval,
+                test.size, test.loop, probeLen, packetBuf);
+        }
+        else
+        {
+            // in a session the connection stays open after the test.
+            doReceiveN(connfd, test.timeout, session ? testBytes() : -1,
+                packetBuf);
+        }
         break;
     default:
-        logWarning("Unrecognized type %d.", (int)type);
+        logWarning("Unrecognized type %d.", test.type);
+    }
+    // a session goes on with its next test.
+    running = session;
+}
+
+// runs the test announced by the next header of the session.
+static int parseSessionTest(int connfd)
+{
+    int ttype, targ, targ2;
+    int ret;
+    char errbuf[256];
+
+    if ((ret = recvSessionHeader(connfd, &ttype, &targ, &targ2)) <= 0)
+    {
+        if (ret < 0 && continueTest())
+        {
+            logError("Can't receive session header(%s)!",
+                strerrorV(errno, errbuf));
+        }
+        return 0;
+    }
+    if ((ttype & ~FLAG_REVERSE) != TYPE_FIX || targ2 <= 0)
+    {
+        logError("Unexpected test in session(type %d, size %d)!", ttype,
+            targ2);
+        return 0;
+    }
+    test.type = ttype;
+    test.timeout = targ > 0 ? targ : 200;
+    test.size = targ2;
+    logVerbose("Session test: type = %d, timeout = %d, size = %d", ttype,
+        test.timeout, test.size);
+    parse(connfd);
+    return lastResult.bytes == testBytes();
+}
+
+// serves a replayed flow: the header gives the bytes sent by the client and
+// by the server, in this order.
+static void replayFlow(int connfd)
+{
+    int ttype, up, down;
+    char errbuf[256];
+
+    if (recvSessionHeader(connfd, &ttype, &up, &down) <= 0 ||
+        ttype != TYPE_FIX)
+    {
+        logError("Can't receive flow header(%s)!", strerrorV(errno, errbuf));
+        return;
+    }
+    logMessage("Replaying flow of %d + %d Bytes.", up, down);
+    if (up > 0)
+    {
+        doReceiveN(connfd, test.timeout, up, packetBuf);
+    }
+    if (down > 0 && continueTest())
+    {
+        doFixTest(connfd, test.timeout, down, packetBuf);
+    }
+}
+
+// accepts the flows of a replay as they arrive and serves each of them in
+// its own process, then waits for all of them.
+static void doReplay(int *listenfds, int listenCount)
+{
+    struct sockaddr_in clientaddr;
+    unsigned int clientlen;
+    char errbuf[256];
+    pid_t pid;
+    int connfd, i;
+    int accepted = 0;
+
+    while (accepted < test.size && continueTest())
+    {
+        clientlen = sizeof(clientaddr);
+        if ((connfd = acceptAny(listenfds, listenCount, &clientaddr,
+            &clientlen)) < 0)
+        {
+            if (errno != EINTR)
+            {
+                logError("Unable to accept connection(%s)!",
+                    strerrorV(errno, errbuf));
+            }
+            continue;
+        }
+        if ((pid = fork()) < 0)
+        {
+            logError("Can't serve flow #%d(%s)!", accepted,
+                strerrorV(errno, errbuf));
+        }
+        else if (pid == 0)
+        {
+            flowCount = 0;
+            for (i = 0; i < listenCount; ++i)
+            {
+                backend->close(listenfds[i]);
+            }
+            replayFlow(connfd);
+            backend->close(connfd);
+            exit(0);
+        }
+        else
+        {
+            flowPID[flowCount++] = pid;
+        }
+        backend->close(connfd);
+        ++accepted;
+    }
+    for (i = 0; i < flowCount; ++i)
+    {
+        while (waitpid(flowPID[i], NULL, 0) < 0 && errno == EINTR);
+    }
+    logMessage("Replayed %d flows.", flowCount);
+}
+
+static void parseStream(int connfd)
+{
+    char go;
+    char errbuf[256];
+    ssize_t ret;
+
+    if (incast && (ret = rio_readnr(connfd, &go, 1)) < 1)
+    {
+        logError("Didn't get the start byte(%s)!", ret < 0 ?
+            strerrorV(errno, errbuf) : "EOF");
+        return;
+    }
+    if (session)
+    {
+        doSession(connfd, parseSessionTest);
+    }
+    else
+    {
+        parse(connfd);
+    }
+    getTCPCounters(connfd, &lastResult.retrans, &lastResult.rtt);
+    if (mptcp)
+    {
+        logMPTCPInfo(connfd, lastResult.elapsed);
     }
-    running = 0;
 }
 
 static void parseArguments(int argc, char **argv)
 {
     char c;
     optind = 0;
-    while ((c = getopt(argc, argv, "p:vV::l:hs:")) != EOF)
+    while ((c = getopt(argc, argv, "f:p:vV::l:hMs:W")) != EOF)
     {
         switch (c)
         {
+        case 'f':
+            inheritedCount = splitList(optarg, inheritedFDs, MAX_ADDRS);
+            break;
         case 'h':
             printUsageAndExit(argv);
             break;
         case 'l':
             path = optarg;
             break;
+        case 'M':
+            mptcp = 1;
+            break;
         case 'p':
             port = atoi(optarg);
             break;
         case 's':
-            sourceIP = optarg;
+            sourceCount = splitList(optarg, sourceIPs, MAX_ADDRS);
             break;
         case 'V':
             if (optarg)
@@ -176,6 +541,9 @@ static void parseArguments(int argc, char **argv)
                 setVerbose(1);
             }
             break;
+        case 'W':
+            pooled = 1;
+            break;
         default:
             logWarning("Unexpected command-line option %c!", (char)optopt);
             printUsageAndExit(argv);
@@ -192,19 +560,220 @@ static void parseArguments(int argc, char **argv)
     }
 }
 
-int serverMain(int argc, char **argv)
+static void sigusr1Handler(int sig)
 {
-    int listenfd;
+    int be = errno;
+    USDT1(signal, sig);
+    woken = 1;
+    errno = be;
+}
+
+// a pooled server is forked with SIGUSR1 blocked, so that the wake-up can't
+// be lost before the handler is installed.
+static void waitForTest()
+{
+    sigset_t mask;
+
+    signalNoRestart(SIGUSR1, sigusr1Handler);
+    // don't outlive the controller while idle.
+    prctl(PR_SET_PDEATHSIG, SIGINT);
+    if (getppid() == 1)
+    {
+        exit(0);
+    }
+    logMessage("Server(%d) waiting for a test.", getpid());
+    sigprocmask(SIG_SETMASK, NULL, &mask);
+    sigdelset(&mask, SIGUSR1);
+    while (!woken)
+    {
+        sigsuspend(&mask);
+    }
+    sigprocmask(SIG_SETMASK, &mask, NULL);
+}
+
+// accepts the connections of a test, returns -1 if it was interrupted.
+static int acceptStreams()
+{
+    struct sockaddr_in clientaddr;
     unsigned int clientlen;
     unsigned short clientport;
-    int connfd = -1;
-    struct sockaddr_in clientaddr;
     char *haddrp;
-    usage = svusage;
     char errbuf[256];
-#ifdef CHECK
-    long i = 0;
-#endif
+    int64_t accepting;
+    int connfd;
+    int accepted = 0;
+
+    while (accepted < streams && continueTest())
+    {
+        clientlen = sizeof(clientaddr);
+        accepting = traceNow();
+        connfd = acceptAny(listenfds, listenCount, &clientaddr, &clientlen);
+        if (connfd < 0)
+        {
+            if (errno == EINTR)
+            {
+                logVerbose("%s", "Accept interrupted.");
+            }
+            else
+            {
+                logError("Unable to accept connection(%s)!",
+                         strerrorV(errno, errbuf));
+            }
+            continue;
+        }
+        if (testMode->nodelay)
+        {
+            int flag = 1;
+            backend->setsockopt(connfd, IPPROTO_TCP, TCP_NODELAY,
+                (char*)&flag, sizeof(int));
+        }
+        haddrp = inet_ntoa(clientaddr.sin_addr);
+        clientport = clientaddr.sin_port >> 8 | clientaddr.sin_port << 8;
+        logMessage("Connected with %s:%d%s", haddrp, (int)clientport,
+            fastOpened(connfd) ? "(TCP Fast Open)" : "");
+        sprintf(streamNames[accepted], "%s:%d", haddrp, (int)clientport);
+        pStreamNames[accepted] = streamNames[accepted];
+        traceSpan(TRACE_CONNECT, accepted, accepting);
+        connfds[accepted++] = connfd;
+    }
+    return continueTest() ? 0 : -1;
+}
+
+// runs the test over the connections accepted, then closes them.
+static void runStreams()
+{
+    char errbuf[256];
+    int64_t closing;
+
+    if (streams > 1)
+    {
+        doParallel(streams, connfds, pStreamNames, parseStream);
+        logMessage("Connections closed.\n");
+        return;
+    }
+
+    traceStreamStart(0);
+    parseStream(connfds[0]);
+    traceStreamEnd();
+    closing = traceNow();
+    if (backend->close(connfds[0]) < 0)
+    {
+        logWarning("Error when closing connection(%s).", 
+            strerrorV(errno, errbuf));
+    }
+    traceSpan(TRACE_CLOSE, 0, closing);
+    logMessage("Connection with %s closed.\n", streamNames[0]);
+}
+
+static void closeListeners()
+{
+    char errbuf[256];
+    int i;
+
+    for (i = 0; i < listenCount; ++i)
+    {
+        if (backend->close(listenfds[i]) < 0)
+        {
+            logWarning("Error when closing listen socket(%s).",
+                strerrorV(errno, errbuf));
+        }
+    }
+}
+
+// sends the events of the test, then answers every byte of the client with
+// the server's clock.
+static int sendTrace(int connfd)
+{
+    static char events[TRACE_HEADER + MAX_TRACE * TRACE_EVENT];
+    char clock[TRACE_CLOCK];
+    char byte;
+    int64_t received;
+    int i;
+
+    if (rSendBytes(connfd, events, encodeTrace(events),
+        "Can't send the trace") != RET_SUCC)
+    {
+        return -1;
+    }
+    for (i = 0; i < TRACE_SAMPLES; ++i)
+    {
+        if (rRecvBytes(connfd, &byte, 1, "Can't receive the clock request")
+            != RET_SUCC)
+        {
+            return -1;
+        }
+        received = traceNow();
+        if (rSendBytes(connfd, clock, encodeTraceClock(clock, received),
+            "Can't send the clock") != RET_SUCC)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// sends the results of the test in lastResult to the client, which asks
+// for them on a connection of its own once it has closed the data
+// connections, and the trace of the test with FLAG_TRACE.
+static void serveResults()
+{
+    struct sockaddr_in clientaddr;
+    socklen_t clientlen = sizeof(clientaddr);
+    char record[RESULTS_LEN];
+    char errbuf[256];
+    liveStat_t *live = liveStat;
+    int connfd, type, arg, arg2;
+
+    // the record isn't part of the test.
+    liveStat = NULL;
+    if ((connfd = rAcceptAny(listenfds, listenCount, &clientaddr,
+        &clientlen)) < 0)
+    {
+        logWarning("The client didn't ask for the results(%s).",
+            strerrorV(errno, errbuf));
+        return;
+    }
+    if (recvSessionHeader(connfd, &type, &arg, &arg2) < 0 ||
+        type != TYPE_RESULTS)
+    {
+        logWarning("Expected a request for the results from %s.",
+            inet_ntoa(clientaddr.sin_addr));
+    }
+    else if (rSendBytes(connfd, record, encodeResults(&lastResult, record),
+        "Can't send the results") == RET_SUCC &&
+        (!(plan.flags & FLAG_TRACE) || sendTrace(connfd) == 0))
+    {
+        logVerbose("Results sent to %s.", inet_ntoa(clientaddr.sin_addr));
+    }
+    backend->close(connfd);
+    liveStat = live;
+}
+
+// serves a run of a test of the plan on connections of its own, the
+// listeners stay open for the next one.
+static int servePlanTest(const planTest_t *t)
+{
+    loadTest(t);
+    running = 1;
+    if (acceptStreams() < 0)
+    {
+        return 0;
+    }
+    setLiveState(LIVE_RUNNING, ++planRun);
+    runStreams();
+    setLiveState(LIVE_WAITING, planRun);
+    if (plan.flags & FLAG_RESULTS)
+    {
+        serveResults();
+    }
+    return 1;
+}
+
+int serverMain(int argc, char **argv)
+{
+    usage = svusage;
+    int64_t configuring;
+    int i;
 
     if (argc == 1)
     {
@@ -215,80 +784,116 @@ int serverMain(int argc, char **argv)
     parseArguments(argc, argv);
     printInitLog();
 
-#ifdef CHECK
-    while (++i < (PACKET_LEN >> 3))
-    {
-        ((long*)packetBuf)[i] = i;
-    }
-#else
-    memset(packetBuf, 0x10, sizeof(packetBuf));
-#endif
-
     signalNoRestart(SIGALRM, sigalrmHandler);
     signalNoRestart(SIGINT, sigintHandler);
     signalNoRestart(SIGPIPE, SIG_IGN);
 
-    configure();
+    if (pooled)
+    {
+        // the buffer only changes for check tests.
+        fillPacketBuf(packetBuf);
+        waitForTest();
+        configuring = traceNow();
+        configure();
+        if (testMode == testModes + MODE_CHECK)
+        {
+            fillPacketBuf(packetBuf);
+        }
+    }
+    else
+    {
+        configuring = traceNow();
+        configure();
+        fillPacketBuf(packetBuf);
+    }
 
-    listenfd = forceOpenListenFD(sourceIP, port);
+    if (inheritedCount > 0)
+    {
+        listenCount = inheritedCount;
+        for (i = 0; i < listenCount; ++i)
+        {
+            listenfds[i] = atoi(inheritedFDs[i]);
+        }
+    }
+    else
+    {
+        // without -s, listen on all addresses.
+        listenCount = sourceCount ? sourceCount : 1;
+        for (i = 0; i < listenCount; ++i)
+        {
+            listenfds[i] = forceOpenListenFD(
+                sourceCount ? sourceIPs[i] : NULL, port,
+                mptcp ? IPPROTO_MPTCP : 0);
+        }
+    }
 
     logMessage("Listening on port %d.", port);
-    clientlen = sizeof(clientaddr);
+    attachLiveStat(port, many.conns > 0 || replay ? 1 : planRuns(&plan));
+    traceSpan(TRACE_CONFIGURE, -1, configuring);
+    // the client connects as soon as the controller replies, only report
+    // ready once the listeners are open.
+    if (rKill(getppid(), "controller", SIGUSR1) != RET_SUCC)
+    {
+        logError("Can't contact with controller!");
+    }
 
     setLock(&sigint);
     setLock(&sigalrm);
     running = 1;
 
-    while (continueTest())
+    // a single process serves all the connections of the test, it ends when
+    // the client has closed them.
+    if (many.conns > 0)
     {
-        connfd = accept(listenfd, (struct sockaddr *)&clientaddr, &clientlen);
-        if (connfd < 0)
+        setLiveState(LIVE_RUNNING, 1);
+        doManyServer(&many, listenfds, listenCount, packetBuf);
+        setLiveState(LIVE_DONE, 1);
+        for (i = 0; i < listenCount; ++i)
         {
-            if (errno == EINTR)
-            {
-                logVerbose("%s", "Accept interrupted.");
-            }
-            else
-            {
-                logError("Unable to accept connection(%s)!",
-                         strerrorV(errno, errbuf));
-            }
-            continue;
+            backend->close(listenfds[i]);
         }
-#ifdef FIX
-        int flag = 1;
-        setsockopt(connfd, IPPROTO_TCP, TCP_NODELAY, (char*)&flag, sizeof(int));
-#endif
-#ifdef PROBE
-        int flag = 1;
-        setsockopt(connfd, IPPROTO_TCP, TCP_NODELAY, (char*)&flag, sizeof(int));
-#endif
-        break;
+        logMessage("Connections closed.\n");
+        return 0;
     }
 
-    if (!continueTest())
+    if (replay)
     {
-        return 1;
+        setLiveState(LIVE_RUNNING, 1);
+        doReplay(listenfds, listenCount);
+        setLiveState(LIVE_DONE, 1);
+        for (i = 0; i < listenCount; ++i)
+        {
+            backend->close(listenfds[i]);
+        }
+        return 0;
     }
 
-    if (close(listenfd) < 0)
+    if (planRuns(&plan) > 1)
     {
-        logWarning("Error when closing listen socket(%s).", 
-            strerrorV(errno, errbuf));
+        doPlan(&plan, servePlanTest);
+        setLiveState(LIVE_DONE, planRun);
+        closeListeners();
+        return 0;
     }
 
-    haddrp = inet_ntoa(clientaddr.sin_addr);
-    clientport = clientaddr.sin_port >> 8 | clientaddr.sin_port << 8;
-    logMessage("Connected with %s:%d", haddrp, (int)clientport);
-
-    parse(connfd);
-    if (close(connfd) < 0)
+    if (acceptStreams() < 0)
     {
-        logWarning("Error when closing connection(%s).", 
-            strerrorV(errno, errbuf));
+        setLiveState(LIVE_DONE, 0);
+        return 1;
     }
-    logMessage("Connection with %s closed.\n", haddrp);
 
+    setLiveState(LIVE_RUNNING, 1);
+    // the client asks for the results on the same port.
+    if (plan.flags & FLAG_RESULTS)
+    {
+        runStreams();
+        setLiveState(LIVE_DONE, 1);
+        serveResults();
+        closeListeners();
+        return 0;
+    }
+    closeListeners();
+    runStreams();
+    setLiveState(LIVE_DONE, 1);
     return 0;
 }
-